@@ -31,11 +31,18 @@
 #include "ImfHybridInputFile.h"
 
 #include "ImfInputPart.h"
+#include "ImfDeepScanLineInputPart.h"
+#include "ImfDeepTiledInputPart.h"
+#include "ImfDeepFrameBuffer.h"
 #include "ImfPartType.h"
 
 #include "Iex.h"
+#include "IlmThreadPool.h"
+#include "half.h"
 
 #include <algorithm>
+#include <memory>
+#include <vector>
 
 
 OPENEXR_IMF_INTERNAL_NAMESPACE_SOURCE_ENTER
@@ -43,6 +50,24 @@ OPENEXR_IMF_INTERNAL_NAMESPACE_SOURCE_ENTER
 
 using namespace std;
 using IMATH_NAMESPACE::Box2i;
+using ILMTHREAD_NAMESPACE::Task;
+using ILMTHREAD_NAMESPACE::TaskGroup;
+using ILMTHREAD_NAMESPACE::ThreadPool;
+
+
+// Deep scanlines are read and flattened this many at a time,
+// so the sample buffers don't have to hold the whole image.
+#ifndef OPENEXR_DEEP_BAND_HEIGHT
+#define OPENEXR_DEEP_BAND_HEIGHT	32
+#endif
+
+
+static bool
+IsDeep(const Header &head)
+{
+	return (head.type() == OPENEXR_IMF_INTERNAL_NAMESPACE::DEEPSCANLINE ||
+			head.type() == OPENEXR_IMF_INTERNAL_NAMESPACE::DEEPTILE);
+}
 
 
 HybridInputFile::HybridInputFile(const char fileName[], bool renameFirstPart, int numThreads, bool reconstructChunkOffsetTable) :
@@ -112,11 +137,351 @@ HybridInputFile::readPixels(int scanLine1, int scanLine2)
 			
 			if(endScanline >= startScanline)
 			{
-				InputPart inPart(_multiPart, n);
+				if( IsDeep(_multiPart.header(n)) )
+				{
+					readDeepPixels(n, part_fb, startScanline, endScanline);
+				}
+				else
+				{
+					InputPart inPart(_multiPart, n);
+					
+					inPart.setFrameBuffer(part_fb);
+					
+					inPart.readPixels(startScanline, endScanline);
+				}
+			}
+		}
+	}
+}
+
+
+// One band of deep samples, laid out over the part's dataWindow columns.
+// Every deep channel is read as float.
+struct DeepBand
+{
+	int xMin;
+	int width;
+	int yMin;
+	int height;
+	
+	const unsigned int *counts;
+	const float * const *pointers; // channel c starts at pointers[c * width * height]
+	
+	int alpha; // deep channel index or -1
+	int depth;
+	
+	struct Output
+	{
+		Slice slice;
+		int channel; // deep channel index or -1 to fill
+		bool nearest; // depth channels take the front sample
+	};
+	
+	vector<Output> outputs;
+	
+	const float *samples(int channel, int x, int y) const
+	{
+		return pointers[(channel * width * height) + ((y - yMin) * width) + (x - xMin)];
+	}
+};
+
+
+static void
+WriteFlatValue(const Slice &slice, int x, int y, float value)
+{
+	if( (x % slice.xSampling) != 0 || (y % slice.ySampling) != 0 )
+		return;
+	
+	char *pix = slice.base + ((ptrdiff_t)(x / slice.xSampling) * (ptrdiff_t)slice.xStride) +
+							((ptrdiff_t)(y / slice.ySampling) * (ptrdiff_t)slice.yStride);
+	
+	switch(slice.type)
+	{
+		case OPENEXR_IMF_INTERNAL_NAMESPACE::FLOAT:
+			*(float *)pix = value;
+			break;
+		
+		case OPENEXR_IMF_INTERNAL_NAMESPACE::HALF:
+			*(half *)pix = value;
+			break;
+		
+		case OPENEXR_IMF_INTERNAL_NAMESPACE::UINT:
+			*(unsigned int *)pix = (value > 0.f ? (unsigned int)(value + 0.5f) : 0);
+			break;
+		
+		default:
+			break;
+	}
+}
+
+
+class DepthOrder
+{
+  public:
+	DepthOrder(const float *depth) : _depth(depth) {}
+	
+	bool operator () (int a, int b) const { return _depth[a] < _depth[b]; }
+	
+  private:
+	const float *_depth;
+};
+
+
+// Composites one scanline's samples front to back (they're premultiplied)
+class FlattenRowTask : public Task
+{
+  public:
+	FlattenRowTask(TaskGroup *group, const DeepBand &band, int y);
+	virtual ~FlattenRowTask() {}
+	
+	virtual void execute();
+	
+  private:
+	const DeepBand &_band;
+	const int _y;
+};
+
+
+FlattenRowTask::FlattenRowTask(TaskGroup *group, const DeepBand &band, int y) :
+	Task(group),
+	_band(band),
+	_y(y)
+{
+
+}
+
+
+void
+FlattenRowTask::execute()
+{
+	const int num_outputs = _band.outputs.size();
+	
+	vector<float> flat(num_outputs);
+	vector<int> order;
+	
+	for(int x = _band.xMin; x < _band.xMin + _band.width; x++)
+	{
+		const int count = _band.counts[((_y - _band.yMin) * _band.width) + (x - _band.xMin)];
+		
+		order.resize(count);
+		
+		for(int i=0; i < count; i++)
+			order[i] = i;
+		
+		if(_band.depth >= 0 && count > 1)
+			stable_sort(order.begin(), order.end(), DepthOrder( _band.samples(_band.depth, x, _y) ));
+		
+		
+		const float *alpha = (_band.alpha >= 0 ? _band.samples(_band.alpha, x, _y) : NULL);
+		
+		float coverage = 0.f;
+		
+		for(int o=0; o < num_outputs; o++)
+			flat[o] = 0.f;
+		
+		for(int i=0; i < count && coverage < 1.f; i++)
+		{
+			const int s = order[i];
+			
+			const float visible = 1.f - coverage;
+			
+			for(int o=0; o < num_outputs; o++)
+			{
+				const DeepBand::Output &output = _band.outputs[o];
 				
-				inPart.setFrameBuffer(part_fb);
+				if(output.channel >= 0)
+				{
+					const float value = _band.samples(output.channel, x, _y)[s];
+					
+					if(output.nearest)
+					{
+						if(i == 0)
+							flat[o] = value;
+					}
+					else
+						flat[o] += visible * value;
+				}
+			}
+			
+			// samples without alpha are opaque
+			coverage += visible * (alpha ? alpha[s] : 1.f);
+		}
+		
+		for(int o=0; o < num_outputs; o++)
+		{
+			const DeepBand::Output &output = _band.outputs[o];
+			
+			WriteFlatValue(output.slice, x, _y, (output.channel >= 0 ? flat[o] : (float)output.slice.fillValue));
+		}
+	}
+}
+
+
+void
+HybridInputFile::readDeepPixels(int part, const FrameBuffer &frameBuffer, int scanLine1, int scanLine2)
+{
+	const Header &head = _multiPart.header(part);
+	
+	const Box2i &dataW = head.dataWindow();
+	
+	const bool tiled = (head.type() == OPENEXR_IMF_INTERNAL_NAMESPACE::DEEPTILE);
+	
+	
+	// read only the deep channels we need, plus alpha and depth for compositing
+	vector<string> deep_channels;
+	
+	DeepBand band;
+	
+	band.xMin = dataW.min.x;
+	band.width = dataW.max.x - dataW.min.x + 1;
+	band.alpha = band.depth = -1;
+	
+	for(FrameBuffer::ConstIterator i = frameBuffer.begin(); i != frameBuffer.end(); ++i)
+	{
+		DeepBand::Output output;
+		
+		output.slice = i.slice();
+		output.channel = -1;
+		output.nearest = (string(i.name()) == "Z" || string(i.name()) == "ZBack");
+		
+		if( head.channels().findChannel( i.name() ) )
+		{
+			output.channel = deep_channels.size();
+			
+			deep_channels.push_back( i.name() );
+		}
+		
+		band.outputs.push_back(output);
+	}
+	
+	const char *comp_channels[2] = { "A", "Z" };
+	int *comp_index[2] = { &band.alpha, &band.depth };
+	
+	for(int c=0; c < 2; c++)
+	{
+		if( head.channels().findChannel( comp_channels[c] ) )
+		{
+			vector<string>::const_iterator found = find(deep_channels.begin(), deep_channels.end(), string(comp_channels[c]));
+			
+			*comp_index[c] = (found - deep_channels.begin());
+			
+			if(found == deep_channels.end())
+				deep_channels.push_back( comp_channels[c] );
+		}
+	}
+	
+	const int num_channels = deep_channels.size();
+	
+	
+	auto_ptr<DeepScanLineInputPart> scanlinePart;
+	auto_ptr<DeepTiledInputPart> tiledPart;
+	
+	int band_height = OPENEXR_DEEP_BAND_HEIGHT;
+	
+	if(tiled)
+	{
+		tiledPart.reset(new DeepTiledInputPart(_multiPart, part));
+		
+		band_height = head.tileDescription().ySize;
+	}
+	else
+		scanlinePart.reset(new DeepScanLineInputPart(_multiPart, part));
+	
+	
+	for(int band_start = dataW.min.y + (((scanLine1 - dataW.min.y) / band_height) * band_height);
+			band_start <= scanLine2;
+			band_start += band_height)
+	{
+		const int band_end = min(band_start + band_height - 1, dataW.max.y);
+		
+		band.yMin = band_start;
+		band.height = band_end - band_start + 1;
+		
+		const size_t band_pixels = (size_t)band.width * (size_t)band.height;
+		
+		if(_sampleCounts.size() < band_pixels * sizeof(unsigned int))
+			_sampleCounts.allocate(band_pixels * sizeof(unsigned int));
+		
+		if(_samplePointers.size() < band_pixels * num_channels * sizeof(float *))
+			_samplePointers.allocate(band_pixels * num_channels * sizeof(float *));
+		
+		unsigned int *sample_counts = (unsigned int *)_sampleCounts.data();
+		float **sample_pointers = (float **)_samplePointers.data();
+		
+		// pointers into the buffers are offset so they can be addressed by (x, y)
+		const ptrdiff_t origin_offset = ((ptrdiff_t)band.yMin * band.width) + band.xMin;
+		
+		DeepFrameBuffer deepFrameBuffer;
+		
+		deepFrameBuffer.insertSampleCountSlice( Slice(OPENEXR_IMF_INTERNAL_NAMESPACE::UINT,
+														(char *)(sample_counts - origin_offset),
+														sizeof(unsigned int),
+														sizeof(unsigned int) * band.width) );
+		
+		for(int c=0; c < num_channels; c++)
+		{
+			float **channel_pointers = &sample_pointers[c * band_pixels];
+			
+			deepFrameBuffer.insert(deep_channels[c], DeepSlice(OPENEXR_IMF_INTERNAL_NAMESPACE::FLOAT,
+																(char *)(channel_pointers - origin_offset),
+																sizeof(float *),
+																sizeof(float *) * band.width,
+																sizeof(float)) );
+		}
+		
+		
+		int tile_y = 0;
+		
+		if(tiled)
+		{
+			tile_y = (band_start - dataW.min.y) / band_height;
+			
+			tiledPart->setFrameBuffer(deepFrameBuffer);
+			tiledPart->readPixelSampleCounts(0, tiledPart->numXTiles(0) - 1, tile_y, tile_y);
+		}
+		else
+		{
+			scanlinePart->setFrameBuffer(deepFrameBuffer);
+			scanlinePart->readPixelSampleCounts(band_start, band_end);
+		}
+		
+		
+		size_t total_samples = 0;
+		
+		for(size_t p=0; p < band_pixels; p++)
+			total_samples += sample_counts[p];
+		
+		if(_samples.size() < total_samples * num_channels * sizeof(float))
+			_samples.allocate(total_samples * num_channels * sizeof(float));
+		
+		float *sample_pos = (float *)_samples.data();
+		
+		for(int c=0; c < num_channels; c++)
+		{
+			for(size_t p=0; p < band_pixels; p++)
+			{
+				sample_pointers[(c * band_pixels) + p] = sample_pos;
 				
-				inPart.readPixels(startScanline, endScanline);
+				sample_pos += sample_counts[p];
+			}
+		}
+		
+		
+		if(tiled)
+			tiledPart->readTiles(0, tiledPart->numXTiles(0) - 1, tile_y, tile_y);
+		else
+			scanlinePart->readPixels(band_start, band_end);
+		
+		
+		band.counts = sample_counts;
+		band.pointers = sample_pointers;
+		
+		{
+			TaskGroup taskGroup;
+			
+			for(int y = max(band_start, scanLine1); y <= min(band_end, scanLine2); y++)
+			{
+				ThreadPool::addGlobalTask(new FlattenRowTask(&taskGroup, band, y));
 			}
 		}
 	}
@@ -130,32 +495,31 @@ HybridInputFile::setup()
 	{
 		const Header &head = _multiPart.header(n);
 		
-		if(head.type() != OPENEXR_IMF_INTERNAL_NAMESPACE::DEEPTILE)
+		// deep parts get flattened in readPixels()
+		
+		// this will make a dataWindow that can hold the dataWindows of every part
+		_dataWindow.extendBy( head.dataWindow() );
+		
+		// all displayWindows should be the same, actually
+		_displayWindow.extendBy( head.displayWindow() );
+		
+		
+		const ChannelList &chans = head.channels();
+
+		for(ChannelList::ConstIterator i = chans.begin(); i != chans.end(); ++i)
 		{
-			// this will make a dataWindow that can hold the dataWindows of every part
-			_dataWindow.extendBy( head.dataWindow() );
+			const bool rename = (_multiPart.parts() > 1) && (n > 0 || _renameFirstPart) && head.hasName();
 			
-			// all displayWindows should be the same, actually
-			_displayWindow.extendBy( head.displayWindow() );
+			const string hybrid_name = (rename ? head.name() + "." + i.name() : i.name());
 			
+			_map[ hybrid_name ] = HybridChannel(n, i.name());
 			
-			const ChannelList &chans = head.channels();
-
-			for(ChannelList::ConstIterator i = chans.begin(); i != chans.end(); ++i)
-			{
-				const bool rename = (_multiPart.parts() > 1) && (n > 0 || _renameFirstPart) && head.hasName();
-				
-				const string hybrid_name = (rename ? head.name() + "." + i.name() : i.name());
-				
-				_map[ hybrid_name ] = HybridChannel(n, i.name());
-				
-				_chanList.insert(hybrid_name, i.channel());
-			}
+			_chanList.insert(hybrid_name, i.channel());
 		}
 	}
 	
 	if(_chanList.begin() == _chanList.end()) // empty
-		throw IEX_NAMESPACE::BaseExc("DeepTile images not supported");  // only reason this should happen
+		throw IEX_NAMESPACE::BaseExc("No channels found");
 }
 
 
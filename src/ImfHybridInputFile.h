@@ -37,6 +37,8 @@
 #include "ImfChannelList.h"
 #include "ImathBox.h"
 
+#include "OpenEXR_Premiere_Scratch.h"
+
 
 OPENEXR_IMF_INTERNAL_NAMESPACE_HEADER_ENTER
 
@@ -78,6 +80,8 @@ class IMF_EXPORT HybridInputFile : public GenericInputFile
 	
   private:
 	void setup();
+	
+	void readDeepPixels(int part, const FrameBuffer &frameBuffer, int scanLine1, int scanLine2);
 
   private:
 	MultiPartInputFile _multiPart;
@@ -101,6 +105,12 @@ class IMF_EXPORT HybridInputFile : public GenericInputFile
 	HybridChannelMap _map;
 	
 	ChannelList _chanList;
+	
+	// deep sample buffers, kept around between reads, and
+	// handed back to the scratch arena for the next frame
+	ScratchBuffer	_sampleCounts;
+	ScratchBuffer	_samplePointers;
+	ScratchBuffer	_samples;
 };
 
 
@@ -0,0 +1,332 @@
+
+//////////////////////////////////////////////////////////////////////////////
+// 
+// Copyright (c) 2015, Brendan Bolles
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+//////////////////////////////////////////////////////////////////////////////
+
+//------------------------------------------
+//
+// OpenEXR_Premiere_ChunkCache.cpp
+// 
+// OpenEXR plug-in for Adobe Premiere
+//
+//------------------------------------------
+
+
+#include "OpenEXR_Premiere_ChunkCache.h"
+
+#include <IlmThreadMutex.h>
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include <string.h>
+#include <assert.h>
+
+
+using namespace std;
+using namespace IlmThread;
+using Imf::Int64;
+
+
+typedef struct ChunkKey
+{
+	string	path;
+	Int64	modTime;
+	Int64	size;
+	Int64	block;
+	
+	ChunkKey(const ChunkCacheFile &file, Int64 b) :
+		path(file.path), modTime(file.modTime), size(file.size), block(b) {}
+	
+	bool operator < (const ChunkKey &other) const
+	{
+		if(block != other.block)
+			return (block < other.block);
+		else if(modTime != other.modTime)
+			return (modTime < other.modTime);
+		else if(size != other.size)
+			return (size < other.size);
+		else
+			return (path < other.path);
+	}
+} ChunkKey;
+
+
+typedef std::list<ChunkKey> ChunkLRU; // front is most recently used
+
+typedef struct CachedChunk
+{
+	vector<char>		data;
+	ChunkLRU::iterator	lru;
+} CachedChunk;
+
+typedef std::map<ChunkKey, CachedChunk> ChunkMap;
+
+
+static Mutex			gChunkMutex;
+static ChunkMap			gChunks;
+static ChunkLRU			gChunkLRU;
+static ChunkCacheStats	gChunkStats = {0, 0, 0, 0, 0, 0};
+
+static const size_t	kChunkLimit = OPENEXR_CHUNK_CACHE_SIZE;
+
+typedef struct GrowingFile
+{
+	ChunkCacheFile	file;
+	Int64			tablesEnd;
+} GrowingFile;
+
+typedef std::map<string, GrowingFile> GrowingFileMap; // by path
+
+static GrowingFileMap	gGrowingFiles;
+
+
+// call with the mutex locked
+static void
+EvictChunks(size_t limit)
+{
+	while(gChunkStats.bytesCached > limit && !gChunkLRU.empty())
+	{
+		ChunkMap::iterator chunk = gChunks.find( gChunkLRU.back() );
+		
+		assert(chunk != gChunks.end());
+		
+		gChunkStats.bytesCached -= chunk->second.data.size();
+		gChunkStats.evictions++;
+		
+		gChunks.erase(chunk);
+		gChunkLRU.pop_back();
+	}
+}
+
+
+bool
+ChunkCacheEnabled()
+{
+	return (kChunkLimit > 0);
+}
+
+
+bool
+ReadCachedChunk(const ChunkCacheFile &file, Int64 block, size_t offset,
+					char *dest, size_t n, size_t &copied)
+{
+	Lock lock(gChunkMutex);
+	
+	ChunkMap::iterator chunk = gChunks.find( ChunkKey(file, block) );
+	
+	if(chunk == gChunks.end())
+	{
+		gChunkStats.misses++;
+		
+		return false;
+	}
+	
+	gChunkStats.hits++;
+	
+	gChunkLRU.splice(gChunkLRU.begin(), gChunkLRU, chunk->second.lru);
+	
+	const vector<char> &data = chunk->second.data;
+	
+	copied = (offset < data.size() ? min(n, data.size() - offset) : 0);
+	
+	if(copied > 0)
+		memcpy(dest, &data[offset], copied);
+	
+	return true;
+}
+
+
+void
+StoreCachedChunk(const ChunkCacheFile &file, Int64 block,
+					const char *data, size_t len)
+{
+	Lock lock(gChunkMutex);
+	
+	gChunkStats.bytesFromDisk += len;
+	
+	if(len == 0 || len > kChunkLimit)
+		return;
+	
+	const ChunkKey key(file, block);
+	
+	if(gChunks.find(key) != gChunks.end())
+		return; // another thread got here first
+	
+	EvictChunks(kChunkLimit - len);
+	
+	CachedChunk &chunk = gChunks[key];
+	
+	chunk.data.assign(data, data + len);
+	
+	gChunkLRU.push_front(key);
+	chunk.lru = gChunkLRU.begin();
+	
+	gChunkStats.bytesCached += len;
+	
+	if(gChunkStats.bytesCached > gChunkStats.peakBytes)
+		gChunkStats.peakBytes = gChunkStats.bytesCached;
+}
+
+
+void
+NoteGrowingFile(const ChunkCacheFile &file, Int64 tablesEnd)
+{
+	Lock lock(gChunkMutex);
+	
+	GrowingFile &growing = gGrowingFiles[file.path];
+	
+	growing.file = file;
+	growing.tablesEnd = tablesEnd;
+}
+
+
+void
+ForgetGrowingFile(const ChunkCacheFile &file)
+{
+	Lock lock(gChunkMutex);
+	
+	gGrowingFiles.erase(file.path);
+}
+
+
+// The blocks that can be carried: whole ones after the chunk offset tables,
+// short of the old last block, which was partial.  Call with the mutex locked.
+static bool
+CarryBlocks(const GrowingFile &growing, const ChunkCacheFile &file, Int64 &first, Int64 &last)
+{
+	const ChunkCacheFile &old_file = growing.file;
+	
+	if(old_file.modTime == file.modTime && old_file.size == file.size)
+		return false;
+	
+	// a file that got smaller was started over, nothing to carry
+	if(file.size < old_file.size)
+		return false;
+	
+	first = (growing.tablesEnd + OPENEXR_CHUNK_CACHE_BLOCK - 1) / OPENEXR_CHUNK_CACHE_BLOCK;
+	last = (old_file.size / OPENEXR_CHUNK_CACHE_BLOCK) - 1;
+	
+	// the last one we still have decides
+	while(last >= first && gChunks.find( ChunkKey(old_file, last) ) == gChunks.end())
+		last--;
+	
+	return (first > 0 && last >= first);
+}
+
+
+bool
+GrowingFileCheckBlock(const ChunkCacheFile &file, Int64 &block)
+{
+	Lock lock(gChunkMutex);
+	
+	GrowingFileMap::iterator growing = gGrowingFiles.find(file.path);
+	
+	if(growing == gGrowingFiles.end())
+		return false;
+	
+	Int64 first = 0;
+	
+	return CarryBlocks(growing->second, file, first, block);
+}
+
+
+bool
+CarryGrowingFile(const ChunkCacheFile &file, Int64 block, const char *data, size_t len)
+{
+	Lock lock(gChunkMutex);
+	
+	GrowingFileMap::iterator growing = gGrowingFiles.find(file.path);
+	
+	if(growing == gGrowingFiles.end())
+		return false;
+	
+	const ChunkCacheFile old_file = growing->second.file;
+	
+	Int64 first = 0, last = 0;
+	
+	bool carry = (CarryBlocks(growing->second, file, first, last) && last == block);
+	
+	if(carry)
+	{
+		const vector<char> &old_data = gChunks[ ChunkKey(old_file, last) ].data;
+		
+		carry = (old_data.size() == len && memcmp(&old_data[0], data, len) == 0);
+	}
+	
+	if(carry)
+	{
+		for(Int64 b = first; b <= last; b++)
+		{
+			ChunkMap::iterator old_chunk = gChunks.find( ChunkKey(old_file, b) );
+			
+			const ChunkKey key(file, b);
+			
+			if(old_chunk != gChunks.end() && gChunks.find(key) == gChunks.end())
+			{
+				CachedChunk &chunk = gChunks[key];
+				
+				chunk.data.swap(old_chunk->second.data);
+				chunk.lru = old_chunk->second.lru;
+				
+				*chunk.lru = key;
+				
+				gChunks.erase(old_chunk);
+			}
+		}
+	}
+	
+	// if the check failed the file was started over, and the
+	// next carry will be from the blocks read for this identity
+	growing->second.file = file;
+	
+	return carry;
+}
+
+
+void
+GetChunkCacheStats(ChunkCacheStats &stats)
+{
+	Lock lock(gChunkMutex);
+	
+	stats = gChunkStats;
+}
+
+
+void
+ShutdownChunkCache()
+{
+	Lock lock(gChunkMutex);
+	
+	gChunks.clear();
+	gChunkLRU.clear();
+	
+	gGrowingFiles.clear();
+	
+	gChunkStats.bytesCached = 0;
+}
@@ -0,0 +1,119 @@
+
+//////////////////////////////////////////////////////////////////////////////
+// 
+// Copyright (c) 2015, Brendan Bolles
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+//////////////////////////////////////////////////////////////////////////////
+
+//------------------------------------------
+//
+// OpenEXR_Premiere_ChunkCache.h
+// 
+// OpenEXR plug-in for Adobe Premiere
+//
+//------------------------------------------
+
+
+#ifndef _OPENEXR_PREMIERE_CHUNKCACHE_H_
+#define _OPENEXR_PREMIERE_CHUNKCACHE_H_
+
+#include <ImfInt64.h>
+
+#include <string>
+#include <stddef.h>
+
+
+// Raw file bytes are kept in RAM in fixed-size blocks, so decoding a frame
+// again after Premiere has thrown away the pixels doesn't have to go back
+// to the disk (or the network).  Blocks are keyed by the file's path,
+// modification date and size, so a file that gets re-rendered is not
+// served stale.  Least recently used blocks go first.
+
+#ifndef OPENEXR_CHUNK_CACHE_BLOCK
+#define OPENEXR_CHUNK_CACHE_BLOCK	(1024 * 1024)
+#endif
+
+#ifndef OPENEXR_CHUNK_CACHE_SIZE
+#define OPENEXR_CHUNK_CACHE_SIZE	((size_t)512 * 1024 * 1024)
+#endif
+
+
+typedef struct ChunkCacheFile
+{
+	std::string		path;
+	Imf::Int64		modTime;
+	Imf::Int64		size;
+} ChunkCacheFile;
+
+
+// false if caching has been turned off with a zero limit
+bool ChunkCacheEnabled();
+
+// Copies up to n bytes starting at offset within the block.
+// Returns false if the block is not in the cache, otherwise sets copied,
+// which can be short of n at the end of the file.
+bool ReadCachedChunk(const ChunkCacheFile &file, Imf::Int64 block, size_t offset,
+						char *dest, size_t n, size_t &copied);
+
+// len is OPENEXR_CHUNK_CACHE_BLOCK, except for the last block of the file
+void StoreCachedChunk(const ChunkCacheFile &file, Imf::Int64 block,
+						const char *data, size_t len);
+
+
+typedef struct ChunkCacheStats
+{
+	Imf::Int64	hits;
+	Imf::Int64	misses;
+	Imf::Int64	bytesFromDisk;
+	Imf::Int64	evictions;
+	size_t		bytesCached;
+	size_t		peakBytes;
+} ChunkCacheStats;
+
+// Files still being written (render farm frames) change identity every
+// time they grow, but the blocks already written don't change, except for
+// the headers and chunk offset tables at the front, which end at tablesEnd.
+// Noting a growing file lets the next open carry the blocks after that over,
+// so only the new bytes are read when OpenEXR rebuilds the chunk table.
+void NoteGrowingFile(const ChunkCacheFile &file, Imf::Int64 tablesEnd);
+void ForgetGrowingFile(const ChunkCacheFile &file);
+
+// Called when a file is opened.  Returns false unless the file was noted
+// and has grown since, otherwise sets the last block that could be carried.
+// The caller reads that block from the disk and passes it to
+// CarryGrowingFile(), which only carries the blocks over if it matches what
+// was cached, so a render that started over isn't mixed with the last one.
+// Returns true if anything was carried.
+bool GrowingFileCheckBlock(const ChunkCacheFile &file, Imf::Int64 &block);
+bool CarryGrowingFile(const ChunkCacheFile &file, Imf::Int64 block, const char *data, size_t len);
+
+
+void GetChunkCacheStats(ChunkCacheStats &stats);
+
+// drop all cached blocks
+void ShutdownChunkCache();
+
+
+#endif // _OPENEXR_PREMIERE_CHUNKCACHE_H_
@@ -0,0 +1,713 @@
+
+//////////////////////////////////////////////////////////////////////////////
+// 
+// Copyright (c) 2015, Brendan Bolles
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+//////////////////////////////////////////////////////////////////////////////
+
+//------------------------------------------
+//
+// OpenEXR_Premiere_Convert.cpp
+// 
+// OpenEXR plug-in for Adobe Premiere
+//
+//------------------------------------------
+
+
+#include "OpenEXR_Premiere_Convert.h"
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include <string.h>
+#include <math.h>
+
+
+#ifndef OPENEXR_PREMIERE_SSE2
+	#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+		#define OPENEXR_PREMIERE_SSE2	1
+	#else
+		#define OPENEXR_PREMIERE_SSE2	0
+	#endif
+#endif
+
+// F16C is checked for at runtime, but the compiler has to be able
+// to generate it without it being turned on for the whole file
+#ifndef OPENEXR_PREMIERE_F16C
+	#if !OPENEXR_PREMIERE_SSE2
+		#define OPENEXR_PREMIERE_F16C	0
+	#elif defined(_MSC_VER)
+		#define OPENEXR_PREMIERE_F16C	(_MSC_VER >= 1700)
+	#elif defined(__clang__) && defined(__apple_build_version__)
+		#define OPENEXR_PREMIERE_F16C	(__clang_major__ >= 8)
+	#elif defined(__clang__)
+		#define OPENEXR_PREMIERE_F16C	(__clang_major__ > 3 || (__clang_major__ == 3 && __clang_minor__ >= 8))
+	#elif defined(__GNUC__)
+		#define OPENEXR_PREMIERE_F16C	(__GNUC__ >= 5)
+	#else
+		#define OPENEXR_PREMIERE_F16C	0
+	#endif
+#endif
+
+
+#if OPENEXR_PREMIERE_SSE2
+	#include <emmintrin.h>
+#endif
+
+#if OPENEXR_PREMIERE_F16C
+	#include <immintrin.h>
+
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#define F16C_TARGET
+	#else
+		#include <cpuid.h>
+		#define F16C_TARGET	__attribute__((target("f16c")))
+	#endif
+#endif
+
+
+template <typename OutFormat>
+static void
+ConvertBgraRow_Scalar(const float *in, OutFormat *out, int length, bool premult)
+{
+	if(premult)
+	{
+		for(int x=0; x < length; x++)
+		{
+			const float a = in[3];
+			
+			if(a != 1.f)
+			{
+				out[0] = in[0] * a;
+				out[1] = in[1] * a;
+				out[2] = in[2] * a;
+			}
+			else
+			{
+				out[0] = in[0];
+				out[1] = in[1];
+				out[2] = in[2];
+			}
+			
+			out[3] = a;
+			
+			in += 4;
+			out += 4;
+		}
+	}
+	else
+	{
+		for(int x=0; x < (length * 4); x++)
+		{
+			*out++ = *in++;
+		}
+	}
+}
+
+
+#if OPENEXR_PREMIERE_SSE2
+
+// multiplies B, G and R by A, leaving A alone
+static inline __m128
+PremultiplyBgra(__m128 bgra, __m128 bgr_mask, __m128 alpha_one)
+{
+	const __m128 a = _mm_shuffle_ps(bgra, bgra, _MM_SHUFFLE(3, 3, 3, 3));
+	
+	return _mm_mul_ps(bgra, _mm_or_ps(_mm_and_ps(a, bgr_mask), alpha_one));
+}
+
+
+static void
+ConvertBgraRowFloat_SSE2(const float *in, float *out, int length, bool premult)
+{
+	if(!premult)
+	{
+		memcpy(out, in, sizeof(float) * 4 * length);
+		
+		return;
+	}
+	
+	const __m128 bgr_mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	const __m128 alpha_one = _mm_set_ps(1.f, 0.f, 0.f, 0.f);
+	
+	for(int x=0; x < length; x++)
+	{
+		_mm_storeu_ps(out, PremultiplyBgra(_mm_loadu_ps(in), bgr_mask, alpha_one));
+		
+		in += 4;
+		out += 4;
+	}
+}
+
+#endif // OPENEXR_PREMIERE_SSE2
+
+
+#if OPENEXR_PREMIERE_F16C
+
+static bool
+CPUHasF16C()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	
+	const unsigned int ecx = info[2];
+#else
+	unsigned int eax, ebx, ecx, edx;
+	
+	if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+#endif
+
+	const unsigned int osxsave = (1 << 27);
+	const unsigned int avx = (1 << 28);
+	const unsigned int f16c = (1 << 29);
+	
+	if((ecx & (osxsave | avx | f16c)) != (osxsave | avx | f16c))
+		return false;
+	
+	// F16C instructions are VEX encoded, so the OS has to be saving the AVX state
+#ifdef _MSC_VER
+	const unsigned long long xcr0 = _xgetbv(0);
+#else
+	unsigned int xcr0_lo, xcr0_hi;
+	
+	__asm__ __volatile__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+	
+	const unsigned long long xcr0 = ((unsigned long long)xcr0_hi << 32) | xcr0_lo;
+#endif
+
+	return ((xcr0 & 0x6) == 0x6);
+}
+
+
+F16C_TARGET static void
+ConvertBgraRowHalf_F16C(const float *in, half *out, int length, bool premult)
+{
+	const __m128 bgr_mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	const __m128 alpha_one = _mm_set_ps(1.f, 0.f, 0.f, 0.f);
+	
+	// half rounds to nearest even, and so does mode 0
+	if(premult)
+	{
+		for(int x=0; x < length; x++)
+		{
+			const __m128 bgra = PremultiplyBgra(_mm_loadu_ps(in), bgr_mask, alpha_one);
+			
+			_mm_storel_epi64((__m128i *)out, _mm_cvtps_ph(bgra, 0));
+			
+			in += 4;
+			out += 4;
+		}
+	}
+	else
+	{
+		for(int x=0; x < length; x++)
+		{
+			_mm_storel_epi64((__m128i *)out, _mm_cvtps_ph(_mm_loadu_ps(in), 0));
+			
+			in += 4;
+			out += 4;
+		}
+	}
+}
+
+F16C_TARGET static void
+ConvertBgraRowFromHalf_F16C(const half *in, float *out, int length)
+{
+	for(int x=0; x < length; x++)
+	{
+		_mm_storeu_ps(out, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)in)));
+		
+		in += 4;
+		out += 4;
+	}
+}
+
+#endif // OPENEXR_PREMIERE_F16C
+
+
+static void
+ConvertBgraRowFromHalf_Scalar(const half *in, float *out, int length)
+{
+	for(int x=0; x < (length * 4); x++)
+	{
+		*out++ = *in++;
+	}
+}
+
+
+typedef void (*ConvertHalfRowProc)(const float *in, half *out, int length, bool premult);
+typedef void (*ConvertFromHalfRowProc)(const half *in, float *out, int length);
+typedef void (*ConvertFloatRowProc)(const float *in, float *out, int length, bool premult);
+
+
+// every pixel gets a different combination of color values and alpha
+static void
+MakeCheckRow(std::vector<float> &row)
+{
+	const float inf = std::numeric_limits<float>::infinity();
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	
+	const float values[] = { 0.f, -0.f, 1.f, -1.f, 0.1f, 1.f / 3.f, 0.5f, 2048.5f,
+								65504.f, 65519.f, 65520.f, 1e6f, -1e6f,
+								6.1035156e-5f, 6.0e-5f, 1.0e-5f, 5.9604645e-8f, 2.9802322e-8f, 4.0e-8f,
+								-1.0e-5f, 1.0e-40f, std::numeric_limits<float>::denorm_min(),
+								inf, -inf, nan };
+	
+	const float alphas[] = { 1.f, 0.f, 0.5f, 0.25f, 2.f, -0.5f, 1.0e-5f, inf, nan };
+	
+	const int num_values = sizeof(values) / sizeof(values[0]);
+	const int num_alphas = sizeof(alphas) / sizeof(alphas[0]);
+	
+	const int length = num_values * num_alphas;
+	
+	row.resize(length * 4);
+	
+	for(int p=0; p < length; p++)
+	{
+		row[(p * 4) + 0] = values[p % num_values];
+		row[(p * 4) + 1] = values[(p + 7) % num_values];
+		row[(p * 4) + 2] = values[(p + 13) % num_values];
+		row[(p * 4) + 3] = alphas[p / num_values];
+	}
+}
+
+
+static bool
+HalfConverterMatches(ConvertHalfRowProc proc)
+{
+	std::vector<float> in;
+	MakeCheckRow(in);
+	
+	const int length = in.size() / 4;
+	
+	std::vector<half> expected(in.size()), got(in.size());
+	
+	for(int premult=0; premult < 2; premult++)
+	{
+		ConvertBgraRow_Scalar<half>(&in[0], &expected[0], length, premult);
+		proc(&in[0], &got[0], length, premult);
+		
+		for(size_t i=0; i < in.size(); i++)
+		{
+			if( !(expected[i].bits() == got[i].bits() || (expected[i].isNan() && got[i].isNan())) )
+				return false;
+		}
+	}
+	
+	return true;
+}
+
+
+static bool
+FloatConverterMatches(ConvertFloatRowProc proc)
+{
+	std::vector<float> in;
+	MakeCheckRow(in);
+	
+	const int length = in.size() / 4;
+	
+	std::vector<float> expected(in.size()), got(in.size());
+	
+	for(int premult=0; premult < 2; premult++)
+	{
+		ConvertBgraRow_Scalar<float>(&in[0], &expected[0], length, premult);
+		proc(&in[0], &got[0], length, premult);
+		
+		for(size_t i=0; i < in.size(); i++)
+		{
+			const bool both_nan = (expected[i] != expected[i] && got[i] != got[i]);
+			
+			if( !(both_nan || memcmp(&expected[i], &got[i], sizeof(float)) == 0) )
+				return false;
+		}
+	}
+	
+	return true;
+}
+
+
+static ConvertHalfRowProc
+ChooseHalfConverter()
+{
+#if OPENEXR_PREMIERE_F16C
+	// should never fail, but if it does we'd rather be slow than wrong
+	if( CPUHasF16C() && HalfConverterMatches(ConvertBgraRowHalf_F16C) )
+		return ConvertBgraRowHalf_F16C;
+#endif
+
+	return ConvertBgraRow_Scalar<half>;
+}
+
+static const ConvertHalfRowProc gConvertHalfRow = ChooseHalfConverter();
+
+
+// half to float is exact, so every half there is gets checked
+static bool
+FromHalfConverterMatches(ConvertFromHalfRowProc proc)
+{
+	const int length = (1 << 16) / 4;
+	
+	std::vector<half> in(length * 4);
+	
+	for(int i=0; i < (1 << 16); i++)
+		in[i].setBits(i);
+	
+	std::vector<float> expected(in.size()), got(in.size());
+	
+	ConvertBgraRowFromHalf_Scalar(&in[0], &expected[0], length);
+	proc(&in[0], &got[0], length);
+	
+	for(size_t i=0; i < in.size(); i++)
+	{
+		const bool both_nan = (expected[i] != expected[i] && got[i] != got[i]);
+		
+		if( !(both_nan || memcmp(&expected[i], &got[i], sizeof(float)) == 0) )
+			return false;
+	}
+	
+	return true;
+}
+
+
+static ConvertFromHalfRowProc
+ChooseFromHalfConverter()
+{
+#if OPENEXR_PREMIERE_F16C
+	if( CPUHasF16C() && FromHalfConverterMatches(ConvertBgraRowFromHalf_F16C) )
+		return ConvertBgraRowFromHalf_F16C;
+#endif
+
+	return ConvertBgraRowFromHalf_Scalar;
+}
+
+static const ConvertFromHalfRowProc gConvertFromHalfRow = ChooseFromHalfConverter();
+
+
+void
+ConvertBgraRow(const half *in, float *out, int length)
+{
+	gConvertFromHalfRow(in, out, length);
+}
+
+
+void
+ConvertBgraRow(const float *in, half *out, int length, bool premult)
+{
+	gConvertHalfRow(in, out, length, premult);
+}
+
+
+void
+ConvertBgraRow(const float *in, float *out, int length, bool premult)
+{
+#if OPENEXR_PREMIERE_SSE2
+	ConvertBgraRowFloat_SSE2(in, out, length, premult);
+#else
+	ConvertBgraRow_Scalar<float>(in, out, length, premult);
+#endif
+}
+
+
+// Premiere's 16u is 0-32768.  The tables map the bits of a half straight
+// to it, [1] gamma 2.2 encoding a linear value on the way.
+static unsigned short gHalfTo16u[2][1 << 16];
+
+static bool
+BuildLowBitTables()
+{
+	for(int i=0; i < (1 << 16); i++)
+	{
+		half h;
+		h.setBits(i);
+		
+		const float v = h;
+		
+		if( !(v > 0.f) ) // also catches NaN
+		{
+			gHalfTo16u[0][i] = gHalfTo16u[1][i] = 0;
+		}
+		else if(v >= 1.f)
+		{
+			gHalfTo16u[0][i] = gHalfTo16u[1][i] = 32768;
+		}
+		else
+		{
+			gHalfTo16u[0][i] = (v * 32768.f) + 0.5f;
+			gHalfTo16u[1][i] = (powf(v, 1.f / 2.2f) * 32768.f) + 0.5f;
+		}
+	}
+	
+	return true;
+}
+
+static const bool gLowBitTablesBuilt = BuildLowBitTables();
+
+
+static inline unsigned short
+To16u(float v)
+{
+	return (v >= 1.f ? 32768 : v > 0.f ? (unsigned short)((v * 32768.f) + 0.5f) : 0);
+}
+
+static inline void
+StoreLowBit(unsigned short *out, unsigned short v)
+{
+	*out = v;
+}
+
+static inline void
+StoreLowBit(unsigned char *out, unsigned short v)
+{
+	*out = ((v * 255) + 16384) >> 15;
+}
+
+
+template <typename OutFormat>
+static void
+ConvertBgraRowLowBit_Scalar(const float *in, OutFormat *out, int length, bool linear)
+{
+	for(int x=0; x < length; x++)
+	{
+		for(int c=0; c < 3; c++)
+			StoreLowBit(out++, linear ? gHalfTo16u[1][ half(in[c]).bits() ] : To16u(in[c]));
+		
+		StoreLowBit(out++, To16u(in[3]));
+		
+		in += 4;
+	}
+}
+
+
+#if OPENEXR_PREMIERE_SSE2
+
+// To16u() four at a time
+static inline __m128i
+To16u_SSE2(__m128 v)
+{
+	const __m128 scale = _mm_set1_ps(32768.f);
+	const __m128 round = _mm_set1_ps(0.5f);
+	
+	// max returns its second argument for NaN
+	const __m128 clamped = _mm_min_ps(_mm_max_ps(_mm_mul_ps(v, scale), _mm_setzero_ps()), scale);
+	
+	const __m128i i = _mm_cvttps_epi32(_mm_add_ps(clamped, round));
+	
+	// 32768 doesn't fit a signed pack, so pack it offset and flip the top bit back
+	const __m128i packed = _mm_packs_epi32(_mm_sub_epi32(i, _mm_set1_epi32(32768)), _mm_setzero_si128());
+	
+	return _mm_xor_si128(packed, _mm_set1_epi16((short)0x8000));
+}
+
+
+static inline void
+StoreLowBitChunk(unsigned short *out, const unsigned short *pix, int count)
+{
+	memcpy(out, pix, sizeof(unsigned short) * count);
+}
+
+
+// StoreLowBit() eight at a time, 255 * v being (v << 8) - v
+static inline void
+StoreLowBitChunk(unsigned char *out, const unsigned short *pix, int count)
+{
+	const __m128i round = _mm_set1_epi32(16384);
+	
+	int i = 0;
+	
+	for(; i <= (count - 8); i += 8)
+	{
+		const __m128i v = _mm_loadu_si128((const __m128i *)&pix[i]);
+		
+		const __m128i lo = _mm_unpacklo_epi16(v, _mm_setzero_si128());
+		const __m128i hi = _mm_unpackhi_epi16(v, _mm_setzero_si128());
+		
+		const __m128i lo8 = _mm_srli_epi32(_mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(lo, 8), lo), round), 15);
+		const __m128i hi8 = _mm_srli_epi32(_mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(hi, 8), hi), round), 15);
+		
+		const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(lo8, hi8), _mm_setzero_si128());
+		
+		_mm_storel_epi64((__m128i *)&out[i], packed);
+	}
+	
+	for(; i < count; i++)
+		StoreLowBit(&out[i], pix[i]);
+}
+
+
+template <typename OutFormat>
+static void
+ConvertBgraRowLowBit_SSE2(const float *in, OutFormat *out, int length, bool linear)
+{
+	const int chunk_length = 64;
+	
+	half half_pix[chunk_length * 4];
+	unsigned short pix[(chunk_length * 4) + 4];
+	
+	for(int chunk_start=0; chunk_start < length; chunk_start += chunk_length)
+	{
+		const int chunk = std::min(chunk_length, length - chunk_start);
+		
+		for(int x=0; x < chunk; x++)
+		{
+			_mm_storel_epi64((__m128i *)&pix[x * 4], To16u_SSE2(_mm_loadu_ps(&in[x * 4])));
+		}
+		
+		if(linear)
+		{
+			gConvertHalfRow(in, half_pix, chunk, false);
+			
+			for(int x=0; x < chunk; x++)
+			{
+				for(int c=0; c < 3; c++)
+					pix[(x * 4) + c] = gHalfTo16u[1][ half_pix[(x * 4) + c].bits() ];
+			}
+		}
+		
+		StoreLowBitChunk(out, pix, chunk * 4);
+		
+		in += (chunk * 4);
+		out += (chunk * 4);
+	}
+}
+
+#endif // OPENEXR_PREMIERE_SSE2
+
+
+template <typename OutFormat>
+static void
+ConvertBgraRowLowBit_Dispatch(const float *in, OutFormat *out, int length, bool linear)
+{
+#if OPENEXR_PREMIERE_SSE2
+	ConvertBgraRowLowBit_SSE2<OutFormat>(in, out, length, linear);
+#else
+	ConvertBgraRowLowBit_Scalar<OutFormat>(in, out, length, linear);
+#endif
+}
+
+
+void
+ConvertBgraRowLowBit(const float *in, unsigned char *out, int length, bool linear)
+{
+	ConvertBgraRowLowBit_Dispatch<unsigned char>(in, out, length, linear);
+}
+
+
+void
+ConvertBgraRowLowBit(const float *in, unsigned short *out, int length, bool linear)
+{
+	ConvertBgraRowLowBit_Dispatch<unsigned short>(in, out, length, linear);
+}
+
+
+// rgba swaps red and blue on the way
+template <typename OutFormat>
+static void
+ConvertHalfRowLowBit_Table(const half *in, OutFormat *out, int length, bool linear, bool rgba)
+{
+	const unsigned short *color_table = gHalfTo16u[linear ? 1 : 0];
+	const unsigned short *alpha_table = gHalfTo16u[0];
+	
+	const int first = (rgba ? 2 : 0);
+	const int last = (rgba ? 0 : 2);
+	
+	for(int x=0; x < length; x++)
+	{
+		StoreLowBit(out++, color_table[ in[first].bits() ]);
+		StoreLowBit(out++, color_table[ in[1].bits() ]);
+		StoreLowBit(out++, color_table[ in[last].bits() ]);
+		StoreLowBit(out++, alpha_table[ in[3].bits() ]);
+		
+		in += 4;
+	}
+}
+
+
+void
+ConvertRgbaRowLowBit(const half *in, unsigned char *out, int length, bool linear)
+{
+	ConvertHalfRowLowBit_Table<unsigned char>(in, out, length, linear, true);
+}
+
+
+void
+ConvertRgbaRowLowBit(const half *in, unsigned short *out, int length, bool linear)
+{
+	ConvertHalfRowLowBit_Table<unsigned short>(in, out, length, linear, true);
+}
+
+
+void
+ConvertBgraRowLowBit(const half *in, unsigned char *out, int length, bool linear)
+{
+	ConvertHalfRowLowBit_Table<unsigned char>(in, out, length, linear, false);
+}
+
+
+void
+ConvertBgraRowLowBit(const half *in, unsigned short *out, int length, bool linear)
+{
+	ConvertHalfRowLowBit_Table<unsigned short>(in, out, length, linear, false);
+}
+
+
+static bool
+LowBitConverterMatches()
+{
+	std::vector<float> in;
+	MakeCheckRow(in);
+	
+	const int length = in.size() / 4;
+	
+	std::vector<unsigned short> expected(in.size()), got(in.size());
+	std::vector<unsigned char> expected8(in.size()), got8(in.size());
+	
+	for(int linear=0; linear < 2; linear++)
+	{
+		ConvertBgraRowLowBit_Scalar<unsigned short>(&in[0], &expected[0], length, linear);
+		ConvertBgraRowLowBit(&in[0], &got[0], length, linear);
+		
+		ConvertBgraRowLowBit_Scalar<unsigned char>(&in[0], &expected8[0], length, linear);
+		ConvertBgraRowLowBit(&in[0], &got8[0], length, linear);
+		
+		if(expected != got || expected8 != got8)
+			return false;
+	}
+	
+	return true;
+}
+
+
+bool
+CheckConvertBgraRow()
+{
+	ConvertFloatRowProc float_proc = ConvertBgraRow;
+	
+	return (HalfConverterMatches(gConvertHalfRow) && FloatConverterMatches(float_proc) &&
+			FromHalfConverterMatches(gConvertFromHalfRow) && LowBitConverterMatches());
+}
@@ -0,0 +1,77 @@
+
+//////////////////////////////////////////////////////////////////////////////
+// 
+// Copyright (c) 2015, Brendan Bolles
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+//////////////////////////////////////////////////////////////////////////////
+
+//------------------------------------------
+//
+// OpenEXR_Premiere_Convert.h
+// 
+// OpenEXR plug-in for Adobe Premiere
+//
+//------------------------------------------
+
+
+#ifndef _OPENEXR_PREMIERE_CONVERT_H_
+#define _OPENEXR_PREMIERE_CONVERT_H_
+
+#include <half.h>
+
+
+// Premiere's float BGRA rows to the pixels we write, premultiplying
+// in the same pass when asked.  Half conversion uses F16C if the CPU
+// has it, OpenEXR's tables otherwise.  Pointers need no alignment.
+
+void ConvertBgraRow(const float *in, half *out, int length, bool premult);
+void ConvertBgraRow(const float *in, float *out, int length, bool premult);
+
+
+// Runs the converters in use against the plain C++ ones on awkward values
+// (signed zeros, denormals, rounding ties, overflow, Inf, NaN) and
+// returns true if every result is the same, bit for bit.
+// NaNs only have to stay NaNs, their payloads can differ.
+bool CheckConvertBgraRow();
+
+
+// Premiere's float BGRA rows to its 8u (0-255) and 16u (0-32768) formats.
+// With linear set the colors get gamma 2.2 encoded on the way.  Values are
+// clamped, NaN becomes 0.  The colors go through half, so they get looked up.
+
+void ConvertBgraRowLowBit(const float *in, unsigned char *out, int length, bool linear);
+void ConvertBgraRowLowBit(const float *in, unsigned short *out, int length, bool linear);
+
+// Same, from OpenEXR's RGBA halves, the way RgbaInputFile reads them
+void ConvertRgbaRowLowBit(const half *in, unsigned char *out, int length, bool linear);
+void ConvertRgbaRowLowBit(const half *in, unsigned short *out, int length, bool linear);
+
+// Half BGRA rows, as the disk cache keeps frames, back to Premiere's formats
+void ConvertBgraRow(const half *in, float *out, int length);
+void ConvertBgraRowLowBit(const half *in, unsigned char *out, int length, bool linear);
+void ConvertBgraRowLowBit(const half *in, unsigned short *out, int length, bool linear);
+
+
+#endif // _OPENEXR_PREMIERE_CONVERT_H_
@@ -0,0 +1,736 @@
+
+//////////////////////////////////////////////////////////////////////////////
+// 
+// Copyright (c) 2015, Brendan Bolles
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+//////////////////////////////////////////////////////////////////////////////
+
+//------------------------------------------
+//
+// OpenEXR_Premiere_DiskCache.cpp
+// 
+// OpenEXR plug-in for Adobe Premiere
+//
+//------------------------------------------
+
+
+#include "OpenEXR_Premiere_DiskCache.h"
+
+#include "OpenEXR_Premiere_Tasks.h"
+#include "OpenEXR_Premiere_Scratch.h"
+#include "OpenEXR_Premiere_Convert.h"
+
+#include <IlmThreadMutex.h>
+#include <half.h>
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#ifdef __APPLE__
+	#include <dirent.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <sys/time.h>
+#else
+	#include <windows.h>
+#endif
+
+
+using namespace std;
+using namespace IlmThread;
+using Imf::Int64;
+
+
+static const char kCacheMagic[4] = { 'o', 'E', 'X', 'f' };
+static const unsigned int kCacheVersion = 2; // half pixels
+
+static const char *kCacheExtension = ".exrframe";
+static const char *kTempExtension = ".tmp";
+
+// a temp file this old was left by a crash, writes take a second or two
+static const int kOrphanSeconds = 60 * 60;
+
+// trimming goes a bit under the limit, so the next write doesn't trim again
+static const double kTrimFraction = 0.9;
+
+static const size_t kCacheDataAlignment = 4096; // pixels start on a page boundary
+
+static const int kMaxPendingWrites = 2;
+
+
+typedef struct DiskCacheHeader
+{
+	char			magic[4];
+	unsigned int	version;
+	unsigned int	width;
+	unsigned int	height;
+	unsigned int	keyLength; // key follows the header
+	unsigned int	dataOffset;
+} DiskCacheHeader;
+
+
+static Mutex			gDiskCacheMutex;
+static bool				gConfigured = false;
+static string			gCacheDir;
+static Int64			gCacheLimit = 0;
+static DiskCacheStats	gDiskCacheStats = {0, 0, 0, 0, 0};
+
+static PriorityTaskGroup	*gWriteGroup = NULL;
+static int					gPendingWrites = 0;
+static unsigned int			gTempCounter = 0;
+
+// running total of the folder, -1 until it's been scanned
+static Int64			gCacheSize = -1;
+
+static Mutex			gTrimMutex;
+
+
+// call with the mutex locked
+static void
+Configure()
+{
+	if(gConfigured)
+		return;
+	
+	gConfigured = true;
+	
+	const char *dir = getenv(OPENEXR_FRAME_CACHE_ENV);
+	
+	if(dir == NULL || *dir == '\0')
+		return;
+	
+	gCacheDir = dir;
+	
+#ifdef __APPLE__
+	if(gCacheDir[gCacheDir.size() - 1] != '/')
+		gCacheDir += '/';
+#else
+	if(gCacheDir[gCacheDir.size() - 1] != '\\' && gCacheDir[gCacheDir.size() - 1] != '/')
+		gCacheDir += '\\';
+#endif
+	
+	const char *gb = getenv(OPENEXR_FRAME_CACHE_GB_ENV);
+	
+	const double limit_gb = (gb != NULL ? atof(gb) : OPENEXR_FRAME_CACHE_DEFAULT_GB);
+	
+	gCacheLimit = (Int64)(limit_gb * 1024.0 * 1024.0 * 1024.0);
+	
+	if(gCacheLimit <= 0)
+		gCacheDir.clear();
+}
+
+
+bool
+DiskCacheEnabled()
+{
+	Lock lock(gDiskCacheMutex);
+	
+	Configure();
+	
+	return !gCacheDir.empty();
+}
+
+
+std::string
+DiskCacheKey(const ChunkCacheFile &file, const char * const chan[4],
+				bool bypassConversion, int pixelFormat, int width, int height)
+{
+	stringstream s;
+	
+	s << file.path.size() << ':' << file.path << '|' << file.modTime << '|' << file.size;
+	
+	for(int c=0; c < 4; c++)
+		s << '|' << chan[c];
+	
+	s << '|' << bypassConversion << '|' << pixelFormat << '|' << width << 'x' << height;
+	
+	return s.str();
+}
+
+
+// FNV-1a, names the cache file; the full key is checked inside
+static string
+CachePath(const string &key)
+{
+	Int64 hash = 0xcbf29ce484222325LL;
+	
+	for(size_t i=0; i < key.size(); i++)
+	{
+		hash ^= (unsigned char)key[i];
+		hash *= 0x100000001b3LL;
+	}
+	
+	char name[32];
+	sprintf(name, "%016llx", (unsigned long long)hash);
+	
+	Lock lock(gDiskCacheMutex);
+	
+	return gCacheDir + name + kCacheExtension;
+}
+
+
+// bump the modification date, which is what the LRU goes by
+static void
+TouchFile(const string &path)
+{
+#ifdef __APPLE__
+	utimes(path.c_str(), NULL);
+#else
+	HANDLE fileH = CreateFileA(path.c_str(), FILE_WRITE_ATTRIBUTES,
+								FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+								NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	
+	if(fileH != INVALID_HANDLE_VALUE)
+	{
+		FILETIME now;
+		GetSystemTimeAsFileTime(&now);
+		
+		SetFileTime(fileH, NULL, NULL, &now);
+		
+		CloseHandle(fileH);
+	}
+#endif
+}
+
+
+DiskCachedFrame::DiskCachedFrame() :
+	_data(NULL),
+	_rowbytes(0),
+	_map(NULL),
+	_mapSize(0)
+#ifndef __APPLE__
+	, _fileH(INVALID_HANDLE_VALUE),
+	_mapH(NULL)
+#endif
+{
+
+}
+
+
+DiskCachedFrame::~DiskCachedFrame()
+{
+	close();
+}
+
+
+bool
+DiskCachedFrame::open(const std::string &key, int width, int height)
+{
+	close();
+	
+	const string path = CachePath(key);
+	
+#ifdef __APPLE__
+	int fd = ::open(path.c_str(), O_RDONLY);
+	
+	if(fd >= 0)
+	{
+		struct stat st;
+		
+		if(fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			
+			if(map != MAP_FAILED)
+			{
+				_map = (char *)map;
+				_mapSize = st.st_size;
+			}
+		}
+		
+		::close(fd);
+	}
+#else
+	_fileH = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+							NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	
+	if(_fileH != INVALID_HANDLE_VALUE)
+	{
+		LARGE_INTEGER size;
+		
+		if(GetFileSizeEx(_fileH, &size) && size.QuadPart > 0)
+		{
+			_mapH = CreateFileMappingA(_fileH, NULL, PAGE_READONLY, 0, 0, NULL);
+			
+			if(_mapH != NULL)
+			{
+				_map = (char *)MapViewOfFile(_mapH, FILE_MAP_READ, 0, 0, 0);
+				
+				if(_map != NULL)
+					_mapSize = (size_t)size.QuadPart;
+			}
+		}
+	}
+#endif
+	
+	const DiskCacheHeader *header = (const DiskCacheHeader *)_map;
+	
+	const ptrdiff_t rowbytes = sizeof(half) * 4 * width;
+	
+	const bool valid = (_map != NULL &&
+						_mapSize >= sizeof(DiskCacheHeader) &&
+						memcmp(header->magic, kCacheMagic, 4) == 0 &&
+						header->version == kCacheVersion &&
+						header->width == (unsigned int)width &&
+						header->height == (unsigned int)height &&
+						header->keyLength == key.size() &&
+						sizeof(DiskCacheHeader) + header->keyLength <= header->dataOffset &&
+						header->dataOffset + ((size_t)rowbytes * height) <= _mapSize &&
+						memcmp(_map + sizeof(DiskCacheHeader), key.data(), key.size()) == 0);
+	
+	{
+		Lock lock(gDiskCacheMutex);
+		
+		if(valid)
+			gDiskCacheStats.hits++;
+		else
+			gDiskCacheStats.misses++;
+	}
+	
+	if(!valid)
+	{
+		close();
+		
+		return false;
+	}
+	
+	_data = _map + header->dataOffset;
+	_rowbytes = rowbytes;
+	
+	TouchFile(path);
+	
+	return true;
+}
+
+
+void
+DiskCachedFrame::close()
+{
+#ifdef __APPLE__
+	if(_map != NULL)
+		munmap(_map, _mapSize);
+#else
+	if(_map != NULL)
+		UnmapViewOfFile(_map);
+	
+	if(_mapH != NULL)
+		CloseHandle(_mapH);
+	
+	if(_fileH != INVALID_HANDLE_VALUE)
+		CloseHandle(_fileH);
+	
+	_fileH = INVALID_HANDLE_VALUE;
+	_mapH = NULL;
+#endif
+	
+	_map = NULL;
+	_mapSize = 0;
+	_data = NULL;
+	_rowbytes = 0;
+}
+
+
+typedef struct CacheFileInfo
+{
+	string	path;
+	Int64	size;
+	Int64	modTime;
+	
+	bool operator < (const CacheFileInfo &other) const { return (modTime < other.modTime); }
+} CacheFileInfo;
+
+
+static bool
+EndsWith(const string &name, const char *suffix)
+{
+	const size_t len = strlen(suffix);
+	
+	return (name.size() > len && name.compare(name.size() - len, len, suffix) == 0);
+}
+
+
+// Scan the folder for the real size, deleting temp files left by a crash,
+// then delete the least recently used frames if it's over the limit.
+// Only happens the first time and when the running total goes over.
+static void
+TrimCache()
+{
+	Lock trim_lock(gTrimMutex);
+	
+	string dir;
+	Int64 limit = 0;
+	
+	{
+		Lock lock(gDiskCacheMutex);
+		
+		dir = gCacheDir;
+		limit = gCacheLimit;
+	}
+	
+	vector<CacheFileInfo> files;
+	Int64 total = 0;
+	
+#ifdef __APPLE__
+	DIR *dirP = opendir(dir.c_str());
+	
+	if(dirP == NULL)
+		return;
+	
+	const time_t now = time(NULL);
+	
+	struct dirent *entry = NULL;
+	
+	while( (entry = readdir(dirP)) )
+	{
+		const string name = entry->d_name;
+		
+		const bool frame = EndsWith(name, kCacheExtension);
+		const bool temp = (!frame && EndsWith(name, kTempExtension) && name.find(kCacheExtension) != string::npos);
+		
+		if(frame || temp)
+		{
+			CacheFileInfo info;
+			info.path = dir + name;
+			
+			struct stat st;
+			
+			if(stat(info.path.c_str(), &st) == 0)
+			{
+				if(temp)
+				{
+					if(now - st.st_mtime > kOrphanSeconds)
+						remove(info.path.c_str());
+				}
+				else
+				{
+					info.size = st.st_size;
+					info.modTime = st.st_mtime;
+					
+					files.push_back(info);
+					total += info.size;
+				}
+			}
+		}
+	}
+	
+	closedir(dirP);
+#else
+	WIN32_FIND_DATAA findData;
+	
+	HANDLE findH = FindFirstFileA((dir + "*" + kCacheExtension + "*").c_str(), &findData);
+	
+	if(findH == INVALID_HANDLE_VALUE)
+		return;
+	
+	FILETIME now_ft;
+	GetSystemTimeAsFileTime(&now_ft);
+	
+	const Int64 now = ((Int64)now_ft.dwHighDateTime << 32) | now_ft.dwLowDateTime;
+	
+	do{
+		const string name = findData.cFileName;
+		
+		CacheFileInfo info;
+		
+		info.path = dir + name;
+		info.size = ((Int64)findData.nFileSizeHigh << 32) | findData.nFileSizeLow;
+		info.modTime = ((Int64)findData.ftLastWriteTime.dwHighDateTime << 32) | findData.ftLastWriteTime.dwLowDateTime;
+		
+		if( EndsWith(name, kCacheExtension) )
+		{
+			files.push_back(info);
+			total += info.size;
+		}
+		else if( EndsWith(name, kTempExtension) )
+		{
+			// FILETIME counts 100 ns
+			if(now - info.modTime > (Int64)kOrphanSeconds * 10000000)
+				remove(info.path.c_str());
+		}
+	
+	}while( FindNextFileA(findH, &findData) );
+	
+	FindClose(findH);
+#endif
+	
+	if(total > limit)
+	{
+		const Int64 target = (Int64)(limit * kTrimFraction);
+		
+		sort(files.begin(), files.end());
+		
+		for(vector<CacheFileInfo>::const_iterator i = files.begin(); i != files.end() && total > target; ++i)
+		{
+			// will fail on Windows if someone has it mapped, fine
+			if(remove(i->path.c_str()) == 0)
+			{
+				total -= i->size;
+				
+				Lock lock(gDiskCacheMutex);
+				
+				gDiskCacheStats.evictions++;
+			}
+		}
+	}
+	
+	Lock lock(gDiskCacheMutex);
+	
+	gCacheSize = total;
+}
+
+
+// -1 if it isn't there
+static Int64
+FileSize(const string &path)
+{
+#ifdef __APPLE__
+	struct stat st;
+	
+	if(stat(path.c_str(), &st) == 0)
+		return st.st_size;
+#else
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	
+	if( GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data) )
+		return ((Int64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+#endif
+	
+	return -1;
+}
+
+
+class DiskCacheWriteTask : public PriorityTask
+{
+  public:
+	DiskCacheWriteTask(PriorityTaskGroup *group, const string &key,
+						const char *buf, ptrdiff_t rowbytes, int width, int height);
+	virtual ~DiskCacheWriteTask();
+	
+	virtual void execute();
+	
+  private:
+	bool writeFile(const string &path);
+	
+	const string _key;
+	const int _width;
+	const int _height;
+	ScratchBuffer _pixels;
+};
+
+
+DiskCacheWriteTask::DiskCacheWriteTask(PriorityTaskGroup *group, const string &key,
+										const char *buf, ptrdiff_t rowbytes, int width, int height) :
+	PriorityTask(group),
+	_key(key),
+	_width(width),
+	_height(height)
+{
+	const size_t pix_rowbytes = sizeof(half) * 4 * width;
+	
+	_pixels.allocate(pix_rowbytes * height);
+	
+	for(int y=0; y < height; y++)
+	{
+		ConvertBgraRow((const float *)(buf + (rowbytes * y)), (half *)(_pixels.data() + (pix_rowbytes * y)), width, false);
+	}
+}
+
+
+DiskCacheWriteTask::~DiskCacheWriteTask()
+{
+	Lock lock(gDiskCacheMutex);
+	
+	gPendingWrites--;
+}
+
+
+bool
+DiskCacheWriteTask::writeFile(const string &path)
+{
+	FILE *f = fopen(path.c_str(), "wb");
+	
+	if(f == NULL)
+		return false;
+	
+	DiskCacheHeader header;
+	
+	memcpy(header.magic, kCacheMagic, 4);
+	header.version = kCacheVersion;
+	header.width = _width;
+	header.height = _height;
+	header.keyLength = _key.size();
+	header.dataOffset = ((sizeof(DiskCacheHeader) + _key.size() + kCacheDataAlignment - 1) / kCacheDataAlignment) * kCacheDataAlignment;
+	
+	const vector<char> padding(header.dataOffset - sizeof(DiskCacheHeader) - _key.size(), 0);
+	
+	bool ok = (fwrite(&header, sizeof(header), 1, f) == 1 &&
+				fwrite(_key.data(), 1, _key.size(), f) == _key.size() &&
+				(padding.empty() || fwrite(&padding[0], 1, padding.size(), f) == padding.size()) &&
+				fwrite(_pixels.data(), 1, _pixels.size(), f) == _pixels.size());
+	
+	if(fclose(f) != 0)
+		ok = false;
+	
+	return ok;
+}
+
+
+void
+DiskCacheWriteTask::execute()
+{
+	const string path = CachePath(_key);
+	
+	// write to a temp file and rename, so a reader never sees half a frame
+	stringstream temp_path;
+	
+	{
+		Lock lock(gDiskCacheMutex);
+		
+	#ifdef __APPLE__
+		temp_path << path << '.' << getpid() << '.' << gTempCounter++ << ".tmp";
+	#else
+		temp_path << path << '.' << GetCurrentProcessId() << '.' << gTempCounter++ << ".tmp";
+	#endif
+	}
+	
+	bool ok = writeFile(temp_path.str());
+	
+	const Int64 new_size = FileSize(temp_path.str());
+	const Int64 old_size = FileSize(path); // if this replaces a frame
+	
+	if(ok)
+	{
+	#ifdef __APPLE__
+		ok = (rename(temp_path.str().c_str(), path.c_str()) == 0);
+	#else
+		ok = (MoveFileExA(temp_path.str().c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE);
+	#endif
+	}
+	
+	if(ok)
+	{
+		bool trim = false;
+		
+		{
+			Lock lock(gDiskCacheMutex);
+			
+			gDiskCacheStats.writes++;
+			
+			if(gCacheSize >= 0)
+				gCacheSize += max<Int64>(new_size, 0) - max<Int64>(old_size, 0);
+			
+			trim = (gCacheSize < 0 || gCacheSize > gCacheLimit);
+		}
+		
+		if(trim)
+			TrimCache();
+	}
+	else
+		remove(temp_path.str().c_str());
+}
+
+
+void
+WriteDiskCachedFrame(const std::string &key, const char *buf, ptrdiff_t rowbytes,
+						int width, int height)
+{
+	PriorityTaskGroup *group = NULL;
+	
+	{
+		Lock lock(gDiskCacheMutex);
+		
+		Configure();
+		
+		if(gCacheDir.empty())
+			return;
+		
+		if(gPendingWrites >= kMaxPendingWrites)
+		{
+			gDiskCacheStats.dropped++;
+			
+			return;
+		}
+		
+		if(gWriteGroup == NULL)
+			gWriteGroup = new PriorityTaskGroup;
+		
+		group = gWriteGroup;
+		
+		gPendingWrites++;
+	}
+	
+	DiskCacheWriteTask *task = NULL;
+	
+	try
+	{
+		task = new DiskCacheWriteTask(group, key, buf, rowbytes, width, height);
+	}
+	catch(...)
+	{
+		// couldn't copy the frame, no harm done
+		Lock lock(gDiskCacheMutex);
+		
+		gPendingWrites--; // the task destructor never ran
+		gDiskCacheStats.dropped++;
+		
+		return;
+	}
+	
+	AddPriorityTask(task, kTaskPriority_Background);
+}
+
+
+void
+GetDiskCacheStats(DiskCacheStats &stats)
+{
+	Lock lock(gDiskCacheMutex);
+	
+	stats = gDiskCacheStats;
+}
+
+
+void
+ShutdownDiskCache()
+{
+	PriorityTaskGroup *group = NULL;
+	
+	{
+		Lock lock(gDiskCacheMutex);
+		
+		group = gWriteGroup;
+		gWriteGroup = NULL;
+	}
+	
+	delete group; // waits for the writes
+}
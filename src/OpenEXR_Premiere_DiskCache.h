@@ -0,0 +1,125 @@
+
+//////////////////////////////////////////////////////////////////////////////
+// 
+// Copyright (c) 2015, Brendan Bolles
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+//////////////////////////////////////////////////////////////////////////////
+
+//------------------------------------------
+//
+// OpenEXR_Premiere_DiskCache.h
+// 
+// OpenEXR plug-in for Adobe Premiere
+//
+//------------------------------------------
+
+
+#ifndef _OPENEXR_PREMIERE_DISKCACHE_H_
+#define _OPENEXR_PREMIERE_DISKCACHE_H_
+
+#include "OpenEXR_Premiere_ChunkCache.h"
+
+#include <ImfInt64.h>
+
+#include <string>
+#include <stddef.h>
+
+
+// Optional on-disk cache of decoded frames, for codecs that are too slow
+// to decode in realtime (PIZ, DWAA, DWAB).  Frames are stored as raw half
+// BGRA in the same row order as the PPix, so reading one back is a memory
+// map and a half-to-float conversion.  Only frames from half channels go
+// in, so nothing is lost.  Turned on by pointing the OPENEXR_PREMIERE_FRAME_CACHE
+// environment variable at a folder.  OPENEXR_PREMIERE_FRAME_CACHE_GB sets
+// the size cap, after which the least recently used frames are deleted.
+
+#define OPENEXR_FRAME_CACHE_ENV		"OPENEXR_PREMIERE_FRAME_CACHE"
+#define OPENEXR_FRAME_CACHE_GB_ENV	"OPENEXR_PREMIERE_FRAME_CACHE_GB"
+
+#ifndef OPENEXR_FRAME_CACHE_DEFAULT_GB
+#define OPENEXR_FRAME_CACHE_DEFAULT_GB	64
+#endif
+
+
+bool DiskCacheEnabled();
+
+// everything that changes the decoded pixels goes into the key
+std::string DiskCacheKey(const ChunkCacheFile &file, const char * const chan[4],
+							bool bypassConversion, int pixelFormat, int width, int height);
+
+
+// A cached frame, mapped read-only.  Rows are width * 4 halves.
+class DiskCachedFrame
+{
+  public:
+	DiskCachedFrame();
+	~DiskCachedFrame();
+	
+	// false if the frame is not in the cache
+	bool open(const std::string &key, int width, int height);
+	
+	const char * data() const { return _data; }
+	ptrdiff_t rowbytes() const { return _rowbytes; }
+	
+  private:
+	DiskCachedFrame(const DiskCachedFrame &);
+	DiskCachedFrame & operator = (const DiskCachedFrame &);
+	
+	void close();
+	
+	const char *_data;
+	ptrdiff_t _rowbytes;
+	
+	char *_map;
+	size_t _mapSize;
+#ifndef __APPLE__
+	void *_fileH;
+	void *_mapH;
+#endif
+};
+
+
+// Copies the float frame to half and writes it in the background.  The frame
+// is quietly dropped if too many writes are already waiting.
+void WriteDiskCachedFrame(const std::string &key, const char *buf, ptrdiff_t rowbytes,
+							int width, int height);
+
+
+typedef struct DiskCacheStats
+{
+	Imf::Int64	hits;
+	Imf::Int64	misses;
+	Imf::Int64	writes;
+	Imf::Int64	dropped;
+	Imf::Int64	evictions;
+} DiskCacheStats;
+
+void GetDiskCacheStats(DiskCacheStats &stats);
+
+// waits for pending writes
+void ShutdownDiskCache();
+
+
+#endif // _OPENEXR_PREMIERE_DISKCACHE_H_
@@ -39,11 +39,22 @@
 #include "OpenEXR_Premiere_Export.h"
 
 #include "OpenEXR_Premiere_IO.h"
+#include "OpenEXR_Premiere_Tasks.h"
+#include "OpenEXR_Premiere_Scratch.h"
+#include "OpenEXR_Premiere_Convert.h"
+#include "OpenEXR_Premiere_Zip.h"
 
 #include "OpenEXR_Premiere_Dialogs.h"
 
 #include <ImfOutputFile.h>
+#include <ImfTiledOutputFile.h>
+#include <ImfMultiPartOutputFile.h>
+#include <ImfOutputPart.h>
+#include <ImfTiledOutputPart.h>
+#include <ImfPartType.h>
 #include <ImfRgbaFile.h>
+#include <ImfRgbaYca.h>
+#include <ImfPreviewImage.h>
 
 #include <ImfStandardAttributes.h>
 #include <ImfChannelList.h>
@@ -51,7 +62,15 @@
 #include <IexBaseExc.h>
 #include <IlmThread.h>
 #include <IlmThreadPool.h>
-#include <ImfArray.h>
+#include <IlmThreadMutex.h>
+#include <IlmThreadSemaphore.h>
+
+#include <vector>
+#include <list>
+#include <map>
+#include <memory>
+
+#include <math.h>
 
 
 #ifdef PRMAC_ENV
@@ -79,12 +98,21 @@ typedef struct ExportSettings
 	PrSDKExportParamSuite		*exportParamSuite;
 	PrSDKExportInfoSuite		*exportInfoSuite;
 	PrSDKExportFileSuite		*exportFileSuite;
+	PrSDKExportProgressSuite	*exportProgressSuite;
+	PrSDKErrorSuite3			*errorSuite;
 	PrSDKPPixCreatorSuite		*ppixCreatorSuite;
 	PrSDKPPixSuite				*ppixSuite;
 	PrSDKTimeSuite				*timeSuite;
 	PrSDKMemoryManagerSuite		*memorySuite;
 	PrSDKSequenceRenderSuite	*sequenceRenderSuite;
 	PrSDKWindowSuite			*windowSuite;
+	
+	// Auto compression's choice, made once for the whole job
+	// even when Premiere calls exSDKExport for each frame
+	bool						haveAutoCompression;
+	Compression					autoCompression;
+	char						autoCompressionReport[512];
+	PrTime						lastExportEndTime; // a call that doesn't follow on is a new job
 } ExportSettings;
 
 
@@ -137,7 +165,7 @@ exSDKStartup(
 	infoRecP->doesNotSupportAudioOnly = kPrTrue;
 	infoRecP->canExportVideo	= kPrTrue;
 	infoRecP->canExportAudio	= kPrFalse;
-	infoRecP->singleFrameOnly	= kPrTrue;
+	infoRecP->singleFrameOnly	= kPrFalse; // so we can write a sequence in one pass
 	
 	infoRecP->interfaceVersion	= EXPORTMOD_VERSION;
 	
@@ -178,6 +206,9 @@ exSDKStartup(
 	#endif
 	}
 	
+	// the SIMD conversions have to match OpenEXR's own, bit for bit
+	assert( CheckConvertBgraRow() );
+	
 	return malNoError;
 }
 
@@ -188,6 +219,8 @@ exSDKShutdown()
 	if( supportsThreads() )
 		setGlobalThreadCount(0);
 	
+	ShutdownScratch();
+	
 	return malNoError;
 }
 
@@ -226,6 +259,14 @@ exSDKBeginInstance(
 				kPrSDKExportFileSuite,
 				kPrSDKExportFileSuiteVersion,
 				const_cast<const void**>(reinterpret_cast<void**>(&(mySettings->exportFileSuite))));
+			spError = spBasic->AcquireSuite(
+				kPrSDKExportProgressSuite,
+				kPrSDKExportProgressSuiteVersion,
+				const_cast<const void**>(reinterpret_cast<void**>(&(mySettings->exportProgressSuite))));
+			spError = spBasic->AcquireSuite(
+				kPrSDKErrorSuite,
+				kPrSDKErrorSuiteVersion3,
+				const_cast<const void**>(reinterpret_cast<void**>(&(mySettings->errorSuite))));
 			spError = spBasic->AcquireSuite(
 				kPrSDKExportInfoSuite,
 				kPrSDKExportInfoSuiteVersion,
@@ -283,6 +324,14 @@ exSDKEndInstance(
 		{
 			result = spBasic->ReleaseSuite(kPrSDKExportFileSuite, kPrSDKExportFileSuiteVersion);
 		}
+		if (lRec->exportProgressSuite)
+		{
+			result = spBasic->ReleaseSuite(kPrSDKExportProgressSuite, kPrSDKExportProgressSuiteVersion);
+		}
+		if (lRec->errorSuite)
+		{
+			result = spBasic->ReleaseSuite(kPrSDKErrorSuite, kPrSDKErrorSuiteVersion3);
+		}
 		if (lRec->exportInfoSuite)
 		{
 			result = spBasic->ReleaseSuite(kPrSDKExportInfoSuite, kPrSDKExportInfoSuiteVersion);
@@ -318,9 +367,24 @@ exSDKEndInstance(
 #define EXRSettingsGroup	"EXRSettingsGroup"
 #define EXRCompression		"EXRCompression"
 #define EXRCompressionLevel	"EXRCompressionLevel"
+#define EXRZipLevel			"EXRZipLevel"
 #define EXRFloat			"EXRfloat"
 #define EXRBypassLinear		"EXRBypassLinear"
 #define EXRLumiChrom		"EXRlumichrom"
+#define EXRSequenceOnePass	"EXRSequenceOnePass"
+#define EXRCropToAlpha		"EXRCropToAlpha"
+#define EXRDropOpaqueAlpha	"EXRDropOpaqueAlpha"
+#define EXRTileSize			"EXRTileSize"
+#define EXRTileLevels		"EXRTileLevels"
+#define EXRSeparateAlpha	"EXRSeparateAlpha"
+#define EXRPreview			"EXRPreview"
+
+// EXRCompression value that lets the first frame decide
+#define EXR_AUTO_COMPRESSION	100
+
+// Version 2 added Zip Level, tiles, the preview image, one-pass sequences
+// and the Crop to Alpha, Drop Opaque Alpha and Separate Alpha options
+#define EXR_PARAMS_VERSION		2
 
 #define ADBEStillSequence	"ADBEStillSequence"
 #define ADBEVideoAlpha		"ADBEVideoAlpha"
@@ -374,6 +438,13 @@ exSDKQueryOutputSettings(
 		paramSuite->GetParamValue(exID, mgroupIndex, EXRLumiChrom, &lumiChrom);
 		paramSuite->GetParamValue(exID, mgroupIndex, EXRFloat, &floatNotHalf);
 		
+		exParamValues tileSize, tileLevels;
+		tileSize.value.intValue = 0;
+		tileLevels.value.intValue = ONE_LEVEL;
+		
+		paramSuite->GetParamValue(exID, mgroupIndex, EXRTileSize, &tileSize);
+		paramSuite->GetParamValue(exID, mgroupIndex, EXRTileLevels, &tileLevels);
+		
 		
 		int channels = (alpha.value.intValue ? 4 : 3);
 		int pix_size = (floatNotHalf.value.intValue ? sizeof(float) : sizeof(half));
@@ -385,8 +456,19 @@ exSDKQueryOutputSettings(
 			divisor *= 2;
 		}
 		
+		float levels = 1.f;
+		
+		if(tileSize.value.intValue > 0 && !lumiChrom.value.intValue)
+		{
+			// all the smaller levels add up to about a third more for mipmaps, three times more for ripmaps
+			if(tileLevels.value.intValue == MIPMAP_LEVELS)
+				levels = 4.f / 3.f;
+			else if(tileLevels.value.intValue == RIPMAP_LEVELS)
+				levels = 4.f;
+		}
+		
 		videoBitrate = static_cast<csSDK_uint32>(fps * width.value.intValue * height.value.intValue *
-												pix_size * channels / divisor);
+												pix_size * channels * levels / divisor);
 	}
 	
 	// return outBitratePerSecond in kbps
@@ -423,13 +505,17 @@ exSDKQueryStillSequence(
 	csSDK_uint32 exID = stillSequenceRecP->exporterPluginID;
 	csSDK_int32 gIdx = 0;
 	
-	exParamValues sequence, frameRate;
+	exParamValues sequence, onePass, frameRate;
+	
+	onePass.value.intValue = kPrFalse;
 	
 	paramSuite->GetParamValue(exID, gIdx, ADBEStillSequence, &sequence);
+	paramSuite->GetParamValue(exID, gIdx, EXRSequenceOnePass, &onePass);
 	paramSuite->GetParamValue(exID, gIdx, ADBEVideoFPS, &frameRate);
 	
 	
-	stillSequenceRecP->exportAsStillSequence = sequence.value.intValue;
+	// in one-pass mode we write the sequence ourselves
+	stillSequenceRecP->exportAsStillSequence = (sequence.value.intValue && !onePass.value.intValue);
 	stillSequenceRecP->exportFrameRate = frameRate.value.timeValue;
 	
 	return malNoError;
@@ -508,10 +594,10 @@ CalculateTimeCode(int frame_num, int frame_rate, bool drop_frame)
 
 
 template <typename InFormat, typename OutFormat>
-class ConvertBgraRowTask : public Task
+class ConvertBgraRowTask : public PriorityTask
 {
   public:
-	ConvertBgraRowTask(TaskGroup *group, InFormat *input_row, OutFormat *output_row, int length, bool premult);
+	ConvertBgraRowTask(PriorityTaskGroup *group, InFormat *input_row, OutFormat *output_row, int length, bool premult);
 	virtual ~ConvertBgraRowTask() {}
 	
 	virtual void execute();
@@ -525,8 +611,8 @@ class ConvertBgraRowTask : public Task
 
 
 template <typename InFormat, typename OutFormat>
-ConvertBgraRowTask<InFormat, OutFormat>::ConvertBgraRowTask(TaskGroup *group, InFormat *input_row, OutFormat *output_row, int length, bool premult) :
-	Task(group),
+ConvertBgraRowTask<InFormat, OutFormat>::ConvertBgraRowTask(PriorityTaskGroup *group, InFormat *input_row, OutFormat *output_row, int length, bool premult) :
+	PriorityTask(group),
 	_input_row(input_row),
 	_output_row(output_row),
 	_length(length),
@@ -540,70 +626,400 @@ template <typename InFormat, typename OutFormat>
 void
 ConvertBgraRowTask<InFormat, OutFormat>::execute()
 {
-	InFormat *in = _input_row;
-	OutFormat *out = _output_row;
+	ConvertBgraRow(_input_row, _output_row, _length, _premult);
+}
+
+
+// Luminance/Chroma is done the way RgbaOutputFile does it, but in parallel.
+// First each row is premultiplied, converted to YCA and its chroma filtered
+// horizontally.  Then, once all the rows are done, the chroma is filtered
+// vertically and everything is rounded.  The rows are kept as Rgba with
+// Y in g, RY in r, BY in b.  Chroma is only meaningful on even rows and columns.
+using RgbaYca::N;
+using RgbaYca::N2;
+
+// RgbaOutputFile's default rounding, which helps compression
+static const unsigned int kYCRoundY = 7;
+static const unsigned int kYCRoundC = 5;
+
+
+static void
+YcaHorizRow(const float *input_row, Rgba *output_row, int display_width, int data_width, const V3f &yw, bool alpha)
+{
+	vector<half> bgra(display_width * 4);
+	
+	ConvertBgraRow(input_row, &bgra[0], display_width, alpha);
+	
+	// padded on both sides for the filter
+	vector<Rgba> row(data_width + N - 1);
+	
+	Rgba *rgba = &row[N2];
+	
+	const half *pix = &bgra[0];
+	
+	for(int x=0; x < display_width; x++)
+	{
+		rgba[x].b = *pix++;
+		rgba[x].g = *pix++;
+		rgba[x].r = *pix++;
+		rgba[x].a = *pix++;
+	}
+	
+	for(int x=display_width; x < data_width; x++)
+		rgba[x] = rgba[display_width - 1];
+	
+	RgbaYca::RGBAtoYCA(yw, data_width, alpha, rgba, rgba);
+	
+	for(int i=0; i < N2; i++)
+	{
+		row[i] = rgba[0];
+		row[N2 + data_width + i] = rgba[data_width - 1];
+	}
+	
+	RgbaYca::decimateChromaHoriz(data_width, &row[0], output_row);
+}
+
+
+static void
+YcaVertRow(const Rgba *horiz_rows, int horiz_height, int y, int width, Rgba *output_row)
+{
+	if(y % 2 == 0)
+	{
+		// edge rows repeat, as in RgbaOutputFile
+		const Rgba *rows[N];
+		
+		for(int i=0; i < N; i++)
+		{
+			const int row_y = max(0, min(y - N2 + i, horiz_height - 1));
+			
+			rows[i] = horiz_rows + ((size_t)row_y * width);
+		}
+		
+		RgbaYca::decimateChromaVert(width, rows, output_row);
+	}
+	else
+	{
+		const int row_y = min(y, horiz_height - 1);
+		
+		memcpy(output_row, horiz_rows + ((size_t)row_y * width), sizeof(Rgba) * width);
+	}
+	
+	RgbaYca::roundYCA(width, kYCRoundY, kYCRoundC, output_row, output_row);
+}
+
+
+// the channels RgbaOutputFile would make, over rows kept as above
+static void
+InsertYcaChannels(Header &header, bool alpha)
+{
+	header.channels().insert("Y", Channel(Imf::HALF));
+	header.channels().insert("RY", Channel(Imf::HALF, 2, 2, true));
+	header.channels().insert("BY", Channel(Imf::HALF, 2, 2, true));
+	
+	if(alpha)
+		header.channels().insert("A", Channel(Imf::HALF));
+}
+
+
+static void
+InsertYcaSlices(FrameBuffer &frameBuffer, Rgba *yca, size_t rowbytes, bool alpha)
+{
+	frameBuffer.insert("Y", Slice(Imf::HALF, (char *)&yca->g, sizeof(Rgba), rowbytes) );
+	frameBuffer.insert("RY", Slice(Imf::HALF, (char *)&yca->r, sizeof(Rgba) * 2, rowbytes * 2, 2, 2) );
+	frameBuffer.insert("BY", Slice(Imf::HALF, (char *)&yca->b, sizeof(Rgba) * 2, rowbytes * 2, 2, 2) );
+	
+	if(alpha)
+		frameBuffer.insert("A", Slice(Imf::HALF, (char *)&yca->a, sizeof(Rgba), rowbytes) );
+}
+
+
+class YcaHorizRowTask : public PriorityTask
+{
+  public:
+	YcaHorizRowTask(PriorityTaskGroup *group, const float *input_row, Rgba *output_row,
+					int display_width, int data_width, const V3f &yw, bool alpha);
+	virtual ~YcaHorizRowTask() {}
+	
+	virtual void execute();
+	
+  private:
+	const float *_input_row;
+	Rgba *_output_row;
+	const int _display_width;
+	const int _data_width;
+	const V3f _yw;
+	const bool _alpha;
+};
+
+
+YcaHorizRowTask::YcaHorizRowTask(PriorityTaskGroup *group, const float *input_row, Rgba *output_row,
+									int display_width, int data_width, const V3f &yw, bool alpha) :
+	PriorityTask(group),
+	_input_row(input_row),
+	_output_row(output_row),
+	_display_width(display_width),
+	_data_width(data_width),
+	_yw(yw),
+	_alpha(alpha)
+{
+
+}
+
+
+void
+YcaHorizRowTask::execute()
+{
+	YcaHorizRow(_input_row, _output_row, _display_width, _data_width, _yw, _alpha);
+}
+
+
+class YcaVertRowTask : public PriorityTask
+{
+  public:
+	YcaVertRowTask(PriorityTaskGroup *group, const Rgba *horiz_rows, int horiz_height,
+					int y, int width, Rgba *output_row);
+	virtual ~YcaVertRowTask() {}
+	
+	virtual void execute();
+	
+  private:
+	const Rgba *_horiz_rows;
+	const int _horiz_height;
+	const int _y;
+	const int _width;
+	Rgba *_output_row;
+};
+
+
+YcaVertRowTask::YcaVertRowTask(PriorityTaskGroup *group, const Rgba *horiz_rows, int horiz_height,
+								int y, int width, Rgba *output_row) :
+	PriorityTask(group),
+	_horiz_rows(horiz_rows),
+	_horiz_height(horiz_height),
+	_y(y),
+	_width(width),
+	_output_row(output_row)
+{
+
+}
+
+
+void
+YcaVertRowTask::execute()
+{
+	YcaVertRow(_horiz_rows, _horiz_height, _y, _width, _output_row);
+}
+
+
+// The small 8-bit previewImage thumbnail, box filtered from the whole
+// frame.  Each task makes one preview row from its band of frame rows,
+// and converts any of those rows ExportFrame is copying while they're
+// in cache.
+#ifndef OPENEXR_EXPORT_PREVIEW_SIZE
+#define OPENEXR_EXPORT_PREVIEW_SIZE	256 // longest side
+#endif
+
+typedef struct RowCopy
+{
+	const char		*buf_origin; // bottom row of the data window in the PPix
+	ptrdiff_t		buf_rowbytes;
+	int				first_row; // of buf_origin, counting up from the bottom of the PPix
+	int				rows;
+	int				width;
+	char			*origin; // the copy, same way up
+	size_t			rowbytes;
+	Imf::PixelType	type;
+	bool			premult;
+} RowCopy;
+
+
+class PreviewRowTask : public PriorityTask
+{
+  public:
+	PreviewRowTask(PriorityTaskGroup *group, const char *frameBufferP, csSDK_int32 rowbytes, int width, int height,
+					PreviewImage &preview, int preview_y, bool alpha, bool linear, const RowCopy *copy);
+	virtual ~PreviewRowTask() {}
+	
+	virtual void execute();
+	
+  private:
+	void copyRow(int buf_y);
+	
+	const char *_frameBufferP;
+	const csSDK_int32 _rowbytes;
+	const int _width;
+	const int _height;
+	PreviewImage &_preview;
+	const int _preview_y;
+	const bool _alpha;
+	const bool _linear;
+	const RowCopy *_copy;
+};
+
+
+PreviewRowTask::PreviewRowTask(PriorityTaskGroup *group, const char *frameBufferP, csSDK_int32 rowbytes, int width, int height,
+								PreviewImage &preview, int preview_y, bool alpha, bool linear, const RowCopy *copy) :
+	PriorityTask(group),
+	_frameBufferP(frameBufferP),
+	_rowbytes(rowbytes),
+	_width(width),
+	_height(height),
+	_preview(preview),
+	_preview_y(preview_y),
+	_alpha(alpha),
+	_linear(linear),
+	_copy(copy)
+{
+
+}
+
+
+// previews are gamma corrected, unless Premiere already did that
+static inline unsigned char
+PreviewValue(float v, bool linear)
+{
+	if(linear && v > 0.f)
+		v = powf(v, 1.f / 2.2f);
+	
+	return (v >= 1.f ? 255 : v <= 0.f ? 0 : (unsigned char)((v * 255.f) + 0.5f));
+}
+
+
+void
+PreviewRowTask::copyRow(int buf_y)
+{
+	const int copy_y = buf_y - _copy->first_row;
 	
-	for(int x=0; x < (_length * 4); x++)
+	if(copy_y >= 0 && copy_y < _copy->rows)
 	{
-		*out++ = *in++;
+		const float *in = (const float *)(_copy->buf_origin + (_copy->buf_rowbytes * copy_y));
+		
+		char *out = _copy->origin + (_copy->rowbytes * copy_y);
+		
+		if(_copy->type == Imf::HALF)
+			ConvertBgraRow(in, (half *)out, _copy->width, _copy->premult);
+		else
+			ConvertBgraRow(in, (float *)out, _copy->width, _copy->premult);
 	}
+}
+
 
-	if(_premult)
+void
+PreviewRowTask::execute()
+{
+	const int preview_width = _preview.width();
+	const int preview_height = _preview.height();
+	
+	const int y_begin = (_preview_y * _height) / preview_height;
+	const int y_end = ((_preview_y + 1) * _height) / preview_height;
+	
+	vector<float> sums(preview_width * 4, 0.f);
+	
+	for(int y = y_begin; y < y_end; y++)
 	{
-		OutFormat *b = _output_row + 0;
-		OutFormat *g = _output_row + 1;
-		OutFormat *r = _output_row + 2;
-		OutFormat *a = _output_row + 3;
+		const int buf_y = _height - 1 - y; // PPix is upside down
+		
+		if(_copy != NULL)
+			copyRow(buf_y);
 		
-		for(int x=0; x < _length; x++)
+		const float *row = (const float *)(_frameBufferP + ((ptrdiff_t)_rowbytes * buf_y));
+		
+		for(int px=0; px < preview_width; px++)
 		{
-			if(*a != 1.f)
+			const int x_begin = (px * _width) / preview_width;
+			const int x_end = ((px + 1) * _width) / preview_width;
+			
+			float *sum = &sums[px * 4];
+			
+			// premultiplied, like the file
+			for(int x = x_begin; x < x_end; x++)
 			{
-				*b *= *a;
-				*g *= *a;
-				*r *= *a;
+				const float *bgra = row + (x * 4);
+				
+				const float a = (_alpha ? bgra[3] : 1.f);
+				
+				sum[0] += bgra[0] * a;
+				sum[1] += bgra[1] * a;
+				sum[2] += bgra[2] * a;
+				sum[3] += a;
 			}
-
-			b += 4;
-			g += 4;
-			r += 4;
-			a += 4;
 		}
 	}
+	
+	for(int px=0; px < preview_width; px++)
+	{
+		const int x_begin = (px * _width) / preview_width;
+		const int x_end = ((px + 1) * _width) / preview_width;
+		
+		const float scale = 1.f / (float)((x_end - x_begin) * (y_end - y_begin));
+		
+		const float *sum = &sums[px * 4];
+		
+		PreviewRgba &pixel = _preview.pixel(px, _preview_y);
+		
+		pixel.b = PreviewValue(sum[0] * scale, _linear);
+		pixel.g = PreviewValue(sum[1] * scale, _linear);
+		pixel.r = PreviewValue(sum[2] * scale, _linear);
+		pixel.a = PreviewValue(sum[3] * scale, false);
+	}
 }
 
 
 static void
-Premultiply(Rgba &in)
+AddPreviewTasks(PriorityTaskGroup *group, const char *frameBufferP, csSDK_int32 rowbytes, int width, int height,
+				PreviewImage &preview, bool alpha, bool linear, const RowCopy *copy)
 {
-	if(in.a != 1.f)
+	for(unsigned int y=0; y < preview.height(); y++)
 	{
-		in.r *= in.a;
-		in.g *= in.a;
-		in.b *= in.a;
+		AddPriorityTask(new PreviewRowTask(group, frameBufferP, rowbytes, width, height,
+											preview, y, alpha, linear, copy), kTaskPriority_Export);
 	}
 }
 
 
-static prMALError
-exSDKExport(
-	exportStdParms	*stdParmsP,
-	exDoExportRec	*exportInfoP)
+static PreviewImage
+MakePreviewImage(int width, int height)
 {
-	prMALError					result					= malNoError;
-	ExportSettings				*mySettings				= reinterpret_cast<ExportSettings*>(exportInfoP->privateData);
-	PrSDKExportParamSuite		*paramSuite				= mySettings->exportParamSuite;
-	PrSDKExportInfoSuite		*exportInfoSuite		= mySettings->exportInfoSuite;
-	PrSDKSequenceRenderSuite	*renderSuite			= mySettings->sequenceRenderSuite;
-	PrSDKMemoryManagerSuite		*memorySuite			= mySettings->memorySuite;
-	PrSDKPPixCreatorSuite		*pixCreatorSuite		= mySettings->ppixCreatorSuite;
-	PrSDKPPixSuite				*pixSuite				= mySettings->ppixSuite;
+	const int longest = max(width, height);
+	
+	if(longest <= OPENEXR_EXPORT_PREVIEW_SIZE)
+		return PreviewImage(width, height);
+	
+	return PreviewImage(max(1, (width * OPENEXR_EXPORT_PREVIEW_SIZE) / longest),
+						max(1, (height * OPENEXR_EXPORT_PREVIEW_SIZE) / longest));
+}
 
-	if(!exportInfoP->exportVideo)
-		return malNoError;
+
+typedef struct ExportParams
+{
+	csSDK_int32		width;
+	csSDK_int32		height;
+	csSDK_int32		parNum;
+	csSDK_int32		parDen;
+	csSDK_int32		fieldType;
+	PrTime			frameRate;
+	bool			alpha;
+	bool			bypassLinear;
+	Compression		compression;
+	bool			autoCompression;
+	float			compressionLevel;
+	int				zipLevel;
+	bool			lumiChrom;
+	bool			floatNotHalf;
+	bool			sequence;
+	bool			onePass;
+	bool			cropToAlpha;
+	bool			dropOpaqueAlpha;
+	int				tileSize; // 0 for scanlines
+	LevelMode		tileLevels;
+	bool			separateAlpha;
+	bool			preview;
+} ExportParams;
 
 
-	csSDK_uint32 exID = exportInfoP->exporterPluginID;
+static void
+GetExportParams(PrSDKExportParamSuite *paramSuite, csSDK_uint32 exID, ExportParams &params)
+{
 	csSDK_int32 gIdx = 0;
 	
 	exParamValues widthP, heightP, pixelAspectRatioP, fieldTypeP, frameRateP, alphaP;
@@ -616,403 +1032,2329 @@ exSDKExport(
 	paramSuite->GetParamValue(exID, gIdx, ADBEVideoAlpha, &alphaP);
 	
 	
-	exParamValues bypassLinearP;
+	exParamValues bypassLinearP, sequenceP, onePassP, cropToAlphaP, dropOpaqueAlphaP, separateAlphaP;
 	bypassLinearP.value.intValue = kPrFalse;
+	sequenceP.value.intValue = kPrFalse;
+	
 	paramSuite->GetParamValue(exID, gIdx, EXRBypassLinear, &bypassLinearP);
+	paramSuite->GetParamValue(exID, gIdx, ADBEStillSequence, &sequenceP);
+	paramSuite->GetParamValue(exID, gIdx, EXRSequenceOnePass, &onePassP);
+	paramSuite->GetParamValue(exID, gIdx, EXRCropToAlpha, &cropToAlphaP);
+	paramSuite->GetParamValue(exID, gIdx, EXRDropOpaqueAlpha, &dropOpaqueAlphaP);
+	paramSuite->GetParamValue(exID, gIdx, EXRSeparateAlpha, &separateAlphaP);
+	
+	
+	exParamValues compressionP, compressionLevelP, zipLevelP, lumichromP, floatP, tileSizeP, tileLevelsP, previewP;
+	
+	paramSuite->GetParamValue(exID, gIdx, EXRCompression, &compressionP);
+	paramSuite->GetParamValue(exID, gIdx, EXRCompressionLevel, &compressionLevelP);
+	paramSuite->GetParamValue(exID, gIdx, EXRZipLevel, &zipLevelP);
+	paramSuite->GetParamValue(exID, gIdx, EXRLumiChrom, &lumichromP);
+	paramSuite->GetParamValue(exID, gIdx, EXRFloat, &floatP);
+	paramSuite->GetParamValue(exID, gIdx, EXRTileSize, &tileSizeP);
+	paramSuite->GetParamValue(exID, gIdx, EXRTileLevels, &tileLevelsP);
+	paramSuite->GetParamValue(exID, gIdx, EXRPreview, &previewP);
+	
+	
+	params.width = widthP.value.intValue;
+	params.height = heightP.value.intValue;
+	params.parNum = pixelAspectRatioP.value.ratioValue.numerator;
+	params.parDen = pixelAspectRatioP.value.ratioValue.denominator;
+	params.fieldType = fieldTypeP.value.intValue;
+	params.frameRate = frameRateP.value.timeValue;
+	params.alpha = alphaP.value.intValue;
+	params.bypassLinear = bypassLinearP.value.intValue;
+	params.autoCompression = (compressionP.value.intValue == EXR_AUTO_COMPRESSION);
+	params.compression = (params.autoCompression ? PIZ_COMPRESSION : (Compression)compressionP.value.intValue);
+	params.compressionLevel = compressionLevelP.value.floatValue;
+	params.zipLevel = zipLevelP.value.intValue;
+	params.lumiChrom = lumichromP.value.intValue;
+	params.floatNotHalf = floatP.value.intValue;
+	params.sequence = sequenceP.value.intValue;
+	params.onePass = onePassP.value.intValue;
+	params.cropToAlpha = cropToAlphaP.value.intValue;
+	params.dropOpaqueAlpha = dropOpaqueAlphaP.value.intValue;
+	params.tileSize = tileSizeP.value.intValue;
+	params.tileLevels = (LevelMode)tileLevelsP.value.intValue;
+	params.separateAlpha = separateAlphaP.value.intValue;
+	params.preview = previewP.value.intValue;
+}
+
+
+typedef struct ExportTimecode
+{
+	int			frame_num; // of the first frame
+	int			timecode_base;
+	bool		drop_frame;
+	Rational	fps;
+} ExportTimecode;
+
+
+// false if the frame rate isn't one timecode knows about
+static bool
+GetExportTimecode(ExportSettings *mySettings, csSDK_uint32 exID, PrTime startTime, PrTime frameRate,
+					PrTime ticksPerSecond, ExportTimecode &timecode)
+{
+	PrTime frameRates[] = {	10, 15, 23,
+							24, 25, 29,
+							30, 50, 59,
+							60};
+													
+	PrTime frameRateNumDens[][2] = {{10, 1}, {15, 1}, {24000, 1001},
+									{24, 1}, {25, 1}, {30000, 1001},
+									{30, 1}, {50, 1}, {60000, 1001},
+									{60, 1}};
 	
-	SequenceRender_ParamsRec renderParms;
-	const PrPixelFormat pixelFormat = (bypassLinearP.value.intValue ?
-										PrPixelFormat_BGRA_4444_32f :
-										PrPixelFormat_BGRA_4444_32f_Linear);
+	int frameRateBase[] = {	10, 15, 24,
+							24, 25, 30,
+							30, 50, 60,
+							60};
 	
+	bool dropFrame[] =	{	false, false, false,
+							false, false, true,
+							false, false, true,
+							false };
 	
-	renderParms.inRequestedPixelFormatArray = &pixelFormat;
-	renderParms.inRequestedPixelFormatArrayCount = 1;
-	renderParms.inWidth = widthP.value.intValue;
-	renderParms.inHeight = heightP.value.intValue;
-	renderParms.inPixelAspectRatioNumerator = pixelAspectRatioP.value.ratioValue.numerator;
-	renderParms.inPixelAspectRatioDenominator = pixelAspectRatioP.value.ratioValue.denominator;
-	renderParms.inRenderQuality = (exportInfoP->maximumRenderQuality ? kPrRenderQuality_Max : kPrRenderQuality_High);
-	renderParms.inFieldType = fieldTypeP.value.intValue;
-	renderParms.inDeinterlace = kPrFalse;
-	renderParms.inDeinterlaceQuality = (exportInfoP->maximumRenderQuality ? kPrRenderQuality_Max : kPrRenderQuality_High);
-	renderParms.inCompositeOnBlack = (alphaP.value.intValue ? kPrFalse: kPrTrue);
+	for(csSDK_int32 i=0; i < sizeof(frameRates) / sizeof (PrTime); i++)
+	{
+		frameRates[i] = ticksPerSecond / frameRateNumDens[i][0] * frameRateNumDens[i][1];
+	}
 	
 	
-	csSDK_uint32 videoRenderID;
-	renderSuite->MakeVideoRenderer(exID, &videoRenderID, frameRateP.value.timeValue);
+	int frameRateIndex = -1;
+	
+	for(csSDK_int32 i=0; i < sizeof(frameRates) / sizeof (PrTime); i++)
+	{
+		if(frameRate == frameRates[i])
+			frameRateIndex = i;
+	}
+	
+	if(frameRateIndex < 0)
+		return false;
 	
 	
-	SequenceRender_GetFrameReturnRec renderResult;
-	result = renderSuite->RenderVideoFrame(videoRenderID,
-											exportInfoP->startTime,
-											&renderParms,
-											kRenderCacheType_None,
-											&renderResult);
+#if EXPORTMOD_VERSION >= 4
+	PrParam timecodeP;
+	mySettings->exportInfoSuite->GetExportSourceInfo(exID, kExportInfo_SourceTimecode, &timecodeP);
 	
-	if(result != suiteError_CompilerCompileAbort)
+	ExporterTimecodeRec *timecodeRec = (ExporterTimecodeRec *)timecodeP.mMemoryPtr;
+	
+	int frame_num = 0;
+	int alt_timecode_base = 0;
+	bool alt_drop_frame = false;
+	
+	if(timecodeRec)
 	{
-		exParamValues compressionP, compressionLevelP, lumichromP, floatP;
-		
-		paramSuite->GetParamValue(exID, gIdx, EXRCompression, &compressionP);
-		paramSuite->GetParamValue(exID, gIdx, EXRCompressionLevel, &compressionLevelP);
-		paramSuite->GetParamValue(exID, gIdx, EXRLumiChrom, &lumichromP);
-		paramSuite->GetParamValue(exID, gIdx, EXRFloat, &floatP);
-		
-		
-		char *frameBufferP = NULL;
-		csSDK_int32 rowbytes = 0;
-		PrPixelFormat pixFormat;
-		prRect bounds;
-		csSDK_uint32 parN, parD;
-		
-		pixSuite->GetPixels(renderResult.outFrame, PrPPixBufferAccess_ReadOnly, &frameBufferP);
-		pixSuite->GetRowBytes(renderResult.outFrame, &rowbytes);
-		pixSuite->GetPixelFormat(renderResult.outFrame, &pixFormat);
-		pixSuite->GetBounds(renderResult.outFrame, &bounds);
-		pixSuite->GetPixelAspectRatio(renderResult.outFrame, &parN, &parD);
+		frame_num = timecodeRec->mTimecodeTicks / timecodeRec->mTicksPerFrame;
 		
+		alt_timecode_base = ((float)ticksPerSecond / (float)timecodeRec->mTicksPerFrame) + 0.5f;
 		
-		if(pixFormat == PrPixelFormat_BGRA_4444_32f_Linear || pixFormat == PrPixelFormat_BGRA_4444_32f)
-		{
-			try
-			{
-				if( supportsThreads() )
-					setGlobalThreadCount(gNumCPUs);
-					
-				
-				bool floatNotHalf = floatP.value.intValue;
-				bool lumiChrom = lumichromP.value.intValue;
-				bool alpha = alphaP.value.intValue;
-				
-				
-				int data_width, display_width, data_height, display_height;
-				
-				data_width = display_width = bounds.right - bounds.left;
-				data_height = display_height = bounds.bottom - bounds.top;
-				
-				if(lumiChrom)
-				{	// Luminance/Chroma needs even width & height
-					data_width += (data_width % 2);
-					data_height += (data_height % 2);
-				}
+		alt_drop_frame = timecodeRec->mTimecodeStartPrefersDropFrame;
+	
+		mySettings->memorySuite->PrDisposePtr(timecodeP.mMemoryPtr);
+	}
+	else
+	{
+		frame_num = (startTime * frameRateNumDens[frameRateIndex][0]) /
+						(ticksPerSecond * frameRateNumDens[frameRateIndex][1]);
+	}
+	
+	
+	const int alt_frame_num = (startTime * frameRateNumDens[frameRateIndex][0]) /
+						(ticksPerSecond * frameRateNumDens[frameRateIndex][1]);
 						
+	const int timecode_base = frameRateBase[frameRateIndex];
+	
+	const bool drop_frame = dropFrame[frameRateIndex];
+	
+	
+	assert(frame_num == alt_frame_num);
+	assert(timecode_base == alt_timecode_base);
+	assert(drop_frame == alt_drop_frame); // this will fail with the export frame button
+#else
+	const int frame_num = (startTime * frameRateNumDens[frameRateIndex][0]) /
+						(ticksPerSecond * frameRateNumDens[frameRateIndex][1]);
+						
+	const int timecode_base = frameRateBase[frameRateIndex];
+	
+	const bool drop_frame = dropFrame[frameRateIndex];
+#endif
+	
+	timecode.frame_num = frame_num;
+	timecode.timecode_base = timecode_base;
+	timecode.drop_frame = drop_frame;
+	timecode.fps = Rational(frameRateNumDens[frameRateIndex][0], frameRateNumDens[frameRateIndex][1]);
+	
+	return true;
+}
+
+
+// Everything in the header that stays the same from frame to frame.
+// Channels and timecode get added for each frame.
+static Header
+MakeHeaderTemplate(const ExportParams &params, int display_width, int display_height,
+					csSDK_uint32 parN, csSDK_uint32 parD, PrTime ticksPerSecond,
+					const ExportTimecode *timecode)
+{
+	int data_width = display_width;
+	int data_height = display_height;
+	
+	if(params.lumiChrom)
+	{	// Luminance/Chroma needs even width & height
+		data_width += (data_width % 2);
+		data_height += (data_height % 2);
+	}
+	
+	
+	Header header(	Box2i( V2i(0,0), V2i(display_width-1, display_height-1) ),
+					Box2i( V2i(0,0), V2i(data_width-1, data_height-1) ),
+					(float)parN / (float)parD,
+					V2f(0, 0),
+					1,
+					INCREASING_Y,
+					params.compression);
+	
+	
+	if(params.compression == DWAA_COMPRESSION || params.compression == DWAB_COMPRESSION)
+	{
+		addDwaCompressionLevel(header, params.compressionLevel);
+	}
+	
+	
+	// tiled files can't have subsampled channels
+	if(params.tileSize > 0 && !params.lumiChrom)
+	{
+		header.setTileDescription( TileDescription(params.tileSize, params.tileSize, params.tileLevels, ROUND_DOWN) );
+	}
+	
+	
+	// store the actual ratio as a custom attribute
+#define PIXEL_ASPECT_RATIONAL_KEY	"pixelAspectRatioRational"
+	if(parN != parD)
+	{
+		header.insert(PIXEL_ASPECT_RATIONAL_KEY, RationalAttribute( Rational(parN, parD) ) );
+	}
+	
+	
+	// add time attributes
+	time_t the_time = time(NULL);
+	tm *local_time = localtime(&the_time);
+	
+	if(local_time)
+	{
+		char date_string[256];
+		sprintf(date_string, "%04d:%02d:%02d %02d:%02d:%02d", local_time->tm_year + 1900, local_time->tm_mon + 1, local_time->tm_mday,
+													local_time->tm_hour, local_time->tm_min, local_time->tm_sec);
+		
+		addCapDate(header, date_string);
+#ifdef PRWIN_ENV
+		_timeb win_time;
+		_ftime(&win_time);
+		addUtcOffset(header, (float)( (win_time.timezone - (win_time.dstflag ? 60 : 0) ) * 60));
+#else
+		addUtcOffset(header, (float)-local_time->tm_gmtoff);
+#endif
+	}
+	
+	
+	// FPS
+	if(timecode != NULL)
+	{
+		// the real values
+		addFramesPerSecond(header, timecode->fps);
+	}
+	else if(ticksPerSecond < limits<int>::max() &&
+		params.frameRate < limits<unsigned int>::max())
+	{
+		addFramesPerSecond(header, Rational(ticksPerSecond, params.frameRate) );
+	}
+	else
+		addFramesPerSecond(header, Rational((double)ticksPerSecond / (double)params.frameRate) );
+	
+	
+	// graffiti
+	header.insert("writer", StringAttribute("ProEXR for Premiere"));
+	
+	
+	// Color space
+	if(params.bypassLinear)
+		addComments(header, "Conversion to linear bypassed in Premiere");
+	
+	
+	return header;
+}
+
+
+typedef struct AlphaRowScan
+{
+	int		first; // pixels with non-zero alpha, first > last if there are none
+	int		last;
+	bool	opaque; // alpha is 1 all the way across
+} AlphaRowScan;
+
+
+class AlphaScanRowTask : public PriorityTask
+{
+  public:
+	AlphaScanRowTask(PriorityTaskGroup *group, const float *row, int width, AlphaRowScan &scan);
+	virtual ~AlphaScanRowTask() {}
+	
+	virtual void execute();
+	
+  private:
+	const float *_row;
+	const int _width;
+	AlphaRowScan &_scan;
+};
+
+
+AlphaScanRowTask::AlphaScanRowTask(PriorityTaskGroup *group, const float *row, int width, AlphaRowScan &scan) :
+	PriorityTask(group),
+	_row(row),
+	_width(width),
+	_scan(scan)
+{
+
+}
+
+
+void
+AlphaScanRowTask::execute()
+{
+	const float *a = _row + 3;
+	
+	int first = _width;
+	int last = -1;
+	bool opaque = true;
+	
+	for(int x=0; x < _width; x++)
+	{
+		const float alpha = a[x * 4];
+		
+		if(alpha != 1.f)
+			opaque = false;
+		
+		if(alpha != 0.f)
+		{
+			if(first > x)
+				first = x;
+			
+			last = x;
+		}
+	}
+	
+	_scan.first = first;
+	_scan.last = last;
+	_scan.opaque = opaque;
+}
+
+
+// Look over the alpha of a float BGRA frame.  bounds is the area with
+// anything in it, in file coordinates.  OpenEXR needs at least one pixel,
+// so an empty frame gets the top corner.
+static void
+ScanAlpha(const char *frameBufferP, csSDK_int32 rowbytes, int width, int height,
+			Box2i &bounds, bool &opaque)
+{
+	vector<AlphaRowScan> rows(height);
+	
+	{
+		PriorityTaskGroup taskGroup;
+		
+		for(int y=0; y < height; y++)
+		{
+			const char *buf_row = frameBufferP + ((ptrdiff_t)rowbytes * (height - 1 - y));
+			
+			AddPriorityTask(new AlphaScanRowTask(&taskGroup, (const float *)buf_row, width, rows[y]), kTaskPriority_Export);
+		}
+		
+		taskGroup.wait();
+	}
+	
+	bounds.makeEmpty();
+	
+	opaque = true;
+	
+	for(int y=0; y < height; y++)
+	{
+		if(rows[y].first <= rows[y].last)
+		{
+			bounds.extendBy( V2i(rows[y].first, y) );
+			bounds.extendBy( V2i(rows[y].last, y) );
+		}
+		
+		if(!rows[y].opaque)
+			opaque = false;
+	}
+	
+	if( bounds.isEmpty() )
+		bounds = Box2i( V2i(0, 0), V2i(0, 0) );
+}
+
+
+// which of the BGRA channels go in a part
+enum {
+	kBgraColor = 1,
+	kBgraAlpha = 2
+};
+
+static void
+InsertBgraSlices(FrameBuffer &frameBuffer, Imf::PixelType buf_type, char *bgra_origin, ptrdiff_t rowbytes,
+					unsigned int channels)
+{
+	const size_t pix_size = (buf_type == Imf::FLOAT ? sizeof(float) : sizeof(half));
+	
+	if(channels & kBgraColor)
+	{
+		frameBuffer.insert("B", Slice(buf_type, bgra_origin + (pix_size * 0), pix_size * 4, rowbytes) );
+		frameBuffer.insert("G", Slice(buf_type, bgra_origin + (pix_size * 1), pix_size * 4, rowbytes) );
+		frameBuffer.insert("R", Slice(buf_type, bgra_origin + (pix_size * 2), pix_size * 4, rowbytes) );
+	}
+	
+	if(channels & kBgraAlpha)
+		frameBuffer.insert("A", Slice(buf_type, bgra_origin + (pix_size * 3), pix_size * 4, rowbytes) );
+}
+
+
+static void
+InsertBgraChannels(Header &header, Imf::PixelType pix_type, unsigned int channels)
+{
+	if(channels & kBgraColor)
+	{
+		header.channels().insert("B", Channel(pix_type));
+		header.channels().insert("G", Channel(pix_type));
+		header.channels().insert("R", Channel(pix_type));
+	}
+	
+	if(channels & kBgraAlpha)
+		header.channels().insert("A", Channel(pix_type));
+}
+
+
+// One resolution level of a tiled file, BGRA.  Only level (0, 0)
+// can be half, the filtered levels are float.
+// origin is the first pixel of the level's data window.
+typedef struct LevelImage
+{
+	char		*origin;
+	ptrdiff_t	rowbytes;
+	int			width;
+	int			height;
+} LevelImage;
+
+
+// Box filters one row of the next level down, halving
+// whichever directions got smaller.
+class DownsampleRowTask : public PriorityTask
+{
+  public:
+	DownsampleRowTask(PriorityTaskGroup *group, const LevelImage &input, const LevelImage &output, int y);
+	virtual ~DownsampleRowTask() {}
+	
+	virtual void execute();
+	
+  private:
+	const LevelImage &_input;
+	const LevelImage &_output;
+	const int _y;
+};
+
+
+DownsampleRowTask::DownsampleRowTask(PriorityTaskGroup *group, const LevelImage &input, const LevelImage &output, int y) :
+	PriorityTask(group),
+	_input(input),
+	_output(output),
+	_y(y)
+{
+
+}
+
+
+void
+DownsampleRowTask::execute()
+{
+	// with ROUND_DOWN a level is never more than half the one before,
+	// so the input pixels are always there
+	const int x_factor = (_output.width < _input.width ? 2 : 1);
+	const int y_factor = (_output.height < _input.height ? 2 : 1);
+	
+	const float weight = 1.f / (float)(x_factor * y_factor);
+	
+	const float *in_row = (const float *)(_input.origin + (_input.rowbytes * _y * y_factor));
+	const float *in_next = (y_factor == 2 ? (const float *)((const char *)in_row + _input.rowbytes) : in_row);
+	
+	float *out = (float *)(_output.origin + (_output.rowbytes * _y));
+	
+	for(int x=0; x < _output.width; x++)
+	{
+		const float *in0 = in_row + (x * x_factor * 4);
+		const float *in1 = in_next + (x * x_factor * 4);
+		
+		for(int c=0; c < 4; c++)
+		{
+			float sum = in0[c];
+			
+			if(x_factor == 2)
+				sum += in0[c + 4];
+			
+			if(y_factor == 2)
+			{
+				sum += in1[c];
+				
+				if(x_factor == 2)
+					sum += in1[c + 4];
+			}
+			
+			out[c] = sum * weight;
+		}
+		
+		out += 4;
+	}
+}
+
+
+static void
+MakeLevel(const LevelImage &input, int width, int height, ScratchBuffer &buffer, LevelImage &output)
+{
+	const size_t rowbytes = ScratchRowbytes(width, sizeof(float) * 4);
+	
+	buffer.allocate(rowbytes * height);
+	
+	LevelImage level;
+	
+	level.origin = buffer.data();
+	level.rowbytes = rowbytes;
+	level.width = width;
+	level.height = height;
+	
+	{
+		PriorityTaskGroup taskGroup;
+		
+		for(int y=0; y < height; y++)
+		{
+			AddPriorityTask(new DownsampleRowTask(&taskGroup, input, level, y), kTaskPriority_Export);
+		}
+		
+		taskGroup.wait();
+	}
+	
+	output = level;
+}
+
+
+// Each part gets its channels of the same pixels.
+// Parts share the data window and tiling.
+template <typename TiledOutput>
+static void
+WriteLevel(TiledOutput * const parts[], const unsigned int channels[], int num_parts,
+			const LevelImage &level, Imf::PixelType buf_type, int lx, int ly)
+{
+	const Box2i levelW = parts[0]->dataWindowForLevel(lx, ly);
+	
+	assert(levelW.max.x - levelW.min.x + 1 == level.width);
+	assert(levelW.max.y - levelW.min.y + 1 == level.height);
+	
+	const size_t pix_size = (buf_type == Imf::FLOAT ? sizeof(float) : sizeof(half));
+	
+	// where pixel (0, 0) would be
+	char *bgra_origin = level.origin - (level.rowbytes * levelW.min.y) - (ptrdiff_t)(pix_size * 4 * levelW.min.x);
+	
+	for(int n=0; n < num_parts; n++)
+	{
+		FrameBuffer frameBuffer;
+		
+		InsertBgraSlices(frameBuffer, buf_type, bgra_origin, level.rowbytes, channels[n]);
+		
+		parts[n]->setFrameBuffer(frameBuffer);
+		
+		// asking for all the tiles at once lets OpenEXR compress them in parallel
+		parts[n]->writeTiles(0, parts[n]->numXTiles(lx) - 1, 0, parts[n]->numYTiles(ly) - 1, lx, ly);
+	}
+}
+
+
+// Level (0, 0), then the others, each one filtered from a level already
+// made.  Only the levels still needed as sources are kept around.
+template <typename TiledOutput>
+static void
+WriteTileLevels(TiledOutput * const parts[], const unsigned int channels[], int num_parts,
+				const LevelImage &full_level, Imf::PixelType buf_type)
+{
+	TiledOutput &file = *parts[0];
+	
+	WriteLevel(parts, channels, num_parts, full_level, buf_type, 0, 0);
+	
+	if(file.levelMode() == MIPMAP_LEVELS)
+	{
+		assert(buf_type == Imf::FLOAT);
+		
+		ScratchBuffer buffers[2];
+		
+		LevelImage level = full_level;
+		
+		for(int l=1; l < file.numLevels(); l++)
+		{
+			MakeLevel(level, file.levelWidth(l), file.levelHeight(l), buffers[l % 2], level);
+			
+			WriteLevel(parts, channels, num_parts, level, Imf::FLOAT, l, l);
+		}
+	}
+	else if(file.levelMode() == RIPMAP_LEVELS)
+	{
+		assert(buf_type == Imf::FLOAT);
+		
+		ScratchBuffer column_buffers[2], row_buffers[2];
+		
+		LevelImage column_level = full_level; // (0, ly)
+		
+		for(int ly=0; ly < file.numYLevels(); ly++)
+		{
+			if(ly > 0)
+			{
+				MakeLevel(column_level, file.levelWidth(0), file.levelHeight(ly), column_buffers[ly % 2], column_level);
+				
+				WriteLevel(parts, channels, num_parts, column_level, Imf::FLOAT, 0, ly);
+			}
+			
+			LevelImage level = column_level;
+			
+			for(int lx=1; lx < file.numXLevels(); lx++)
+			{
+				MakeLevel(level, file.levelWidth(lx), file.levelHeight(ly), row_buffers[lx % 2], level);
+				
+				WriteLevel(parts, channels, num_parts, level, Imf::FLOAT, lx, ly);
+			}
+		}
+	}
+}
+
+
+// Auto compression tries the lossless codecs on a few blocks of the first
+// frame, each codec on its own thread.  The blocks get the same channels
+// the file will, so with Luminance/Chroma they're converted to YCA first.
+// The winner is the one that would get a frame onto the disk soonest,
+// compressing on every CPU and writing at OPENEXR_AUTO_COMPRESSION_DISK_MB
+// megabytes per second.
+#ifndef OPENEXR_AUTO_COMPRESSION_BLOCKS
+#define OPENEXR_AUTO_COMPRESSION_BLOCKS		4
+#endif
+
+#ifndef OPENEXR_AUTO_COMPRESSION_LINES
+#define OPENEXR_AUTO_COMPRESSION_LINES		32 // the most scanlines any of them puts in a chunk
+#endif
+
+#ifndef OPENEXR_AUTO_COMPRESSION_DISK_MB
+#define OPENEXR_AUTO_COMPRESSION_DISK_MB	200
+#endif
+
+typedef struct CompressionTrial
+{
+	Compression		compression;
+	const char		*name;
+	size_t			bytes; // 0 if it failed
+	double			seconds;
+} CompressionTrial;
+
+
+class CompressionTrialTask : public PriorityTask
+{
+  public:
+	CompressionTrialTask(PriorityTaskGroup *group, const Header &header, const ExportParams &params,
+							const vector<char *> &blocks, csSDK_int32 rowbytes, CompressionTrial &trial);
+	virtual ~CompressionTrialTask() {}
+	
+	virtual void execute();
+	
+  private:
+	const Header &_header;
+	const ExportParams &_params;
+	const vector<char *> &_blocks;
+	const csSDK_int32 _rowbytes;
+	CompressionTrial &_trial;
+};
+
+
+CompressionTrialTask::CompressionTrialTask(PriorityTaskGroup *group, const Header &header, const ExportParams &params,
+											const vector<char *> &blocks, csSDK_int32 rowbytes, CompressionTrial &trial) :
+	PriorityTask(group),
+	_header(header),
+	_params(params),
+	_blocks(blocks),
+	_rowbytes(rowbytes),
+	_trial(trial)
+{
+
+}
+
+
+void
+CompressionTrialTask::execute()
+{
+	try
+	{
+		Header header = _header;
+		
+		header.compression() = _trial.compression;
+		
+		const int display_width = header.displayWindow().max.x + 1;
+		const int display_height = header.displayWindow().max.y + 1;
+		
+		const int data_width = header.dataWindow().max.x + 1;
+		const int data_height = header.dataWindow().max.y + 1;
+		
+		const bool alpha = _params.alpha;
+		const unsigned int channels = kBgraColor | (alpha ? kBgraAlpha : 0);
+		
+		V3f yw;
+		
+		if(_params.lumiChrom)
+		{
+			InsertYcaChannels(header, alpha);
+			
+			yw = RgbaYca::computeYw( hasChromaticities(header) ? Imf::chromaticities(header) : Chromaticities() );
+		}
+		else
+			InsertBgraChannels(header, (_params.floatNotHalf ? Imf::FLOAT : Imf::HALF), channels);
+		
+		vector<Rgba> horiz_rows, yca_rows;
+		
+		size_t bytes = 0;
+		
+		const double start = CurrentSeconds();
+		
+		for(vector<char *>::const_iterator i = _blocks.begin(); i != _blocks.end(); ++i)
+		{
+			OMemStreamPr stream;
+			
+			{
+				FrameBuffer frameBuffer;
 				
-				const Compression compression_type = (Compression)compressionP.value.intValue;
-				
-				
-				// set up header
-				Header header(	Box2i( V2i(0,0), V2i(display_width-1, display_height-1) ),
-								Box2i( V2i(0,0), V2i(data_width-1, data_height-1) ),
-								(float)parN / (float)parD,
-								V2f(0, 0),
-								1,
-								INCREASING_Y,
-								compression_type);
-				
-				
-				if(compression_type == DWAA_COMPRESSION || compression_type == DWAB_COMPRESSION)
+				if(_params.lumiChrom)
 				{
-					addDwaCompressionLevel(header, compressionLevelP.value.floatValue);
+					// what ExportFrame does, on this thread
+					horiz_rows.resize((size_t)data_width * display_height);
+					yca_rows.resize((size_t)data_width * data_height);
+					
+					for(int y=0; y < display_height; y++)
+					{
+						YcaHorizRow((const float *)(*i - ((ptrdiff_t)_rowbytes * y)),
+									&horiz_rows[(size_t)y * data_width],
+									display_width, data_width, yw, alpha);
+					}
+					
+					for(int y=0; y < data_height; y++)
+					{
+						YcaVertRow(&horiz_rows[0], display_height, y, data_width,
+									&yca_rows[(size_t)y * data_width]);
+					}
+					
+					InsertYcaSlices(frameBuffer, &yca_rows[0], sizeof(Rgba) * data_width, alpha);
 				}
+				else
+					InsertBgraSlices(frameBuffer, Imf::FLOAT, *i, -(ptrdiff_t)_rowbytes, channels);
 				
+				// no threads, the other codecs are using the other CPUs
+				OutputFile file(stream, header, 0);
 				
-				// store the actual ratio as a custom attribute
-			#define PIXEL_ASPECT_RATIONAL_KEY	"pixelAspectRatioRational"
-				if(parN != parD)
+				file.setFrameBuffer(frameBuffer);
+				file.writePixels(data_height);
+			}
+			
+			bytes += stream.size();
+		}
+		
+		_trial.seconds = CurrentSeconds() - start;
+		_trial.bytes = bytes;
+	}
+	catch(...)
+	{
+		_trial.bytes = 0;
+	}
+}
+
+
+static Compression
+ChooseCompression(const ExportParams &params, char *frameBufferP, csSDK_int32 rowbytes, int width, int height,
+					csSDK_uint32 parN, csSDK_uint32 parD, PrTime ticksPerSecond, string &report)
+{
+	CompressionTrial trials[] = {	{ RLE_COMPRESSION,	"RLE",		0, 0.0 },
+									{ ZIPS_COMPRESSION,	"Zip",		0, 0.0 },
+									{ ZIP_COMPRESSION,	"Zip16",	0, 0.0 },
+									{ PIZ_COMPRESSION,	"Piz",		0, 0.0 } };
+	
+	const int num_trials = sizeof(trials) / sizeof(trials[0]);
+	
+	const int lines = min(OPENEXR_AUTO_COMPRESSION_LINES, height);
+	const int num_blocks = max(1, min(OPENEXR_AUTO_COMPRESSION_BLOCKS, height / lines));
+	
+	// blocks spread evenly down the frame, starting from their top scanline,
+	// remembering the PPix is upside down
+	vector<char *> blocks;
+	
+	for(int b=0; b < num_blocks; b++)
+	{
+		const int y = (num_blocks > 1 ? ((height - lines) * b) / (num_blocks - 1) : (height - lines) / 2);
+		
+		blocks.push_back(frameBufferP + ((ptrdiff_t)rowbytes * (height - 1 - y)));
+	}
+	
+	const Imf::PixelType pix_type = ((params.floatNotHalf && !params.lumiChrom) ? Imf::FLOAT : Imf::HALF);
+	
+	// the header the frames will get, except the blocks are
+	// always scanlines
+	ExportParams trial_params = params;
+	
+	trial_params.tileSize = 0;
+	
+	const Header header = MakeHeaderTemplate(trial_params, width, lines, parN, parD, ticksPerSecond, NULL);
+	
+	{
+		PriorityTaskGroup taskGroup;
+		
+		for(int i=0; i < num_trials; i++)
+		{
+			AddPriorityTask(new CompressionTrialTask(&taskGroup, header, trial_params, blocks, rowbytes, trials[i]),
+							kTaskPriority_Export);
+		}
+	}
+	
+	
+	const double sampled_bytes = (double)width * lines * num_blocks *
+									(params.alpha ? 4 : 3) * (pix_type == Imf::FLOAT ? sizeof(float) : sizeof(half));
+	
+	const double frame_scale = (double)height / (double)(lines * num_blocks);
+	
+	const double disk_bytes_per_second = OPENEXR_AUTO_COMPRESSION_DISK_MB * 1024.0 * 1024.0;
+	
+	int best = -1;
+	double best_seconds = 0.0;
+	
+	for(int i=0; i < num_trials; i++)
+	{
+		if(trials[i].bytes > 0)
+		{
+			const double compress_seconds = (trials[i].seconds * frame_scale) / (double)(gNumCPUs > 0 ? gNumCPUs : 1);
+			const double write_seconds = ((double)trials[i].bytes * frame_scale) / disk_bytes_per_second;
+			
+			if(best < 0 || (compress_seconds + write_seconds) < best_seconds)
+			{
+				best = i;
+				best_seconds = compress_seconds + write_seconds;
+			}
+		}
+	}
+	
+	if(best < 0)
+		return PIZ_COMPRESSION;
+	
+	
+	stringstream s;
+	
+	s << "Auto compression chose " << trials[best].name << ", trying " << num_blocks << "x" << lines <<
+			" scanlines of the first frame:";
+	
+	for(int i=0; i < num_trials; i++)
+	{
+		if(trials[i].bytes > 0)
+		{
+			char trial_string[256];
+			sprintf(trial_string, " %s %.1f%% size %.1f ms;", trials[i].name,
+						(100.0 * trials[i].bytes) / sampled_bytes, trials[i].seconds * 1000.0);
+			
+			s << trial_string;
+		}
+	}
+	
+	report = s.str();
+	
+	return trials[best].compression;
+}
+
+
+// part names when alpha gets its own part
+#define COLOR_PART_NAME	"color"
+#define ALPHA_PART_NAME	"alpha"
+
+
+// A frame converted out of Premiere's buffer, ready for OpenEXR.
+// When ownPixels is false, pixels that need no premultiplying are
+// read straight from the PPix, which then has to outlive the frame.
+// For half files OpenEXR converts the float slices itself, on its
+// own threads as it compresses.  Mip and rip levels are filtered
+// from float pixels, so then the copy stays float.
+class ExportFrame
+{
+  public:
+	ExportFrame(const Header &header, const ExportParams &params,
+				char *frameBufferP, csSDK_int32 rowbytes, bool ownPixels);
+	~ExportFrame() {}
+	
+	void write(OStream &outstream);
+	
+  private:
+	Header _header;
+	const bool _lumiChrom;
+	const bool _alpha;
+	const bool _separateAlpha;
+	Imf::PixelType _pix_type; // in the file
+	Imf::PixelType _buf_type; // in _origin
+	
+	ScratchBuffer _buffer;
+	char *_origin;
+	size_t _rowbytes;
+};
+
+
+ExportFrame::ExportFrame(const Header &header, const ExportParams &params,
+							char *frameBufferP, csSDK_int32 rowbytes, bool ownPixels) :
+	_header(header),
+	_lumiChrom(params.lumiChrom),
+	_alpha(params.alpha),
+	_separateAlpha(params.separateAlpha),
+	_pix_type(params.floatNotHalf ? Imf::FLOAT : Imf::HALF),
+	_buf_type(Imf::FLOAT),
+	_origin(NULL),
+	_rowbytes(0)
+{
+	const Box2i &dispW = _header.displayWindow();
+	const Box2i &dataW = _header.dataWindow();
+	
+	const int display_width = dispW.max.x - dispW.min.x + 1;
+	const int display_height = dispW.max.y - dispW.min.y + 1;
+	
+	const int data_width = dataW.max.x - dataW.min.x + 1;
+	const int data_height = dataW.max.y - dataW.min.y + 1;
+	
+	const bool alpha = _alpha;
+	
+	
+	PreviewImage preview;
+	
+	if(params.preview)
+		preview = MakePreviewImage(display_width, display_height);
+	
+	
+	if(_lumiChrom)
+	{
+		Chromaticities chromaticities;
+		
+		if( hasChromaticities(_header) )
+			chromaticities = Imf::chromaticities(_header);
+		
+		const V3f yw = RgbaYca::computeYw(chromaticities);
+		
+		
+		// rows converted and filtered horizontally, only as many as Premiere gave us
+		ScratchBuffer horiz_buffer(sizeof(Rgba) * data_width * display_height);
+		
+		Rgba *horiz_rows = (Rgba *)horiz_buffer.data();
+		
+		{
+			PriorityTaskGroup taskGroup;
+			
+			if(params.preview)
+			{
+				AddPreviewTasks(&taskGroup, frameBufferP, rowbytes, display_width, display_height,
+								preview, alpha, !params.bypassLinear, NULL);
+			}
+			
+			for(int y=0; y < display_height; y++)
+			{
+				const char *buf_row = frameBufferP + ((ptrdiff_t)rowbytes * (display_height - 1 - y));
+				
+				AddPriorityTask(new YcaHorizRowTask(&taskGroup,
+													(const float *)buf_row,
+													horiz_rows + ((size_t)y * data_width),
+													display_width,
+													data_width,
+													yw,
+													alpha), kTaskPriority_Export);
+			}
+			
+			taskGroup.wait();
+		}
+		
+		
+		_rowbytes = sizeof(Rgba) * data_width;
+		
+		_buffer.allocate(_rowbytes * data_height);
+		
+		_origin = _buffer.data();
+		
+		{
+			PriorityTaskGroup taskGroup;
+			
+			for(int y=0; y < data_height; y++)
+			{
+				AddPriorityTask(new YcaVertRowTask(&taskGroup,
+													horiz_rows,
+													display_height,
+													y,
+													data_width,
+													(Rgba *)(_origin + (_rowbytes * y))), kTaskPriority_Export);
+			}
+			
+			taskGroup.wait();
+		}
+	}
+	else
+	{
+		int width = data_width;
+		int height = data_height;
+		
+		const bool levels = (_header.hasTileDescription() && _header.tileDescription().mode != ONE_LEVEL);
+		
+		const Imf::PixelType copy_type = (levels ? Imf::FLOAT : _pix_type);
+		
+		size_t pix_size = (copy_type == Imf::FLOAT ? sizeof(float) : sizeof(half));
+		
+		// the PPix is upside down, so start from the bottom of the data window
+		char *data_origin = frameBufferP + ((ptrdiff_t)rowbytes * (dispW.max.y - dataW.max.y)) +
+								(sizeof(float) * 4 * (dataW.min.x - dispW.min.x));
+
+		_origin = data_origin;
+		_rowbytes = rowbytes;
+		
+		
+		// We have to make a copy of the world if we want to premultiply or
+		// the PPix is going away.  Then we may as well make it half.
+		if(alpha || ownPixels)
+		{
+			const size_t temp_rowbytes = ScratchRowbytes(width, pix_size * 4);
+			
+			_buffer.allocate(temp_rowbytes * height);
+			
+			char *temp_origin = _buffer.data();
+			
+			RowCopy copy;
+			
+			PriorityTaskGroup taskGroup;
+			
+			if(params.preview)
+			{
+				// the preview tasks do the copying too
+				copy.buf_origin = data_origin;
+				copy.buf_rowbytes = rowbytes;
+				copy.first_row = dispW.max.y - dataW.max.y;
+				copy.rows = height;
+				copy.width = width;
+				copy.origin = temp_origin;
+				copy.rowbytes = temp_rowbytes;
+				copy.type = copy_type;
+				copy.premult = alpha;
+				
+				AddPreviewTasks(&taskGroup, frameBufferP, rowbytes, display_width, display_height,
+								preview, alpha, !params.bypassLinear, &copy);
+			}
+			else
+			{
+				char *buf_row = data_origin;
+				char *temp_row = temp_origin;
+				
+				for(int y=0; y < height; y++)
+				{
+					if(copy_type == Imf::HALF)
+					{
+						AddPriorityTask(new ConvertBgraRowTask<float, half>(&taskGroup,
+																				(float *)buf_row,
+																				(half *)temp_row,
+																				width,
+																				alpha), kTaskPriority_Export);
+					}
+					else
+					{
+						AddPriorityTask(new ConvertBgraRowTask<float, float>(&taskGroup,
+																				(float *)buf_row,
+																				(float *)temp_row,
+																				width,
+																				alpha), kTaskPriority_Export);
+					}
+					
+					buf_row += rowbytes;
+					temp_row += temp_rowbytes;
+				}
+			}
+			
+			taskGroup.wait();
+			
+			_origin = temp_origin;
+			_rowbytes = temp_rowbytes;
+			_buf_type = copy_type;
+		}
+		else if(params.preview)
+		{
+			PriorityTaskGroup taskGroup;
+			
+			AddPreviewTasks(&taskGroup, frameBufferP, rowbytes, display_width, display_height,
+							preview, alpha, !params.bypassLinear, NULL);
+			
+			taskGroup.wait();
+		}
+	}
+	
+	
+	if(params.preview)
+		_header.setPreviewImage(preview);
+}
+
+
+void
+ExportFrame::write(OStream &outstream)
+{
+	const Box2i &dataW = _header.dataWindow();
+	
+	const int data_width = dataW.max.x - dataW.min.x + 1;
+	const int data_height = dataW.max.y - dataW.min.y + 1;
+	
+	
+	if(_lumiChrom)
+	{
+		Header header = _header;
+		
+		InsertYcaChannels(header, _alpha);
+		
+		FrameBuffer frameBuffer;
+		
+		InsertYcaSlices(frameBuffer, (Rgba *)_origin, _rowbytes, _alpha);
+		
+		
+		OutputFile file(outstream, header);
+		
+		file.setFrameBuffer(frameBuffer);
+		file.writePixels(data_height);
+	}
+	else
+	{
+		const Imf::PixelType pix_type = _pix_type;
+		const Imf::PixelType buf_type = _buf_type;
+		const ptrdiff_t buf_rowbytes = _rowbytes;
+		
+		// the PPix is upside down
+		LevelImage full_level;
+		
+		full_level.origin = _origin + (buf_rowbytes * (data_height - 1));
+		full_level.rowbytes = -buf_rowbytes;
+		full_level.width = data_width;
+		full_level.height = data_height;
+		
+		const bool tiled = _header.hasTileDescription();
+		
+		
+		if(_alpha && _separateAlpha)
+		{
+			// color and alpha in their own parts, so a reader
+			// can decompress just the one it wants
+			Header headers[2] = { _header, _header };
+			
+			const unsigned int channels[2] = { kBgraColor, kBgraAlpha };
+			
+			headers[0].setName(COLOR_PART_NAME);
+			headers[1].setName(ALPHA_PART_NAME);
+			
+			for(int n=0; n < 2; n++)
+			{
+				headers[n].setType(tiled ? TILEDIMAGE : SCANLINEIMAGE);
+				
+				InsertBgraChannels(headers[n], pix_type, channels[n]);
+			}
+			
+			
+			MultiPartOutputFile file(outstream, headers, 2);
+			
+			// The parts share the stream, so OpenEXR writes them one at a
+			// time.  Each one compresses its chunks in parallel.
+			if(tiled)
+			{
+				TiledOutputPart color_part(file, 0);
+				TiledOutputPart alpha_part(file, 1);
+				
+				TiledOutputPart * const parts[2] = { &color_part, &alpha_part };
+				
+				WriteTileLevels(parts, channels, 2, full_level, buf_type);
+			}
+			else
+			{
+				const size_t pix_size = (buf_type == Imf::FLOAT ? sizeof(float) : sizeof(half));
+				
+				// where pixel (0, 0) would be
+				char *bgra_origin = full_level.origin + (buf_rowbytes * dataW.min.y) - (ptrdiff_t)(pix_size * 4 * dataW.min.x);
+				
+				for(int n=0; n < 2; n++)
 				{
-					header.insert(PIXEL_ASPECT_RATIONAL_KEY, RationalAttribute( Rational(parN, parD) ) );
+					FrameBuffer frameBuffer;
+					
+					InsertBgraSlices(frameBuffer, buf_type, bgra_origin, -buf_rowbytes, channels[n]);
+					
+					OutputPart part(file, n);
+					
+					part.setFrameBuffer(frameBuffer);
+					part.writePixels(data_height);
 				}
+			}
+		}
+		else
+		{
+			const unsigned int channels = kBgraColor | (_alpha ? kBgraAlpha : 0);
+			
+			Header header = _header;
+			
+			InsertBgraChannels(header, pix_type, channels);
+			
+			
+			if(tiled)
+			{
+				TiledOutputFile file(outstream, header);
 				
+				TiledOutputFile * const parts[1] = { &file };
 				
-				// add time attributes
-				time_t the_time = time(NULL);
-				tm *local_time = localtime(&the_time);
+				WriteTileLevels(parts, &channels, 1, full_level, buf_type);
+			}
+			else
+			{
+				const size_t pix_size = (buf_type == Imf::FLOAT ? sizeof(float) : sizeof(half));
 				
-				if(local_time)
-				{
-					char date_string[256];
-					sprintf(date_string, "%04d:%02d:%02d %02d:%02d:%02d", local_time->tm_year + 1900, local_time->tm_mon + 1, local_time->tm_mday,
-																local_time->tm_hour, local_time->tm_min, local_time->tm_sec);
-					
-					addCapDate(header, date_string);
-			#ifdef PRWIN_ENV
-					_timeb win_time;
-					_ftime(&win_time);
-					addUtcOffset(header, (float)( (win_time.timezone - (win_time.dstflag ? 60 : 0) ) * 60));
-			#else
-					addUtcOffset(header, (float)-local_time->tm_gmtoff);
-			#endif
-				}
+				// where pixel (0, 0) would be
+				char *bgra_origin = full_level.origin + (buf_rowbytes * dataW.min.y) - (ptrdiff_t)(pix_size * 4 * dataW.min.x);
 				
+				FrameBuffer frameBuffer;
 				
-				PrTime ticksPerSecond;
-				mySettings->timeSuite->GetTicksPerSecond(&ticksPerSecond);
+				InsertBgraSlices(frameBuffer, buf_type, bgra_origin, -buf_rowbytes, channels);
 				
-				// FPS
-				if(ticksPerSecond < limits<int>::max() &&
-					frameRateP.value.timeValue < limits<unsigned int>::max())
-				{
-					addFramesPerSecond(header, Rational(ticksPerSecond, frameRateP.value.timeValue) );
-				}
-				else
-					addFramesPerSecond(header, Rational((double)ticksPerSecond / (double)frameRateP.value.timeValue) );
-					
+				OutputFile file(outstream, header);
 				
-				// timecode
-				PrTime frameRates[] = {	10, 15, 23,
-										24, 25, 29,
-										30, 50, 59,
-										60};
-																
-				PrTime frameRateNumDens[][2] = {{10, 1}, {15, 1}, {24000, 1001},
-												{24, 1}, {25, 1}, {30000, 1001},
-												{30, 1}, {50, 1}, {60000, 1001},
-												{60, 1}};
+				file.setFrameBuffer(frameBuffer);
+				file.writePixels(data_height);
+			}
+		}
+	}
+}
+
+
+// Frames that have been rendered and converted, waiting for (or in the
+// middle of) compression, or compressed and waiting their turn to be
+// written.  Each slot holds one frame, so the slot count bounds the memory.
+// PIZ and DWA only get so much parallelism out of one file, so with lots of
+// cores we compress several frames at once.  0 means start at 2 and grow
+// as the export runs, see GrowPipelineDepth().
+#ifndef OPENEXR_EXPORT_PIPELINE_DEPTH
+#define OPENEXR_EXPORT_PIPELINE_DEPTH	0
+#endif
+
+#ifndef OPENEXR_EXPORT_MAX_PIPELINE_DEPTH
+#define OPENEXR_EXPORT_MAX_PIPELINE_DEPTH	16
+#endif
+
+// Each frame being compressed holds a pool thread while it waits on the
+// tasks OpenEXR starts from inside the write, so leave at least one free.
+static unsigned int
+MaxPipelineDepth()
+{
+	if(gNumCPUs < 2)
+		return 0;
+	
+	const unsigned int depth = (OPENEXR_EXPORT_PIPELINE_DEPTH > 0 ? OPENEXR_EXPORT_PIPELINE_DEPTH : OPENEXR_EXPORT_MAX_PIPELINE_DEPTH);
+	
+	return min<unsigned int>(depth, gNumCPUs - 1);
+}
+
+
+static unsigned int
+ExportPipelineDepth()
+{
+	const unsigned int depth = (OPENEXR_EXPORT_PIPELINE_DEPTH > 0 ? OPENEXR_EXPORT_PIPELINE_DEPTH : 2);
+	
+	return min<unsigned int>(depth, MaxPipelineDepth());
+}
+
+
+// Frames that look just like the one before (title cards, holds) are not
+// compressed again, the file from the frame before is reused.
+#ifndef OPENEXR_EXPORT_REPEAT_FRAMES
+#define OPENEXR_EXPORT_REPEAT_FRAMES	1
+#endif
+
+// A quick hash of each row of a frame, to spot a repeat
+// without keeping the last frame's pixels around.
+class HashRowTask : public PriorityTask
+{
+  public:
+	HashRowTask(PriorityTaskGroup *group, const char *row, size_t length, Int64 &hash);
+	virtual ~HashRowTask() {}
+	
+	virtual void execute();
+	
+  private:
+	const char *_row;
+	const size_t _length;
+	Int64 &_hash;
+};
+
+
+HashRowTask::HashRowTask(PriorityTaskGroup *group, const char *row, size_t length, Int64 &hash) :
+	PriorityTask(group),
+	_row(row),
+	_length(length),
+	_hash(hash)
+{
+
+}
+
+
+void
+HashRowTask::execute()
+{
+	Int64 hash = 0x9e3779b97f4a7c15LL ^ _length;
+	
+	size_t i = 0;
+	
+	for(; i + sizeof(Int64) <= _length; i += sizeof(Int64))
+	{
+		Int64 word;
+		memcpy(&word, _row + i, sizeof(Int64));
+		
+		hash ^= word * 0x87c37b91114253d5LL;
+		hash = (hash << 31) | (hash >> 33);
+		hash *= 0x4cf5ad432745937fLL;
+	}
+	
+	for(; i < _length; i++)
+	{
+		hash ^= (unsigned char)_row[i];
+		hash *= 0x100000001b3LL;
+	}
+	
+	_hash = hash;
+}
+
+
+static void
+HashFrame(const char *frameBufferP, csSDK_int32 rowbytes, int width, int height, vector<Int64> &hashes)
+{
+	hashes.resize(height);
+	
+	PriorityTaskGroup taskGroup;
+	
+	for(int y=0; y < height; y++)
+	{
+		AddPriorityTask(new HashRowTask(&taskGroup, frameBufferP + ((ptrdiff_t)rowbytes * y),
+										sizeof(float) * 4 * width, hashes[y]), kTaskPriority_Export);
+	}
+	
+	taskGroup.wait();
+}
+
+
+// Where an attribute's value is in each header of the file, empty if it's
+// missing from any of them.  Multi-part files have a header for every part,
+// with an empty header after the last one.
+static void
+FindAttributeValues(const char *data, size_t size, const char *name, const char *type, size_t value_size,
+					vector<size_t> &positions)
+{
+	positions.clear();
+	
+	if(size < 8)
+		return;
+	
+	const unsigned char *v = (const unsigned char *)data + 4;
+	
+	const int version = v[0] | (v[1] << 8) | (v[2] << 16) | (v[3] << 24);
+	
+	const bool multi_part = isMultiPart(version);
+	
+	size_t pos = 8; // magic number and version
+	
+	bool found = false;
+	
+	while(pos < size)
+	{
+		if(data[pos] == '\0')
+		{
+			// end of a header
+			if(!found)
+			{
+				positions.clear();
+				return;
+			}
+			
+			pos++;
+			
+			if(!multi_part || pos >= size || data[pos] == '\0')
+				return;
+			
+			found = false;
+			
+			continue;
+		}
+		
+		size_t name_end = pos;
+		
+		while(name_end < size && data[name_end] != '\0')
+			name_end++;
+		
+		size_t type_end = name_end + 1;
+		
+		while(type_end < size && data[type_end] != '\0')
+			type_end++;
+		
+		if(type_end + 5 > size)
+			break;
+		
+		const unsigned char *s = (const unsigned char *)data + type_end + 1;
+		
+		const size_t attr_size = s[0] | (s[1] << 8) | (s[2] << 16) | ((size_t)s[3] << 24);
+		
+		const size_t value_pos = type_end + 5;
+		
+		if(value_pos + attr_size > size)
+			break;
+		
+		if(strcmp(data + pos, name) == 0 && strcmp(data + name_end + 1, type) == 0)
+		{
+			if(attr_size != value_size)
+				break;
+			
+			positions.push_back(value_pos);
+			
+			found = true;
+		}
+		
+		pos = value_pos + attr_size;
+	}
+	
+	positions.clear(); // ran off the end
+}
+
+
+// The file from the frame before, with this frame's timecode patched in,
+// once for every part.  A timecode attribute is always the same size,
+// so nothing else moves.
+static void
+WriteRepeatedFrame(const OMemStreamPr &file, const TimeCode *timecode, OStream &outstream)
+{
+	vector<size_t> value_positions;
+	
+	if(timecode != NULL)
+		FindAttributeValues(file.data(), file.size(), "timeCode", "timecode", 8, value_positions);
+	
+	if( value_positions.empty() )
+	{
+		file.writeTo(outstream);
+	}
+	else
+	{
+		const unsigned int words[2] = { timecode->timeAndFlags(), timecode->userData() };
+		
+		unsigned char value[8];
+		
+		for(int i=0; i < 2; i++)
+		{
+			value[(i * 4) + 0] = (words[i] >>  0) & 0xff;
+			value[(i * 4) + 1] = (words[i] >>  8) & 0xff;
+			value[(i * 4) + 2] = (words[i] >> 16) & 0xff;
+			value[(i * 4) + 3] = (words[i] >> 24) & 0xff;
+		}
+		
+		size_t pos = 0;
+		
+		for(vector<size_t>::const_iterator i = value_positions.begin(); i != value_positions.end(); ++i)
+		{
+			file.writeTo(outstream, pos, *i - pos);
+			
+			outstream.write((const char *)value, 8);
+			
+			pos = *i + 8;
+		}
+		
+		file.writeTo(outstream, pos, file.size() - pos);
+	}
+}
+
+
+typedef struct EncodedFrame
+{
+	OMemStreamPr			*file; // NULL if the frame failed
+	bool					repeat; // write the frame before again
+	bool					have_timecode;
+	TimeCode				timecode;
+	vector<prUTF16Char>		path;
+	
+	EncodedFrame() : file(NULL), repeat(false), have_timecode(false) {}
+} EncodedFrame;
+
+// Sequence files are encoded in memory and written out on their own thread,
+// so a slow disk holds up neither rendering nor compression.  Frames are
+// written in the order they come in.  At most OPENEXR_EXPORT_WRITE_QUEUE
+// files wait here, after that write() blocks.
+#ifndef OPENEXR_EXPORT_WRITE_QUEUE
+#define OPENEXR_EXPORT_WRITE_QUEUE	4
+#endif
+
+class SequenceWriter : public Thread
+{
+  public:
+	SequenceWriter(unsigned int depth);
+	virtual ~SequenceWriter();
+	
+	virtual void run();
+	
+	// takes ownership of frame.file
+	void write(const EncodedFrame &frame);
+	
+	// writes whatever is left and stops the thread
+	void finish();
+	
+	bool failed();
+	
+  private:
+	void writeFrame(const EncodedFrame &frame);
+	
+	const bool _threaded;
+	bool _finished;
+	
+	Semaphore _slots;
+	Semaphore _queued;
+	Semaphore _done;
+	
+	Mutex _mutex;
+	list<EncodedFrame> _queue;
+	bool _quit;
+	bool _failed;
+	
+	OMemStreamPr *_last_file; // for repeats, only touched by the writing thread
+};
+
+
+SequenceWriter::SequenceWriter(unsigned int depth) :
+	_threaded( supportsThreads() ),
+	_finished(false),
+	_slots(depth),
+	_queued(0),
+	_done(0),
+	_quit(false),
+	_failed(false),
+	_last_file(NULL)
+{
+	if(_threaded)
+		start();
+}
+
+
+SequenceWriter::~SequenceWriter()
+{
+	finish();
+	
+	for(list<EncodedFrame>::iterator i = _queue.begin(); i != _queue.end(); ++i)
+		delete i->file;
+	
+	delete _last_file;
+}
+
+
+void
+SequenceWriter::run()
+{
+	while(true)
+	{
+		_queued.wait();
+		
+		EncodedFrame frame;
+		
+		{
+			Lock lock(_mutex);
+			
+			if(_queue.empty())
+			{
+				assert(_quit);
+				break;
+			}
+			
+			frame = _queue.front();
+			
+			_queue.pop_front();
+		}
+		
+		writeFrame(frame);
+		
+		_slots.post();
+	}
+	
+	_done.post();
+}
+
+
+void
+SequenceWriter::write(const EncodedFrame &frame)
+{
+	if(_threaded)
+	{
+		_slots.wait();
+		
+		try
+		{
+			Lock lock(_mutex);
+			
+			_queue.push_back(frame);
+		}
+		catch(...)
+		{
+			delete frame.file;
+			
+			_slots.post();
+			
+			throw;
+		}
+		
+		_queued.post();
+	}
+	else
+		writeFrame(frame);
+}
+
+
+void
+SequenceWriter::finish()
+{
+	if(_threaded && !_finished)
+	{
+		{
+			Lock lock(_mutex);
+			
+			_quit = true;
+		}
+		
+		_queued.post();
+		
+		_done.wait();
+	}
+	
+	_finished = true;
+}
+
+
+bool
+SequenceWriter::failed()
+{
+	Lock lock(_mutex);
+	
+	return _failed;
+}
+
+
+void
+SequenceWriter::writeFrame(const EncodedFrame &frame)
+{
+	OMemStreamPr *file = (frame.repeat ? _last_file : frame.file);
+	
+	if(file != NULL && !failed())
+	{
+		try
+		{
+			OFStreamPr outstream(&frame.path[0]);
+			
+			if(frame.repeat)
+				WriteRepeatedFrame(*file, (frame.have_timecode ? &frame.timecode : NULL), outstream);
+			else
+				file->writeTo(outstream);
+			
+			outstream.close();
+		}
+		catch(...)
+		{
+			Lock lock(_mutex);
+			
+			_failed = true;
+		}
+	}
+	
+	if(!frame.repeat)
+	{
+		delete _last_file;
+		
+		_last_file = frame.file;
+	}
+}
+
+
+typedef struct ExportPipeline
+{
+	Semaphore	slots;
+	Mutex		mutex;
+	bool		failed;
+	
+	// frames finish compressing in any order, but the files
+	// go to the writer in frame order
+	int							next_commit;
+	map<int, EncodedFrame>		encoded;
+	
+	SequenceWriter				*writer;
+	bool						committing; // someone is passing frames to the writer
+	
+	// how long frames take to compress, start to finish
+	double						encode_seconds;
+	int							encoded_frames;
+	
+	ExportPipeline(unsigned int depth, SequenceWriter *w) : slots(depth), failed(false), next_commit(0), writer(w),
+															committing(false), encode_seconds(0.0), encoded_frames(0) {}
+	~ExportPipeline();
+} ExportPipeline;
+
+
+ExportPipeline::~ExportPipeline()
+{
+	// only left over if the export stopped early
+	for(map<int, EncodedFrame>::iterator i = encoded.begin(); i != encoded.end(); ++i)
+		delete i->second.file;
+}
+
+
+// Hand a compressed frame to the pipeline, then pass every frame that is
+// ready on to the writer, in order.  One thread at a time does the passing,
+// without the mutex, because the writer can block when its queue is full.
+// Each frame passed on frees its slot.  Takes ownership of frame.file.
+static void
+CommitSequenceFrame(ExportPipeline *pipeline, int frame_num, const EncodedFrame &frame)
+{
+	{
+		Lock lock(pipeline->mutex);
+		
+		pipeline->encoded[frame_num] = frame;
+		
+		if(pipeline->committing)
+			return; // that thread will pick this frame up too
+		
+		pipeline->committing = true;
+	}
+	
+	while(true)
+	{
+		vector<EncodedFrame> ready;
+		bool failed = false;
+		
+		{
+			Lock lock(pipeline->mutex);
+			
+			map<int, EncodedFrame>::iterator next = pipeline->encoded.find(pipeline->next_commit);
+			
+			while(next != pipeline->encoded.end())
+			{
+				ready.push_back(next->second);
 				
-				int frameRateBase[] = {	10, 15, 24,
-										24, 25, 30,
-										30, 50, 60,
-										60};
+				pipeline->encoded.erase(next);
 				
-				bool dropFrame[] =	{	false, false, false,
-										false, false, true,
-										false, false, true,
-										false };
+				next = pipeline->encoded.find(++pipeline->next_commit);
+			}
+			
+			if(ready.empty())
+			{
+				pipeline->committing = false;
 				
-				for(csSDK_int32 i=0; i < sizeof(frameRates) / sizeof (PrTime); i++)
-				{
-					frameRates[i] = ticksPerSecond / frameRateNumDens[i][0] * frameRateNumDens[i][1];
-				}
+				return;
+			}
+			
+			failed = pipeline->failed;
+		}
+		
+		for(vector<EncodedFrame>::iterator i = ready.begin(); i != ready.end(); ++i)
+		{
+			EncodedFrame &next_frame = *i;
+			
+			if(failed)
+			{
+				delete next_frame.file;
 				
+				next_frame.file = NULL;
+				next_frame.repeat = false;
+			}
+			
+			try
+			{
+				pipeline->writer->write(next_frame);
+			}
+			catch(...)
+			{
+				Lock lock(pipeline->mutex);
 				
-				int frameRateIndex = -1;
+				pipeline->failed = failed = true;
+			}
+			
+			pipeline->slots.post();
+		}
+	}
+}
+
+
+// Keep enough frames in flight that compression keeps up with rendering:
+// the one being rendered, plus however many finish compressing in the time
+// it takes to render one.  Measured as the export goes, and only ever grows.
+static void
+GrowPipelineDepth(ExportPipeline &pipeline, unsigned int &depth, double render_seconds)
+{
+	if(OPENEXR_EXPORT_PIPELINE_DEPTH > 0 || render_seconds <= 0.0)
+		return;
+	
+	double encode_seconds = 0.0;
+	
+	{
+		Lock lock(pipeline.mutex);
+		
+		if(pipeline.encoded_frames == 0)
+			return;
+		
+		encode_seconds = pipeline.encode_seconds / pipeline.encoded_frames;
+	}
+	
+	const unsigned int target = min<unsigned int>((unsigned int)ceil(encode_seconds / render_seconds) + 1, MaxPipelineDepth());
+	
+	while(depth < target)
+	{
+		pipeline.slots.post();
+		
+		depth++;
+	}
+}
+
+
+class EncodeSequenceFrameTask : public PriorityTask
+{
+  public:
+	EncodeSequenceFrameTask(PriorityTaskGroup *group, ExportPipeline *pipeline,
+							ExportFrame *frame, int frame_num, const EncodedFrame &encoded);
+	virtual ~EncodeSequenceFrameTask();
+	
+	virtual void execute();
+	
+  private:
+	ExportPipeline *_pipeline;
+	ExportFrame *_frame;
+	const int _frame_num;
+	EncodedFrame _encoded;
+};
+
+
+EncodeSequenceFrameTask::EncodeSequenceFrameTask(PriorityTaskGroup *group, ExportPipeline *pipeline,
+												ExportFrame *frame, int frame_num, const EncodedFrame &encoded) :
+	PriorityTask(group),
+	_pipeline(pipeline),
+	_frame(frame),
+	_frame_num(frame_num),
+	_encoded(encoded)
+{
+
+}
+
+
+EncodeSequenceFrameTask::~EncodeSequenceFrameTask()
+{
+	delete _frame;
+}
+
+
+void
+EncodeSequenceFrameTask::execute()
+{
+	OMemStreamPr *file = NULL;
+	
+	const double start = CurrentSeconds();
+	
+	try
+	{
+		file = new OMemStreamPr;
+		
+		_frame->write(*file);
+		
+		Lock lock(_pipeline->mutex);
+		
+		_pipeline->encode_seconds += CurrentSeconds() - start;
+		_pipeline->encoded_frames++;
+	}
+	catch(...)
+	{
+		delete file;
+		
+		file = NULL;
+		
+		Lock lock(_pipeline->mutex);
+		
+		_pipeline->failed = true;
+	}
+	
+	// done with the pixels
+	delete _frame;
+	
+	_frame = NULL;
+	
+	_encoded.file = file;
+	
+	CommitSequenceFrame(_pipeline, _frame_num, _encoded);
+}
+
+
+// Premiere gives us /path/name.exr, frames go to /path/name0000.exr
+static void
+MakeSequenceFramePath(const vector<prUTF16Char> &path, int frame, vector<prUTF16Char> &frame_path)
+{
+	size_t ext_pos = path.size();
+	
+	for(size_t i = path.size(); i > 0; i--)
+	{
+		const prUTF16Char c = path[i - 1];
+		
+		if(c == '.')
+		{
+			ext_pos = i - 1;
+			break;
+		}
+		else if(c == '/' || c == '\\')
+			break;
+	}
+	
+	char frame_string[32];
+	sprintf(frame_string, "%04d", frame);
+	
+	frame_path.assign(path.begin(), path.begin() + ext_pos);
+	
+	for(const char *c = frame_string; *c != '\0'; c++)
+		frame_path.push_back(*c);
+	
+	frame_path.insert(frame_path.end(), path.begin() + ext_pos, path.end());
+	
+	frame_path.push_back('\0');
+}
+
+
+static prMALError
+exSDKExport(
+	exportStdParms	*stdParmsP,
+	exDoExportRec	*exportInfoP)
+{
+	prMALError					result					= malNoError;
+	ExportSettings				*mySettings				= reinterpret_cast<ExportSettings*>(exportInfoP->privateData);
+	PrSDKExportParamSuite		*paramSuite				= mySettings->exportParamSuite;
+	PrSDKSequenceRenderSuite	*renderSuite			= mySettings->sequenceRenderSuite;
+	PrSDKPPixSuite				*pixSuite				= mySettings->ppixSuite;
+	PrSDKExportProgressSuite	*progressSuite			= mySettings->exportProgressSuite;
+
+	if(!exportInfoP->exportVideo)
+		return malNoError;
+
+
+	csSDK_uint32 exID = exportInfoP->exporterPluginID;
+	
+	ExportParams params;
+	GetExportParams(paramSuite, exID, params);
+	
+	
+	SequenceRender_ParamsRec renderParms;
+	const PrPixelFormat pixelFormat = (params.bypassLinear ?
+										PrPixelFormat_BGRA_4444_32f :
+										PrPixelFormat_BGRA_4444_32f_Linear);
+	
+	
+	renderParms.inRequestedPixelFormatArray = &pixelFormat;
+	renderParms.inRequestedPixelFormatArrayCount = 1;
+	renderParms.inWidth = params.width;
+	renderParms.inHeight = params.height;
+	renderParms.inPixelAspectRatioNumerator = params.parNum;
+	renderParms.inPixelAspectRatioDenominator = params.parDen;
+	renderParms.inRenderQuality = (exportInfoP->maximumRenderQuality ? kPrRenderQuality_Max : kPrRenderQuality_High);
+	renderParms.inFieldType = params.fieldType;
+	renderParms.inDeinterlace = kPrFalse;
+	renderParms.inDeinterlaceQuality = (exportInfoP->maximumRenderQuality ? kPrRenderQuality_Max : kPrRenderQuality_High);
+	renderParms.inCompositeOnBlack = (params.alpha ? kPrFalse: kPrTrue);
+	
+	
+	// In one-pass sequence mode we get the whole range in a single call
+	// and name the files ourselves.  Otherwise it's one frame per call.
+	const bool write_sequence = (params.sequence && params.onePass);
+	
+	// Frame-at-a-time calls for one job each pick up where the last one
+	// ended.  Anything else is a new job, which gets a new Auto trial.
+	if(write_sequence || exportInfoP->startTime != mySettings->lastExportEndTime)
+		mySettings->haveAutoCompression = false;
+	
+	mySettings->lastExportEndTime = exportInfoP->endTime;
+	
+	vector<prUTF16Char> sequence_path;
+	
+	int num_frames = 1;
+	
+	if(write_sequence)
+	{
+		csSDK_int32 path_length = 0;
+		mySettings->exportFileSuite->GetPlatformPath(exportInfoP->fileObject, &path_length, NULL);
+		
+		if(path_length <= 0)
+			return exportReturn_ErrIo;
+		
+		sequence_path.resize(path_length + 1, 0);
+		
+		mySettings->exportFileSuite->GetPlatformPath(exportInfoP->fileObject, &path_length, &sequence_path[0]);
+		
+		sequence_path.resize(prUTF16CharLength(&sequence_path[0]));
+		
+		if(params.frameRate > 0 && exportInfoP->endTime > exportInfoP->startTime)
+		{
+			num_frames = (exportInfoP->endTime - exportInfoP->startTime + params.frameRate - 1) / params.frameRate;
+		}
+	}
+	
+	
+	PrTime ticksPerSecond;
+	mySettings->timeSuite->GetTicksPerSecond(&ticksPerSecond);
+	
+	ExportTimecode timecode;
+	
+	const bool have_timecode = GetExportTimecode(mySettings, exID, exportInfoP->startTime, params.frameRate,
+													ticksPerSecond, timecode);
+	
+	
+	// Auto never picks a level, the setting is hidden then
+	const bool zip_level = (!params.autoCompression &&
+							(params.compression == ZIPS_COMPRESSION || params.compression == ZIP_COMPRESSION));
+	
+	SetZipCompressionLevel(zip_level ? params.zipLevel : EXR_DEFAULT_ZIP_LEVEL);
+	
+	
+	csSDK_uint32 videoRenderID;
+	renderSuite->MakeVideoRenderer(exID, &videoRenderID, params.frameRate);
+	
+	
+	// While sequence frames are compressed on worker threads,
+	// we go on to render the next ones.
+	unsigned int pipeline_depth = ((write_sequence && num_frames > 1) ? ExportPipelineDepth() : 0);
+	
+	double render_seconds = 0.0; // for growing the pipeline
+	
+	// and the files are written out on another thread
+	auto_ptr<SequenceWriter> writer(write_sequence ? new SequenceWriter(OPENEXR_EXPORT_WRITE_QUEUE) : NULL);
+	
+	ExportPipeline pipeline(pipeline_depth, writer.get());
+	
+	auto_ptr<PriorityTaskGroup> pipelineGroup(new PriorityTaskGroup);
+	
+	int next_prefetch = 1;
+	
+	
+	// for spotting frames that repeat the one before
+	const bool check_repeats = (write_sequence && num_frames > 1 && OPENEXR_EXPORT_REPEAT_FRAMES);
+	
+	vector<Int64> last_hashes, frame_hashes;
+	bool have_last = false;
+	
+	int repeated_frames = 0;
+	
+	
+	Header header_template;
+	bool have_template = false;
+	
+	for(int i=0; i < num_frames && result == malNoError; i++)
+	{
+		const PrTime frame_time = exportInfoP->startTime + (i * params.frameRate);
+		
+		// get Premiere reading media for the frames coming up
+		for(; pipeline_depth > 0 && next_prefetch < num_frames && next_prefetch <= (i + (int)pipeline_depth); next_prefetch++)
+		{
+			renderSuite->PrefetchMediaWithRenderParameters(videoRenderID,
+															exportInfoP->startTime + (next_prefetch * params.frameRate),
+															&renderParms);
+		}
+		
+		const double render_start = CurrentSeconds();
+		
+		SequenceRender_GetFrameReturnRec renderResult;
+		result = renderSuite->RenderVideoFrame(videoRenderID,
+												frame_time,
+												&renderParms,
+												kRenderCacheType_None,
+												&renderResult);
+		
+		render_seconds += CurrentSeconds() - render_start;
+		
+		if(result == suiteError_CompilerCompileAbort)
+			break;
+		
+		
+		char *frameBufferP = NULL;
+		csSDK_int32 rowbytes = 0;
+		PrPixelFormat pixFormat;
+		prRect bounds;
+		csSDK_uint32 parN, parD;
+		
+		pixSuite->GetPixels(renderResult.outFrame, PrPPixBufferAccess_ReadOnly, &frameBufferP);
+		pixSuite->GetRowBytes(renderResult.outFrame, &rowbytes);
+		pixSuite->GetPixelFormat(renderResult.outFrame, &pixFormat);
+		pixSuite->GetBounds(renderResult.outFrame, &bounds);
+		pixSuite->GetPixelAspectRatio(renderResult.outFrame, &parN, &parD);
+		
+		
+		bool frame_queued = false;
+		
+		if(pixFormat == PrPixelFormat_BGRA_4444_32f_Linear || pixFormat == PrPixelFormat_BGRA_4444_32f)
+		{
+			try
+			{
+				if( supportsThreads() )
+					setGlobalThreadCount(gNumCPUs);
 				
-				for(csSDK_int32 i=0; i < sizeof(frameRates) / sizeof (PrTime); i++)
-				{
-					if(frameRateP.value.timeValue == frameRates[i])
-						frameRateIndex = i;
-				}
 				
-				if(frameRateIndex >= 0)
+				if(!have_template)
 				{
-				#if EXPORTMOD_VERSION >= 4
-					PrParam timecodeP;
-					exportInfoSuite->GetExportSourceInfo(exID, kExportInfo_SourceTimecode, &timecodeP);
-					
-					ExporterTimecodeRec *timecodeRec = (ExporterTimecodeRec *)timecodeP.mMemoryPtr;
-					
-					int frame_num = 0;
-					int alt_timecode_base = 0;
-					bool alt_drop_frame = false;
+					string compression_report;
 					
-					if(timecodeRec)
+					if(params.autoCompression)
 					{
-						frame_num = timecodeRec->mTimecodeTicks / timecodeRec->mTicksPerFrame;
-						
-						alt_timecode_base = ((float)ticksPerSecond / (float)timecodeRec->mTicksPerFrame) + 0.5f;
+						if(!mySettings->haveAutoCompression)
+						{
+							string report;
+							
+							mySettings->autoCompression = ChooseCompression(params, frameBufferP, rowbytes,
+																			bounds.right - bounds.left,
+																			bounds.bottom - bounds.top,
+																			parN, parD, ticksPerSecond,
+																			report);
+							
+							strncpy(mySettings->autoCompressionReport, report.c_str(),
+									sizeof(mySettings->autoCompressionReport) - 1);
+							
+							mySettings->haveAutoCompression = true;
+						}
 						
-						alt_drop_frame = timecodeRec->mTimecodeStartPrefersDropFrame;
-					
-						memorySuite->PrDisposePtr(timecodeP.mMemoryPtr);
+						params.compression = mySettings->autoCompression;
+						compression_report = mySettings->autoCompressionReport;
 					}
-					else
+					
+					header_template = MakeHeaderTemplate(params,
+															bounds.right - bounds.left,
+															bounds.bottom - bounds.top,
+															parN, parD, ticksPerSecond,
+															(have_timecode ? &timecode : NULL));
+					
+					if( !compression_report.empty() )
 					{
-						frame_num = (exportInfoP->startTime * frameRateNumDens[frameRateIndex][0]) /
-										(ticksPerSecond * frameRateNumDens[frameRateIndex][1]);
+						const string all_comments = (hasComments(header_template) ?
+														comments(header_template) + "\n" + compression_report :
+														compression_report);
+						
+						addComments(header_template, all_comments);
 					}
 					
+					have_template = true;
+				}
+				
+				const TimeCode frame_timecode = (have_timecode ?
+													CalculateTimeCode(timecode.frame_num + i, timecode.timecode_base, timecode.drop_frame) :
+													TimeCode());
+				
+				bool repeat = false;
+				
+				if(check_repeats)
+				{
+					HashFrame(frameBufferP, rowbytes, bounds.right - bounds.left, bounds.bottom - bounds.top, frame_hashes);
 					
-					const int alt_frame_num = (exportInfoP->startTime * frameRateNumDens[frameRateIndex][0]) /
-										(ticksPerSecond * frameRateNumDens[frameRateIndex][1]);
-										
-					const int timecode_base = frameRateBase[frameRateIndex];
-					
-					const bool drop_frame = dropFrame[frameRateIndex];
+					repeat = (have_last && frame_hashes == last_hashes);
 					
+					last_hashes.swap(frame_hashes);
 					
-					assert(frame_num == alt_frame_num);
-					assert(timecode_base == alt_timecode_base);
-					assert(drop_frame == alt_drop_frame); // this will fail with the export frame button
-				#else
-					const int frame_num = (exportInfoP->startTime * frameRateNumDens[frameRateIndex][0]) /
-										(ticksPerSecond * frameRateNumDens[frameRateIndex][1]);
-										
-					const int timecode_base = frameRateBase[frameRateIndex];
+					have_last = false; // until this frame is on its way
+				}
+				
+				
+				Header header = header_template;
+				
+				ExportParams frame_params = params;
+				
+				if(params.alpha && (params.cropToAlpha || params.dropOpaqueAlpha) && !repeat)
+				{
+					Box2i alpha_bounds;
+					bool opaque = false;
 					
-					const bool drop_frame = dropFrame[frameRateIndex];
-				#endif
+					ScanAlpha(frameBufferP, rowbytes, bounds.right - bounds.left, bounds.bottom - bounds.top,
+								alpha_bounds, opaque);
 					
+					if(params.cropToAlpha && !params.lumiChrom)
+						header.dataWindow() = alpha_bounds;
 					
-					addTimeCode(header, CalculateTimeCode(frame_num, timecode_base, drop_frame));
-
-					// we'll reset the FPS with the real values while we're at it
-					addFramesPerSecond(header, Rational(frameRateNumDens[frameRateIndex][0], frameRateNumDens[frameRateIndex][1]) );
+					// no A channel and no premultiplying
+					if(params.dropOpaqueAlpha && opaque)
+						frame_params.alpha = false;
 				}
 				
+				if(have_timecode)
+					addTimeCode(header, frame_timecode);
 				
-				// graffiti
-				header.insert("writer", StringAttribute("ProEXR for Premiere"));
 				
-				
-				// Color space
-				if(bypassLinearP.value.intValue)
-					addComments(header, "Conversion to linear bypassed in Premiere");
-	
-	
-				if(lumiChrom)
+				if(pipeline_depth > 0)
 				{
-					// make our Rgba buffer
-					Array2D<Rgba> half_buffer(data_height, data_width);
+					// convert here, because the PPix goes away,
+					// then compress on a worker
+					pipeline.slots.wait();
 					
-					char *buf_row = frameBufferP;
+					frame_queued = true; // one way or another
 					
-					for(int y = display_height - 1; y >= 0; y--)
-					{
-						float *buf_pix = (float *)buf_row;
+					EncodedFrame encoded;
 					
-						for(int x=0; x < display_width; x++)
-						{
-							half_buffer[y][x].b = *buf_pix++;
-							half_buffer[y][x].g = *buf_pix++;
-							half_buffer[y][x].r = *buf_pix++;
-							half_buffer[y][x].a = *buf_pix++;
-							
-							if(alpha)
-								Premultiply( half_buffer[y][x] );
-						}
+					encoded.repeat = repeat;
+					encoded.have_timecode = have_timecode;
+					encoded.timecode = frame_timecode;
+					
+					try
+					{
+						MakeSequenceFramePath(sequence_path, i, encoded.path);
 						
-						if(data_width == (display_width + 1))
+						if(repeat)
 						{
-							half_buffer[y][data_width - 1] = half_buffer[y][display_width - 1];
+							CommitSequenceFrame(&pipeline, i, encoded);
 						}
-						
-						buf_row += rowbytes;
-					}
-					
-					if(data_height == (display_height + 1))
-					{
-						for(int x=0; x < data_width; x++)
+						else
 						{
-							half_buffer[data_height - 1][x] = half_buffer[display_height - 1][x];
+							auto_ptr<ExportFrame> frame(new ExportFrame(header, frame_params, frameBufferP, rowbytes, true));
+							
+							EncodeSequenceFrameTask *task = new EncodeSequenceFrameTask(pipelineGroup.get(), &pipeline,
+																						frame.get(), i, encoded);
+							
+							frame.release(); // task deletes it and commits the frame
+							
+							AddPriorityTask(task, kTaskPriority_Export);
 						}
 					}
-					
-					
-					// write file
-					const RgbaChannels rgba_channels = (alpha ? WRITE_YCA : WRITE_YC);
-		
-					OStreamPr outstream(mySettings->exportFileSuite, exportInfoP->fileObject);
-					RgbaOutputFile outputFile(outstream, header, rgba_channels);
-					
-					outputFile.setFrameBuffer(&half_buffer[0][0], 1, data_width);
-					outputFile.writePixels(data_height);
+					catch(...)
+					{
+						// keep the frames after this one moving
+						encoded.repeat = false;
+						
+						CommitSequenceFrame(&pipeline, i, encoded);
+						
+						throw;
+					}
 				}
-				else
+				else if(write_sequence)
 				{
-					int width = data_width;
-					int height = data_height;
-					
-					Imf::PixelType pix_type = (floatNotHalf ? Imf::FLOAT : Imf::HALF);
-					size_t pix_size = (pix_type == Imf::FLOAT ? sizeof(float) : sizeof(half));
-
-					char *buf_origin = frameBufferP;
-					size_t buf_rowbytes = rowbytes;
+					EncodedFrame encoded;
 					
+					encoded.repeat = repeat;
+					encoded.have_timecode = have_timecode;
+					encoded.timecode = frame_timecode;
 					
-					PPixHand tempWorld = NULL;
+					MakeSequenceFramePath(sequence_path, i, encoded.path);
 					
-					// we have to make a copy of the world if we want to create Half pixels or just premultiply
-					if(pix_type == Imf::HALF || alpha)
+					if(!repeat)
 					{
-						PrPixelFormat pix_format = (pix_type == Imf::HALF ? PrPixelFormat_BGRA_4444_16u : PrPixelFormat_BGRA_4444_32f_Linear);
-
-						pixCreatorSuite->CreatePPix(&tempWorld, PrPPixBufferAccess_ReadWrite,
-														pix_format, &bounds);
-														
-						char *temp_origin = NULL;
-						pixSuite->GetPixels(tempWorld, PrPPixBufferAccess_ReadWrite, &temp_origin);
-						
-						csSDK_int32 temp_rowbytes = 0;
-						pixSuite->GetRowBytes(tempWorld, &temp_rowbytes);
+						ExportFrame frame(header, frame_params, frameBufferP, rowbytes, false);
 						
-						TaskGroup taskGroup;
+						auto_ptr<OMemStreamPr> file(new OMemStreamPr);
 						
-						char *buf_row = buf_origin;
-						char *temp_row = temp_origin;
+						frame.write(*file);
 						
-						for(int y=0; y < height; y++)
-						{
-							if(pix_type == Imf::HALF)
-							{
-								ThreadPool::addGlobalTask(new ConvertBgraRowTask<float, half>(&taskGroup,
-																								(float *)buf_row,
-																								(half *)temp_row,
-																								width,
-																								alpha) );
-							}
-							else
-							{
-								ThreadPool::addGlobalTask(new ConvertBgraRowTask<float, float>(&taskGroup,
-																								(float *)buf_row,
-																								(float *)temp_row,
-																								width,
-																								alpha) );
-							}
-							
-							buf_row += buf_rowbytes;
-							temp_row += temp_rowbytes;
-						}
-						
-						buf_origin = temp_origin;
-						buf_rowbytes = temp_rowbytes;
+						encoded.file = file.release();
 					}
-
-
-					header.channels().insert("B", Channel(pix_type));
-					header.channels().insert("G", Channel(pix_type));
-					header.channels().insert("R", Channel(pix_type));
-					
-					if(alpha)
-						header.channels().insert("A", Channel(pix_type));
-					
-						
-					char *bgra_origin = buf_origin + (buf_rowbytes * (height - 1));
-					
-					FrameBuffer frameBuffer;
-					
-					frameBuffer.insert("B", Slice(pix_type, (char *)bgra_origin + (pix_size * 0), pix_size * 4, -buf_rowbytes) );
-					frameBuffer.insert("G", Slice(pix_type, (char *)bgra_origin + (pix_size * 1), pix_size * 4, -buf_rowbytes) );
-					frameBuffer.insert("R", Slice(pix_type, (char *)bgra_origin + (pix_size * 2), pix_size * 4, -buf_rowbytes) );
-					
-					if(alpha)
-						frameBuffer.insert("A", Slice(pix_type, (char *)bgra_origin + (pix_size * 3), pix_size * 4, -buf_rowbytes) );
-					
 					
+					writer->write(encoded);
+				}
+				else
+				{
 					OStreamPr outstream(mySettings->exportFileSuite, exportInfoP->fileObject);
-					OutputFile file(outstream, header);
 					
-					file.setFrameBuffer(frameBuffer);
-					file.writePixels(height);
+					ExportFrame frame(header, frame_params, frameBufferP, rowbytes, false);
 					
+					frame.write(outstream);
 					
-					if(tempWorld)
-					{
-						pixSuite->Dispose(tempWorld);
-					}
+					outstream.flush(); // so we hear about errors
 				}
+				
+				if(repeat)
+					repeated_frames++;
+				
+				have_last = true;
 			}
 			catch(...)
 			{
 				result = exportReturn_ErrIo;
 			}
 		}
+		else
+			result = exportReturn_Unsupported; // not one of the formats we asked for
 		
 		
 		pixSuite->Dispose(renderResult.outFrame);
+		
+		
+		if(pipeline_depth > 0)
+		{
+			Lock lock(pipeline.mutex);
+			
+			// The loop stops here, so the frames before this one can still be
+			// committed in order, but none of them get written.
+			if(!frame_queued)
+				pipeline.failed = true;
+			
+			if(pipeline.failed && result == malNoError)
+				result = exportReturn_ErrIo;
+		}
+		
+		if(pipeline_depth > 0 && result == malNoError)
+			GrowPipelineDepth(pipeline, pipeline_depth, render_seconds / (i + 1));
+		
+		if(writer.get() != NULL && writer->failed())
+			result = exportReturn_ErrIo;
+		
+		if(write_sequence && progressSuite && result == malNoError)
+		{
+			prSuiteError progress_err = progressSuite->UpdateProgressPercent(exID, (float)(i + 1) / (float)num_frames);
+			
+			if(progress_err == exportReturn_Abort)
+				result = exportReturn_Abort;
+		}
+	}
+	
+	
+	if(pipeline_depth > 0)
+		renderSuite->CancelAllOutstandingMediaPrefetches(videoRenderID);
+	
+	// wait for the frames still being compressed and written
+	bool encode_failed = false;
+	
+	try
+	{
+		pipelineGroup->wait();
+	}
+	catch(...)
+	{
+		encode_failed = true;
+	}
+	
+	pipelineGroup.reset();
+	
+	if((pipeline.failed || encode_failed) && result == malNoError)
+		result = exportReturn_ErrIo;
+	
+	if(writer.get() != NULL)
+	{
+		writer->finish(); // waits for the last files to hit the disk
+		
+		if(writer->failed() && result == malNoError)
+			result = exportReturn_ErrIo;
+	}
+	
+	
+	if(repeated_frames > 0 && result == malNoError && mySettings->errorSuite)
+	{
+		stringstream report;
+		
+		report << repeated_frames << " of " << num_frames << " frames were the same as the frame before, "
+				"so their files were copied instead of compressed again.";
+		
+		prUTF16Char title[256], description[256];
+		
+		utf16ncpy(title, "OpenEXR export", 255);
+		utf16ncpy(description, report.str().c_str(), 255);
+		
+		mySettings->errorSuite->SetEventStringUnicode(kEventTypeInformational, title, description);
 	}
 	
 	renderSuite->ReleaseVideoRenderer(exID, videoRenderID);
+	
+	SetZipCompressionLevel(EXR_DEFAULT_ZIP_LEVEL);
 
 
 	return result;
@@ -1078,7 +3420,7 @@ exSDKGenerateDefaultParams(
 	exParamValues compressionValues;
 	compressionValues.structVersion = 1;
 	compressionValues.rangeMin.intValue = NO_COMPRESSION;
-	compressionValues.rangeMax.intValue = DWAB_COMPRESSION;
+	compressionValues.rangeMax.intValue = EXR_AUTO_COMPRESSION;
 	compressionValues.value.intValue = PIZ_COMPRESSION;
 	compressionValues.disabled = kPrFalse;
 	compressionValues.hidden = kPrFalse;
@@ -1112,6 +3454,25 @@ exSDKGenerateDefaultParams(
 	exportParamSuite->AddParam(exID, gIdx, EXRSettingsGroup, &compressionLevelParam);
 
 
+	// zip level
+	exParamValues zipLevelValues;
+	zipLevelValues.structVersion = 1;
+	zipLevelValues.rangeMin.intValue = EXR_DEFAULT_ZIP_LEVEL;
+	zipLevelValues.rangeMax.intValue = 9;
+	zipLevelValues.value.intValue = EXR_DEFAULT_ZIP_LEVEL;
+	zipLevelValues.disabled = kPrFalse;
+	zipLevelValues.hidden = kPrTrue;
+	
+	exNewParamInfo zipLevelParam;
+	zipLevelParam.structVersion = 1;
+	strncpy(zipLevelParam.identifier, EXRZipLevel, 255);
+	zipLevelParam.paramType = exParamType_int;
+	zipLevelParam.flags = exParamFlag_none;
+	zipLevelParam.paramValues = zipLevelValues;
+	
+	exportParamSuite->AddParam(exID, gIdx, EXRSettingsGroup, &zipLevelParam);
+
+
 	// luminance/chroma
 	exParamValues lumichromValues;
 	lumichromValues.structVersion = 1;
@@ -1163,6 +3524,61 @@ exSDKGenerateDefaultParams(
 	exportParamSuite->AddParam(exID, gIdx, EXRSettingsGroup, &bypassParam);
 	
 	
+	// Tiles
+	exParamValues tileSizeValues;
+	tileSizeValues.structVersion = 1;
+	tileSizeValues.rangeMin.intValue = 0;
+	tileSizeValues.rangeMax.intValue = 512;
+	tileSizeValues.value.intValue = 0;
+	tileSizeValues.disabled = kPrFalse;
+	tileSizeValues.hidden = kPrFalse;
+	
+	exNewParamInfo tileSizeParam;
+	tileSizeParam.structVersion = 1;
+	strncpy(tileSizeParam.identifier, EXRTileSize, 255);
+	tileSizeParam.paramType = exParamType_int;
+	tileSizeParam.flags = exParamFlag_none;
+	tileSizeParam.paramValues = tileSizeValues;
+	
+	exportParamSuite->AddParam(exID, gIdx, EXRSettingsGroup, &tileSizeParam);
+	
+	
+	// Resolution levels
+	exParamValues tileLevelsValues;
+	tileLevelsValues.structVersion = 1;
+	tileLevelsValues.rangeMin.intValue = ONE_LEVEL;
+	tileLevelsValues.rangeMax.intValue = RIPMAP_LEVELS;
+	tileLevelsValues.value.intValue = ONE_LEVEL;
+	tileLevelsValues.disabled = kPrTrue;
+	tileLevelsValues.hidden = kPrFalse;
+	
+	exNewParamInfo tileLevelsParam;
+	tileLevelsParam.structVersion = 1;
+	strncpy(tileLevelsParam.identifier, EXRTileLevels, 255);
+	tileLevelsParam.paramType = exParamType_int;
+	tileLevelsParam.flags = exParamFlag_none;
+	tileLevelsParam.paramValues = tileLevelsValues;
+	
+	exportParamSuite->AddParam(exID, gIdx, EXRSettingsGroup, &tileLevelsParam);
+	
+	
+	// Preview image
+	exParamValues previewValues;
+	previewValues.structVersion = 1;
+	previewValues.value.intValue = kPrTrue;
+	previewValues.disabled = kPrFalse;
+	previewValues.hidden = kPrFalse;
+	
+	exNewParamInfo previewParam;
+	previewParam.structVersion = 1;
+	strncpy(previewParam.identifier, EXRPreview, 255);
+	previewParam.paramType = exParamType_bool;
+	previewParam.flags = exParamFlag_none;
+	previewParam.paramValues = previewValues;
+	
+	exportParamSuite->AddParam(exID, gIdx, EXRSettingsGroup, &previewParam);
+	
+	
 	// Image Settings group
 	utf16ncpy(groupString, "Image Settings", 255);
 	exportParamSuite->AddParamGroup(exID, gIdx,
@@ -1263,6 +3679,23 @@ exSDKGenerateDefaultParams(
 	exportParamSuite->AddParam(exID, gIdx, ADBEBasicVideoGroup, &sequenceParam);
 	
 	
+	// Sequence in one pass
+	exParamValues onePassValues;
+	onePassValues.structVersion = 1;
+	onePassValues.value.intValue = kPrTrue;
+	onePassValues.disabled = kPrTrue;
+	onePassValues.hidden = kPrFalse;
+	
+	exNewParamInfo onePassParam;
+	onePassParam.structVersion = 1;
+	strncpy(onePassParam.identifier, EXRSequenceOnePass, 255);
+	onePassParam.paramType = exParamType_bool;
+	onePassParam.flags = exParamFlag_none;
+	onePassParam.paramValues = onePassValues;
+	
+	exportParamSuite->AddParam(exID, gIdx, ADBEBasicVideoGroup, &onePassParam);
+	
+	
 	// frame rate
 	exParamValues fpsValues;
 	fpsValues.structVersion = 1;
@@ -1299,14 +3732,149 @@ exSDKGenerateDefaultParams(
 	exportParamSuite->AddParam(exID, gIdx, ADBEBasicVideoGroup, &alphaParam);
 
 
+	// Crop to Alpha
+	exParamValues cropToAlphaValues;
+	cropToAlphaValues.structVersion = 1;
+	cropToAlphaValues.value.intValue = kPrFalse;
+	cropToAlphaValues.disabled = kPrTrue;
+	cropToAlphaValues.hidden = kPrFalse;
+	
+	exNewParamInfo cropToAlphaParam;
+	cropToAlphaParam.structVersion = 1;
+	strncpy(cropToAlphaParam.identifier, EXRCropToAlpha, 255);
+	cropToAlphaParam.paramType = exParamType_bool;
+	cropToAlphaParam.flags = exParamFlag_none;
+	cropToAlphaParam.paramValues = cropToAlphaValues;
+	
+	exportParamSuite->AddParam(exID, gIdx, ADBEBasicVideoGroup, &cropToAlphaParam);
+
+
+	// Drop Opaque Alpha
+	exParamValues dropOpaqueAlphaValues;
+	dropOpaqueAlphaValues.structVersion = 1;
+	dropOpaqueAlphaValues.value.intValue = kPrFalse;
+	dropOpaqueAlphaValues.disabled = kPrTrue;
+	dropOpaqueAlphaValues.hidden = kPrFalse;
+	
+	exNewParamInfo dropOpaqueAlphaParam;
+	dropOpaqueAlphaParam.structVersion = 1;
+	strncpy(dropOpaqueAlphaParam.identifier, EXRDropOpaqueAlpha, 255);
+	dropOpaqueAlphaParam.paramType = exParamType_bool;
+	dropOpaqueAlphaParam.flags = exParamFlag_none;
+	dropOpaqueAlphaParam.paramValues = dropOpaqueAlphaValues;
+	
+	exportParamSuite->AddParam(exID, gIdx, ADBEBasicVideoGroup, &dropOpaqueAlphaParam);
+
+
+	// Alpha in a separate part
+	exParamValues separateAlphaValues;
+	separateAlphaValues.structVersion = 1;
+	separateAlphaValues.value.intValue = kPrFalse;
+	separateAlphaValues.disabled = kPrTrue;
+	separateAlphaValues.hidden = kPrFalse;
+	
+	exNewParamInfo separateAlphaParam;
+	separateAlphaParam.structVersion = 1;
+	strncpy(separateAlphaParam.identifier, EXRSeparateAlpha, 255);
+	separateAlphaParam.paramType = exParamType_bool;
+	separateAlphaParam.flags = exParamFlag_none;
+	separateAlphaParam.paramValues = separateAlphaValues;
+	
+	exportParamSuite->AddParam(exID, gIdx, ADBEBasicVideoGroup, &separateAlphaParam);
+
+
 
-	exportParamSuite->SetParamsVersion(exID, 1);
+	exportParamSuite->SetParamsVersion(exID, EXR_PARAMS_VERSION);
 	
 	
 	return result;
 }
 
 
+// for params a preset from an older version doesn't have
+static void
+AddMissingParam(PrSDKExportParamSuite *paramSuite, csSDK_int32 exID, csSDK_int32 gIdx, const char *group,
+				const char *identifier, bool boolean, csSDK_int32 value, csSDK_int32 rangeMin, csSDK_int32 rangeMax,
+				bool disabled, bool hidden)
+{
+	exParamValues values;
+	values.structVersion = 1;
+	values.rangeMin.intValue = rangeMin;
+	values.rangeMax.intValue = rangeMax;
+	values.value.intValue = value;
+	values.disabled = (disabled ? kPrTrue : kPrFalse);
+	values.hidden = (hidden ? kPrTrue : kPrFalse);
+	
+	exNewParamInfo param;
+	param.structVersion = 1;
+	strncpy(param.identifier, identifier, 255);
+	param.paramType = (boolean ? exParamType_bool : exParamType_int);
+	param.flags = exParamFlag_none;
+	param.paramValues = values;
+	
+	paramSuite->AddParam(exID, gIdx, group, &param);
+}
+
+
+// Presets saved before EXR_PARAMS_VERSION get the params added since then,
+// set so they write the same files as before.
+static void
+UpgradeParams(PrSDKExportParamSuite *paramSuite, csSDK_int32 exID, csSDK_int32 gIdx)
+{
+	csSDK_int32 paramsVersion = 1;
+	
+	paramSuite->GetParamsVersion(exID, &paramsVersion);
+	
+	if(paramsVersion >= EXR_PARAMS_VERSION)
+		return;
+	
+	
+	exParamValues compressionValue, lumiChromValue, sequenceValue, alphaValue;
+	
+	paramSuite->GetParamValue(exID, gIdx, EXRCompression, &compressionValue);
+	paramSuite->GetParamValue(exID, gIdx, EXRLumiChrom, &lumiChromValue);
+	paramSuite->GetParamValue(exID, gIdx, ADBEStillSequence, &sequenceValue);
+	paramSuite->GetParamValue(exID, gIdx, ADBEVideoAlpha, &alphaValue);
+	
+	const bool is_zip = (compressionValue.value.intValue == Imf::ZIPS_COMPRESSION ||
+							compressionValue.value.intValue == Imf::ZIP_COMPRESSION);
+	
+	const bool lumiChrom = lumiChromValue.value.intValue;
+	const bool sequence = sequenceValue.value.intValue;
+	const bool alpha = alphaValue.value.intValue;
+	
+	if(paramsVersion < 2)
+	{
+		AddMissingParam(paramSuite, exID, gIdx, EXRSettingsGroup, EXRZipLevel, false,
+						EXR_DEFAULT_ZIP_LEVEL, EXR_DEFAULT_ZIP_LEVEL, 9, false, !is_zip);
+		
+		AddMissingParam(paramSuite, exID, gIdx, EXRSettingsGroup, EXRTileSize, false,
+						0, 0, 512, lumiChrom, false);
+		
+		AddMissingParam(paramSuite, exID, gIdx, EXRSettingsGroup, EXRTileLevels, false,
+						ONE_LEVEL, ONE_LEVEL, RIPMAP_LEVELS, true, false);
+		
+		AddMissingParam(paramSuite, exID, gIdx, EXRSettingsGroup, EXRPreview, true,
+						kPrFalse, 0, 0, false, false);
+		
+		// same frames either way, so it gets the new default
+		AddMissingParam(paramSuite, exID, gIdx, ADBEBasicVideoGroup, EXRSequenceOnePass, true,
+						kPrTrue, 0, 0, !sequence, false);
+		
+		AddMissingParam(paramSuite, exID, gIdx, ADBEBasicVideoGroup, EXRCropToAlpha, true,
+						kPrFalse, 0, 0, (!alpha || lumiChrom), false);
+		
+		AddMissingParam(paramSuite, exID, gIdx, ADBEBasicVideoGroup, EXRDropOpaqueAlpha, true,
+						kPrFalse, 0, 0, !alpha, false);
+		
+		AddMissingParam(paramSuite, exID, gIdx, ADBEBasicVideoGroup, EXRSeparateAlpha, true,
+						kPrFalse, 0, 0, (!alpha || lumiChrom), false);
+	}
+	
+	paramSuite->SetParamsVersion(exID, EXR_PARAMS_VERSION);
+}
+
+
 static prMALError
 exSDKPostProcessParams(
 	exportStdParms			*stdParmsP, 
@@ -1325,6 +3893,9 @@ exSDKPostProcessParams(
 	prUTF16Char paramString[256];
 	
 	
+	UpgradeParams(exportParamSuite, exID, gIdx);
+	
+	
 	// OpenEXR settings group
 	utf16ncpy(paramString, "OpenEXR Settings", 255);
 	exportParamSuite->SetParamName(exID, gIdx, EXRSettingsGroup, paramString);
@@ -1336,7 +3907,8 @@ exSDKPostProcessParams(
 	
 #if EXPORTMOD_VERSION >= 5
 	utf16ncpy(paramString,
-				"Compression format to use in the EXR file. None, RLE, Zip, Zip16, and Piz are all lossless.",
+				"Compression format to use in the EXR file. None, RLE, Zip, Zip16, and Piz are all lossless. "
+				"Auto tries the lossless ones on the first frame and picks the quickest to disk.",
 				255);
 	exportParamSuite->SetParamDescription(exID, gIdx, EXRCompression, paramString);
 #endif
@@ -1350,7 +3922,8 @@ exSDKPostProcessParams(
 										"B44",
 										"B44A",
 										"DWAA",
-										"DWAB" };
+										"DWAB",
+										"Auto (lossless)" };
 										
 	csSDK_int32 compressionValues[] = {	NO_COMPRESSION,
 										RLE_COMPRESSION,
@@ -1361,7 +3934,8 @@ exSDKPostProcessParams(
 										B44_COMPRESSION,
 										B44A_COMPRESSION,
 										DWAA_COMPRESSION,
-										DWAB_COMPRESSION };
+										DWAB_COMPRESSION,
+										EXR_AUTO_COMPRESSION };
 	
 	exportParamSuite->ClearConstrainedValues(exID, gIdx, EXRCompression);
 	
@@ -1397,6 +3971,44 @@ exSDKPostProcessParams(
 	exportParamSuite->ChangeParam(exID, gIdx, EXRCompressionLevel, &compressionLevelValues);
 	
 	
+	// zip level
+	utf16ncpy(paramString, "Zip Level", 255);
+	exportParamSuite->SetParamName(exID, gIdx, EXRZipLevel, paramString);
+	
+#if EXPORTMOD_VERSION >= 5
+	utf16ncpy(paramString,
+				"How hard Zip and Zip16 compression work. "
+				"Lower levels are faster, higher levels make smaller files. "
+				"Either way it's lossless.",
+				255);
+	exportParamSuite->SetParamDescription(exID, gIdx, EXRZipLevel, paramString);
+#endif
+	
+	const char *zipLevelStrings[] = {	"Default",
+										"1 (fastest)",
+										"2",
+										"3",
+										"4",
+										"5",
+										"6",
+										"7",
+										"8",
+										"9 (smallest)" };
+	
+	csSDK_int32 zipLevelValues[] = { EXR_DEFAULT_ZIP_LEVEL, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+	
+	exportParamSuite->ClearConstrainedValues(exID, gIdx, EXRZipLevel);
+	
+	exOneParamValueRec tempZipLevel;
+	
+	for(csSDK_int32 i=0; i < sizeof(zipLevelValues) / sizeof (csSDK_int32); i++)
+	{
+		tempZipLevel.intValue = zipLevelValues[i];
+		utf16ncpy(paramString, zipLevelStrings[i], 255);
+		exportParamSuite->AddConstrainedValuePair(exID, gIdx, EXRZipLevel, &tempZipLevel, paramString);
+	}
+	
+	
 	// Luminance/Chroma
 	utf16ncpy(paramString, "Luminance/Chroma", 255);
 	exportParamSuite->SetParamName(exID, gIdx, EXRLumiChrom, paramString);
@@ -1434,6 +4046,82 @@ exSDKPostProcessParams(
 	exportParamSuite->SetParamDescription(exID, gIdx, EXRBypassLinear, paramString);
 #endif
 	
+	// Tiles
+	utf16ncpy(paramString, "Tiles", 255);
+	exportParamSuite->SetParamName(exID, gIdx, EXRTileSize, paramString);
+	
+#if EXPORTMOD_VERSION >= 5
+	utf16ncpy(paramString,
+				"Store the image in square tiles instead of scanlines, "
+				"so readers can decode just the region they need. "
+				"Not used with Luminance/Chroma.",
+				255);
+	exportParamSuite->SetParamDescription(exID, gIdx, EXRTileSize, paramString);
+#endif
+	
+	const char *tileSizeStrings[] = {	"None (Scanlines)",
+										"32 x 32",
+										"64 x 64",
+										"128 x 128",
+										"256 x 256",
+										"512 x 512" };
+	
+	csSDK_int32 tileSizeValues[] = { 0, 32, 64, 128, 256, 512 };
+	
+	exportParamSuite->ClearConstrainedValues(exID, gIdx, EXRTileSize);
+	
+	exOneParamValueRec tempTileSize;
+	
+	for(csSDK_int32 i=0; i < sizeof(tileSizeValues) / sizeof (csSDK_int32); i++)
+	{
+		tempTileSize.intValue = tileSizeValues[i];
+		utf16ncpy(paramString, tileSizeStrings[i], 255);
+		exportParamSuite->AddConstrainedValuePair(exID, gIdx, EXRTileSize, &tempTileSize, paramString);
+	}
+	
+	// Resolution levels
+	utf16ncpy(paramString, "Resolution Levels", 255);
+	exportParamSuite->SetParamName(exID, gIdx, EXRTileLevels, paramString);
+	
+#if EXPORTMOD_VERSION >= 5
+	utf16ncpy(paramString,
+				"Also store smaller versions of tiled images. "
+				"Mipmaps are halved in both directions, ripmaps in each direction separately.",
+				255);
+	exportParamSuite->SetParamDescription(exID, gIdx, EXRTileLevels, paramString);
+#endif
+	
+	const char *tileLevelsStrings[] = {	"One Level",
+										"Mipmap",
+										"Ripmap" };
+	
+	csSDK_int32 tileLevelsValues[] = {	ONE_LEVEL,
+										MIPMAP_LEVELS,
+										RIPMAP_LEVELS };
+	
+	exportParamSuite->ClearConstrainedValues(exID, gIdx, EXRTileLevels);
+	
+	exOneParamValueRec tempTileLevels;
+	
+	for(csSDK_int32 i=0; i < sizeof(tileLevelsValues) / sizeof (csSDK_int32); i++)
+	{
+		tempTileLevels.intValue = tileLevelsValues[i];
+		utf16ncpy(paramString, tileLevelsStrings[i], 255);
+		exportParamSuite->AddConstrainedValuePair(exID, gIdx, EXRTileLevels, &tempTileLevels, paramString);
+	}
+	
+	// Preview image
+	utf16ncpy(paramString, "Embed Preview Image", 255);
+	exportParamSuite->SetParamName(exID, gIdx, EXRPreview, paramString);
+	
+#if EXPORTMOD_VERSION >= 5
+	utf16ncpy(paramString,
+				"Store a small 8-bit thumbnail in the header, "
+				"so file browsers don't have to decode the whole image.",
+				255);
+	exportParamSuite->SetParamDescription(exID, gIdx, EXRPreview, paramString);
+#endif
+	
 	// Image Settings group
 	utf16ncpy(paramString, "Image Settings", 255);
 	exportParamSuite->SetParamName(exID, gIdx, ADBEBasicVideoGroup, paramString);
@@ -1500,6 +4188,19 @@ exSDKPostProcessParams(
 	exportParamSuite->SetParamName(exID, gIdx, ADBEStillSequence, paramString);
 	
 	
+	// sequence in one pass
+	utf16ncpy(paramString, "Write Sequence in One Pass", 255);
+	exportParamSuite->SetParamName(exID, gIdx, EXRSequenceOnePass, paramString);
+	
+#if EXPORTMOD_VERSION >= 5
+	utf16ncpy(paramString,
+				"Render the whole sequence in one go, numbering the files ourselves, "
+				"instead of having Premiere start over for every frame.",
+				255);
+	exportParamSuite->SetParamDescription(exID, gIdx, EXRSequenceOnePass, paramString);
+#endif
+	
+	
 	// field type
 	utf16ncpy(paramString, "Field Type", 255);
 	exportParamSuite->SetParamName(exID, gIdx, ADBEVideoFieldType, paramString);
@@ -1576,6 +4277,47 @@ exSDKPostProcessParams(
 	exportParamSuite->SetParamName(exID, gIdx, ADBEVideoAlpha, paramString);
 	
 	
+	// Crop to Alpha
+	utf16ncpy(paramString, "Crop to Alpha", 255);
+	exportParamSuite->SetParamName(exID, gIdx, EXRCropToAlpha, paramString);
+	
+#if EXPORTMOD_VERSION >= 5
+	utf16ncpy(paramString,
+				"Only store the part of the frame where the alpha channel isn't empty. "
+				"The display window stays the full frame. "
+				"Not used with Luminance/Chroma.",
+				255);
+	exportParamSuite->SetParamDescription(exID, gIdx, EXRCropToAlpha, paramString);
+#endif
+	
+	
+	// Drop Opaque Alpha
+	utf16ncpy(paramString, "Omit Alpha When Opaque", 255);
+	exportParamSuite->SetParamName(exID, gIdx, EXRDropOpaqueAlpha, paramString);
+	
+#if EXPORTMOD_VERSION >= 5
+	utf16ncpy(paramString,
+				"Leave out the alpha channel of any frame where the alpha is 1.0 everywhere. "
+				"This is decided frame by frame.",
+				255);
+	exportParamSuite->SetParamDescription(exID, gIdx, EXRDropOpaqueAlpha, paramString);
+#endif
+	
+	
+	// Alpha in a separate part
+	utf16ncpy(paramString, "Alpha in Separate Part", 255);
+	exportParamSuite->SetParamName(exID, gIdx, EXRSeparateAlpha, paramString);
+	
+#if EXPORTMOD_VERSION >= 5
+	utf16ncpy(paramString,
+				"Write a multi-part file with color and alpha in their own parts, "
+				"so programs can read the matte without decompressing the color. "
+				"Not used with Luminance/Chroma.",
+				255);
+	exportParamSuite->SetParamDescription(exID, gIdx, EXRSeparateAlpha, paramString);
+#endif
+	
+	
 	return result;
 }
 
@@ -1654,20 +4396,37 @@ exSDKGetParamSummary(
 	
 	videoStream << ", " << (alpha.value.intValue ? "Alpha" : "No Alpha");
 	
+	exParamValues cropToAlpha, separateAlpha, alphaLumiChrom;
+	
+	paramSuite->GetParamValue(exID, mgroupIndex, EXRCropToAlpha, &cropToAlpha);
+	paramSuite->GetParamValue(exID, mgroupIndex, EXRLumiChrom, &alphaLumiChrom);
+	
+	// Luminance/Chroma doesn't crop, and keeps alpha in the one part
+	if(alpha.value.intValue && cropToAlpha.value.intValue && !alphaLumiChrom.value.intValue)
+		videoStream << " (Cropped)";
+	
+	paramSuite->GetParamValue(exID, mgroupIndex, EXRSeparateAlpha, &separateAlpha);
+	
+	if(alpha.value.intValue && separateAlpha.value.intValue && !alphaLumiChrom.value.intValue)
+		videoStream << " (Separate Part)";
+	
 	
 	videoSummary = videoStream.str();
 	
 	
 	// EXR settings
-	exParamValues compression, compressionLevel, floatNotHalf, lumiChrom, bypassLinear;
+	exParamValues compression, compressionLevel, zipLevel, floatNotHalf, lumiChrom, bypassLinear, tileSize, tileLevels;
 	
 	bypassLinear.value.intValue = kPrFalse;
 	
 	paramSuite->GetParamValue(exID, mgroupIndex, EXRCompression, &compression);
 	paramSuite->GetParamValue(exID, mgroupIndex, EXRCompressionLevel, &compressionLevel);
+	paramSuite->GetParamValue(exID, mgroupIndex, EXRZipLevel, &zipLevel);
 	paramSuite->GetParamValue(exID, mgroupIndex, EXRLumiChrom, &lumiChrom);
 	paramSuite->GetParamValue(exID, mgroupIndex, EXRFloat, &floatNotHalf);
 	paramSuite->GetParamValue(exID, mgroupIndex, EXRBypassLinear, &bypassLinear);
+	paramSuite->GetParamValue(exID, mgroupIndex, EXRTileSize, &tileSize);
+	paramSuite->GetParamValue(exID, mgroupIndex, EXRTileLevels, &tileLevels);
 	
 	switch(compression.value.intValue)
 	{
@@ -1711,6 +4470,10 @@ exSDKGetParamSummary(
 			bitrateSummary = "DWAB compression";
 			break;
 
+		case EXR_AUTO_COMPRESSION:
+			bitrateSummary = "Auto compression";
+			break;
+
 		default:
 			bitrateSummary = "unknown compression!";
 			break;
@@ -1725,12 +4488,36 @@ exSDKGetParamSummary(
 		
 		bitrateSummary += " (level " + s.str() + ")";
 	}
+	else if((compression.value.intValue == Imf::ZIPS_COMPRESSION ||
+				compression.value.intValue == Imf::ZIP_COMPRESSION) &&
+			zipLevel.value.intValue != EXR_DEFAULT_ZIP_LEVEL)
+	{
+		stringstream s;
+		
+		s << zipLevel.value.intValue;
+		
+		bitrateSummary += " (level " + s.str() + ")";
+	}
 	
 	if(lumiChrom.value.intValue)
 		bitrateSummary += ", Luminance/Chroma";
 	else if(floatNotHalf.value.intValue)
 		bitrateSummary += ", 32-bit float";
 
+	if(tileSize.value.intValue > 0 && !lumiChrom.value.intValue)
+	{
+		stringstream s;
+		
+		s << ", " << tileSize.value.intValue << "x" << tileSize.value.intValue << " tiles";
+		
+		if(tileLevels.value.intValue == MIPMAP_LEVELS)
+			s << " (mipmap)";
+		else if(tileLevels.value.intValue == RIPMAP_LEVELS)
+			s << " (ripmap)";
+		
+		bitrateSummary += s.str();
+	}
+	
 	if(bypassLinear.value.intValue)
 		bitrateSummary += ", Bypass";
 
@@ -1748,6 +4535,53 @@ exSDKGetParamSummary(
 }
 
 
+// tiles don't go with Luminance/Chroma, and levels need tiles
+static void
+UpdateTileParams(PrSDKExportParamSuite *paramSuite, csSDK_int32 exID, csSDK_int32 gIdx)
+{
+	exParamValues lumiChromValue, tileSizeValue, tileLevelsValue;
+	
+	paramSuite->GetParamValue(exID, gIdx, EXRLumiChrom, &lumiChromValue);
+	
+	paramSuite->GetParamValue(exID, gIdx, EXRTileSize, &tileSizeValue);
+	paramSuite->GetParamValue(exID, gIdx, EXRTileLevels, &tileLevelsValue);
+	
+	tileSizeValue.disabled = (lumiChromValue.value.intValue ? kPrTrue : kPrFalse);
+	
+	paramSuite->ChangeParam(exID, gIdx, EXRTileSize, &tileSizeValue);
+	
+	tileLevelsValue.disabled = ((lumiChromValue.value.intValue || tileSizeValue.value.intValue == 0) ? kPrTrue : kPrFalse);
+	
+	paramSuite->ChangeParam(exID, gIdx, EXRTileLevels, &tileLevelsValue);
+}
+
+
+// The alpha options need alpha.  Luminance/Chroma writes a single part,
+// and isn't cropped because its subsampled chroma needs an even data window.
+static void
+UpdateAlphaParams(PrSDKExportParamSuite *paramSuite, csSDK_int32 exID, csSDK_int32 gIdx)
+{
+	exParamValues alphaValue, lumiChromValue, cropToAlphaValue, dropOpaqueAlphaValue, separateAlphaValue;
+	
+	paramSuite->GetParamValue(exID, gIdx, ADBEVideoAlpha, &alphaValue);
+	paramSuite->GetParamValue(exID, gIdx, EXRLumiChrom, &lumiChromValue);
+	paramSuite->GetParamValue(exID, gIdx, EXRCropToAlpha, &cropToAlphaValue);
+	paramSuite->GetParamValue(exID, gIdx, EXRDropOpaqueAlpha, &dropOpaqueAlphaValue);
+	paramSuite->GetParamValue(exID, gIdx, EXRSeparateAlpha, &separateAlphaValue);
+	
+	const bool alpha = alphaValue.value.intValue;
+	const bool lumiChrom = lumiChromValue.value.intValue;
+	
+	cropToAlphaValue.disabled = ((alpha && !lumiChrom) ? kPrFalse : kPrTrue);
+	dropOpaqueAlphaValue.disabled = (alpha ? kPrFalse : kPrTrue);
+	separateAlphaValue.disabled = ((alpha && !lumiChrom) ? kPrFalse : kPrTrue);
+	
+	paramSuite->ChangeParam(exID, gIdx, EXRCropToAlpha, &cropToAlphaValue);
+	paramSuite->ChangeParam(exID, gIdx, EXRDropOpaqueAlpha, &dropOpaqueAlphaValue);
+	paramSuite->ChangeParam(exID, gIdx, EXRSeparateAlpha, &separateAlphaValue);
+}
+
+
 static prMALError
 exSDKValidateParamChanged(
 	exportStdParms		*stdParmsP, 
@@ -1761,6 +4595,9 @@ exSDKValidateParamChanged(
 	
 	string param = validateParamChangedRecP->changedParamIdentifier;
 	
+	// new settings get a new Auto compression trial
+	privateData->haveAutoCompression = false;
+	
 	if(param == EXRCompression)
 	{
 		exParamValues compressionValue, compressionLevelValue;
@@ -1774,6 +4611,17 @@ exSDKValidateParamChanged(
 		compressionLevelValue.hidden = (is_dwa ? kPrFalse : kPrTrue);
 		
 		paramSuite->ChangeParam(exID, gIdx, EXRCompressionLevel, &compressionLevelValue);
+		
+		exParamValues zipLevelValue;
+		
+		paramSuite->GetParamValue(exID, gIdx, EXRZipLevel, &zipLevelValue);
+		
+		const bool is_zip = (compressionValue.value.intValue == Imf::ZIPS_COMPRESSION ||
+								compressionValue.value.intValue == Imf::ZIP_COMPRESSION);
+		
+		zipLevelValue.hidden = (is_zip ? kPrFalse : kPrTrue);
+		
+		paramSuite->ChangeParam(exID, gIdx, EXRZipLevel, &zipLevelValue);
 	}
 	if(param == EXRLumiChrom)
 	{
@@ -1785,10 +4633,17 @@ exSDKValidateParamChanged(
 		floatNotHalfValue.disabled = (lumiChromValue.value.intValue ? kPrTrue : kPrFalse);
 		
 		paramSuite->ChangeParam(exID, gIdx, EXRFloat, &floatNotHalfValue);
+		
+		UpdateTileParams(paramSuite, exID, gIdx);
+		UpdateAlphaParams(paramSuite, exID, gIdx);
+	}
+	else if(param == EXRTileSize)
+	{
+		UpdateTileParams(paramSuite, exID, gIdx);
 	}
 	else if(param == ADBEStillSequence)
 	{
-		exParamValues sequenceValue, frameRateValue;
+		exParamValues sequenceValue, frameRateValue, onePassValue;
 		
 		paramSuite->GetParamValue(exID, gIdx, ADBEStillSequence, &sequenceValue);
 		paramSuite->GetParamValue(exID, gIdx, ADBEVideoFPS, &frameRateValue);
@@ -1796,6 +4651,16 @@ exSDKValidateParamChanged(
 		frameRateValue.disabled = (sequenceValue.value.intValue ? kPrFalse : kPrTrue);
 		
 		paramSuite->ChangeParam(exID, gIdx, ADBEVideoFPS, &frameRateValue);
+		
+		paramSuite->GetParamValue(exID, gIdx, EXRSequenceOnePass, &onePassValue);
+		
+		onePassValue.disabled = (sequenceValue.value.intValue ? kPrFalse : kPrTrue);
+		
+		paramSuite->ChangeParam(exID, gIdx, EXRSequenceOnePass, &onePassValue);
+	}
+	else if(param == ADBEVideoAlpha)
+	{
+		UpdateAlphaParams(paramSuite, exID, gIdx);
 	}
 
 	return malNoError;
@@ -44,6 +44,8 @@
 #include	"PrSDKExportFileSuite.h"
 #include	"PrSDKExportInfoSuite.h"
 #include	"PrSDKExportParamSuite.h"
+#include	"PrSDKExportProgressSuite.h"
+#include	"PrSDKErrorSuite.h"
 #include	"PrSDKSequenceRenderSuite.h"
 #include	"PrSDKPPixCreatorSuite.h"
 #include	"PrSDKPPixCacheSuite.h"
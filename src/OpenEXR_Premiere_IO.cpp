@@ -38,73 +38,237 @@
 
 #include "OpenEXR_Premiere_IO.h"
 
+#include "OpenEXR_UTF.h"
+
 #include <IexBaseExc.h>
 
+#include <vector>
+#include <algorithm>
+
+#include <stdio.h>
+#include <string.h>
 #include <assert.h>
 
 
-IStreamPr::IStreamPr(imFileRef fileRef) :
-	IStream("Premiere Import File"),
-	_fileRef(fileRef)
+bool
+GetFileIdentity(imFileRef fileRef, ChunkCacheFile &file)
 {
-	seekg(0);
+#ifdef __APPLE__
+	FSRef ref;
+	
+	OSErr result = FSGetForkCBInfo(reinterpret_cast<intptr_t>(fileRef), 0, NULL, NULL, NULL, &ref, NULL);
+	
+	if(result != noErr)
+		return false;
+	
+	FSCatalogInfo info;
+	
+	result = FSGetCatalogInfo(&ref, kFSCatInfoContentMod | kFSCatInfoDataSizes, &info, NULL, NULL, NULL);
+	
+	if(result != noErr)
+		return false;
+	
+	UInt8 path[1024];
+	
+	if(FSRefMakePath(&ref, path, sizeof(path)) != noErr)
+		return false;
+	
+	file.path = (const char *)path;
+	file.modTime = ((Imf::Int64)info.contentModDate.highSeconds << 48) |
+					((Imf::Int64)info.contentModDate.lowSeconds << 16) |
+					info.contentModDate.fraction;
+	file.size = info.dataLogicalSize;
+	
+	return true;
+#else
+	BY_HANDLE_FILE_INFORMATION info;
+	
+	if( !GetFileInformationByHandle(fileRef, &info) )
+		return false;
+	
+	WCHAR path[MAX_PATH + 1];
+	
+	DWORD len = GetFinalPathNameByHandleW(fileRef, path, MAX_PATH, FILE_NAME_NORMALIZED);
+	
+	if(len == 0 || len > MAX_PATH)
+		return false;
+	
+	file.path.assign((const char *)path, len * sizeof(WCHAR));
+	file.modTime = ((Imf::Int64)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+	file.size = ((Imf::Int64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	
+	return true;
+#endif
 }
 
 
 bool
-IStreamPr::read(char c[/*n*/], int n)
+GetPathIdentity(const std::string &path, ChunkCacheFile &file)
 {
 #ifdef __APPLE__
-	ByteCount count = n;
+	FSRef ref;
 	
-	OSErr result = FSReadFork(reinterpret_cast<intptr_t>(_fileRef), fsAtMark, 0, count, (void *)c, &count);
+	if(FSPathMakeRef((const UInt8 *)path.c_str(), &ref, NULL) != noErr)
+		return false;
 	
-	return (result == noErr && count == n);
+	FSCatalogInfo info;
+	
+	if(FSGetCatalogInfo(&ref, kFSCatInfoContentMod | kFSCatInfoDataSizes, &info, NULL, NULL, NULL) != noErr)
+		return false;
+	
+	file.path = path;
+	file.modTime = ((Imf::Int64)info.contentModDate.highSeconds << 48) |
+					((Imf::Int64)info.contentModDate.lowSeconds << 16) |
+					info.contentModDate.fraction;
+	file.size = info.dataLogicalSize;
+	
+	return true;
 #else
-	DWORD count = n, out = 0;
+	// the path holds the raw WCHARs, without a terminator
+	std::vector<WCHAR> wpath((path.size() / sizeof(WCHAR)) + 1, 0);
 	
-	BOOL result = ReadFile(_fileRef, (LPVOID)c, count, &out, NULL);
+	if( !path.empty() )
+		memcpy(&wpath[0], path.data(), path.size());
 	
-	return (result && (out == n));
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	
+	if( !GetFileAttributesExW(&wpath[0], GetFileExInfoStandard, &info) )
+		return false;
+	
+	file.path = path;
+	file.modTime = ((Imf::Int64)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+	file.size = ((Imf::Int64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	
+	return true;
 #endif
 }
 
 
-Imf::Int64
-IStreamPr::tellg()
+IStreamPr::IStreamPr(imFileRef fileRef) :
+	IStream("Premiere Import File"),
+	_fileRef(fileRef),
+	_cached(false),
+	_carried(false),
+	_pos(0)
 {
-#ifdef __APPLE__
-	Imf::Int64 pos;
-	SInt64 lpos;
-
-	OSErr result = FSGetForkPosition(reinterpret_cast<intptr_t>(_fileRef), &lpos);
+	if( ChunkCacheEnabled() )
+		_cached = GetFileIdentity(_fileRef, _file);
 	
-	if(result != noErr)
-		throw Iex::IoExc("Error calling FSGetForkPosition().");
+	Imf::Int64 check_block = 0;
+	
+	if(_cached && GrowingFileCheckBlock(_file, check_block))
+	{
+		// what's on the disk now has to match what we cached
+		std::vector<char> block_data(OPENEXR_CHUNK_CACHE_BLOCK);
+		
+		seekFile(check_block * OPENEXR_CHUNK_CACHE_BLOCK);
+		
+		if( readFile(&block_data[0], OPENEXR_CHUNK_CACHE_BLOCK) )
+			_carried = CarryGrowingFile(_file, check_block, &block_data[0], OPENEXR_CHUNK_CACHE_BLOCK);
+	}
+	
+	seekFile(0);
+}
+
 
-	pos = lpos;
+bool
+IStreamPr::read(char c[/*n*/], int n)
+{
+	if(!_cached)
+	{
+		const bool result = readFile(c, n);
+		
+		if(result)
+			_pos += n;
+		
+		return result;
+	}
 	
-	return pos;
-#else
-	Imf::Int64 pos;
-	LARGE_INTEGER lpos, zero;
+	
+	const size_t block_size = OPENEXR_CHUNK_CACHE_BLOCK;
+	
+	while(n > 0)
+	{
+		const Imf::Int64 block = _pos / block_size;
+		const size_t offset = _pos % block_size;
+		const size_t want = std::min<size_t>(n, block_size - offset);
+		
+		size_t copied = 0;
+		
+		if( !ReadCachedChunk(_file, block, offset, c, want, copied) )
+		{
+			const Imf::Int64 block_start = block * block_size;
+			
+			if(block_start >= _file.size)
+				return false;
+			
+			const size_t block_len = std::min<Imf::Int64>(block_size, _file.size - block_start);
+			
+			std::vector<char> block_data(block_len);
+			
+			seekFile(block_start);
+			
+			if( !readFile(&block_data[0], block_len) )
+				return false;
+			
+			StoreCachedChunk(_file, block, &block_data[0], block_len);
+			
+			copied = (offset < block_len ? std::min(want, block_len - offset) : 0);
+			
+			if(copied > 0)
+				memcpy(c, &block_data[offset], copied);
+		}
+		
+		if(copied == 0)
+			return false;
+		
+		_pos += copied;
+		c += copied;
+		n -= copied;
+	}
+	
+	return true;
+}
 
-	zero.QuadPart = 0;
 
-	BOOL result = SetFilePointerEx(_fileRef, zero, &lpos, FILE_CURRENT);
+Imf::Int64
+IStreamPr::tellg()
+{
+	return _pos;
+}
 
-	if(!result)
-		throw Iex::IoExc("Error calling SetFilePointerEx().");
 
-	pos = lpos.QuadPart;
+void
+IStreamPr::seekg(Imf::Int64 pos)
+{
+	if(!_cached)
+		seekFile(pos);
 	
-	return pos;
+	_pos = pos;
+}
+
+
+bool
+IStreamPr::readFile(char c[/*n*/], int n)
+{
+#ifdef __APPLE__
+	ByteCount count = n;
+	
+	OSErr result = FSReadFork(reinterpret_cast<intptr_t>(_fileRef), fsAtMark, 0, count, (void *)c, &count);
+	
+	return (result == noErr && count == n);
+#else
+	DWORD count = n, out = 0;
+	
+	BOOL result = ReadFile(_fileRef, (LPVOID)c, count, &out, NULL);
+	
+	return (result && (out == n));
 #endif
 }
 
 
 void
-IStreamPr::seekg(Imf::Int64 pos)
+IStreamPr::seekFile(Imf::Int64 pos)
 {
 #ifdef __APPLE__
 	OSErr result = FSSetForkPosition(reinterpret_cast<intptr_t>(_fileRef), fsFromStart, pos);
@@ -124,10 +288,18 @@ IStreamPr::seekg(Imf::Int64 pos)
 }
 
 
+#ifndef OPENEXR_EXPORT_WRITE_BUFFER
+#define OPENEXR_EXPORT_WRITE_BUFFER	(8 * 1024 * 1024)
+#endif
+
 OStreamPr::OStreamPr(PrSDKExportFileSuite *fileSuite, csSDK_uint32 fileObject) :
 	OStream("Premiere Export File"),
 	suite(fileSuite),
-	_fileObject(fileObject)
+	_fileObject(fileObject),
+	_buffer_pos(0),
+	_buffered(0),
+	_pos(0),
+	_file_pos(0)
 {
 	if(suite == NULL)
 		throw Iex::ArgExc("Got NULL Export File Suite");
@@ -141,6 +313,12 @@ OStreamPr::OStreamPr(PrSDKExportFileSuite *fileSuite, csSDK_uint32 fileObject) :
 
 OStreamPr::~OStreamPr()
 {
+	try
+	{
+		flush();
+	}
+	catch(...) {}
+	
 	prSuiteError err = suite->Close(_fileObject);
 	
 	assert(err == suiteError_NoError);
@@ -150,34 +328,289 @@ OStreamPr::~OStreamPr()
 void
 OStreamPr::write(const char c[/*n*/], int n)
 {
-	prSuiteError err = suite->Write(_fileObject, (void *)c, n);
+	if(n <= 0)
+		return;
 	
-	if(err != suiteError_NoError)
-		throw Iex::IoExc("Error writing file.");
+	if(_buffer.data() == NULL)
+		_buffer.allocate(OPENEXR_EXPORT_WRITE_BUFFER);
+	
+	const size_t capacity = _buffer.size();
+	
+	// Fits in (or right after) what's buffered?  OpenEXR goes back
+	// to fill in the offset table, which is often still in here.
+	const bool in_buffer = (_pos >= _buffer_pos &&
+							_pos <= _buffer_pos + _buffered &&
+							(_pos - _buffer_pos) + n <= capacity);
+	
+	if(!in_buffer)
+	{
+		flush();
+		
+		_buffer_pos = _pos;
+		
+		if((size_t)n >= capacity)
+		{
+			writeFile(c, n, _pos);
+			
+			_pos += n;
+			_buffer_pos = _pos;
+			
+			return;
+		}
+	}
+	
+	const size_t offset = _pos - _buffer_pos;
+	
+	memcpy(_buffer.data() + offset, c, n);
+	
+	_buffered = std::max(_buffered, offset + n);
+	
+	_pos += n;
 }
 
 
 Imf::Int64
 OStreamPr::tellp()
 {
-	prInt64 pos = 0;
+	return _pos;
+}
+
+
+void
+OStreamPr::seekp(Imf::Int64 pos)
+{
+	_pos = pos;
+}
+
+
+void
+OStreamPr::flush()
+{
+	if(_buffered > 0)
+	{
+		writeFile(_buffer.data(), _buffered, _buffer_pos);
+		
+		_buffer_pos += _buffered;
+		_buffered = 0;
+	}
+}
+
+
+void
+OStreamPr::writeFile(const char c[/*n*/], size_t n, Imf::Int64 pos)
+{
+	if(pos != _file_pos)
+	{
+		prInt64 new_pos = 0;
+		
+		prSuiteError err = suite->Seek(_fileObject, pos, new_pos, fileSeekMode_Begin);
+		
+		if(err != suiteError_NoError)
+			throw Iex::IoExc("Error seeking.");
+		
+		_file_pos = pos;
+	}
 	
-	prSuiteError err = suite->Seek(_fileObject, 0, pos, fileSeekMode_End); // there's a bug in Premiere - fileSeekMode_End is really fileSeekMode_Current
+	// Write() takes a 32-bit length
+	const size_t max_write = (1 << 30);
 	
-	if(err != suiteError_NoError)
+	while(n > 0)
+	{
+		const size_t len = std::min(n, max_write);
+		
+		prSuiteError err = suite->Write(_fileObject, (void *)c, (csSDK_int32)len);
+		
+		if(err != suiteError_NoError)
+			throw Iex::IoExc("Error writing file.");
+		
+		c += len;
+		n -= len;
+		
+		_file_pos += len;
+	}
+}
+
+
+OFStreamPr::OFStreamPr(const prUTF16Char *path) :
+	OStream("Premiere Export File")
+{
+#ifdef __APPLE__
+	_file = fopen(UTF16toUTF8((const utf16_char *)path).c_str(), "wb");
+	
+	if(_file == NULL)
+		throw Iex::IoExc("Error opening file.");
+#else
+	_fileH = CreateFileW(path, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+							CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	
+	if(_fileH == INVALID_HANDLE_VALUE)
+		throw Iex::IoExc("Error opening file.");
+#endif
+}
+
+
+OFStreamPr::~OFStreamPr()
+{
+	// only if close() wasn't called, errors can't be reported from here
+#ifdef __APPLE__
+	if(_file != NULL)
+		fclose(_file);
+#else
+	if(_fileH != INVALID_HANDLE_VALUE)
+		CloseHandle(_fileH);
+#endif
+}
+
+
+void
+OFStreamPr::close()
+{
+#ifdef __APPLE__
+	if(_file == NULL)
+		return;
+	
+	// fclose() flushes the last of the buffered writes
+	const int err = fclose(_file);
+	
+	_file = NULL;
+	
+	if(err != 0)
+		throw Iex::IoExc("Error closing file.");
+#else
+	if(_fileH == INVALID_HANDLE_VALUE)
+		return;
+	
+	const BOOL result = CloseHandle(_fileH);
+	
+	_fileH = INVALID_HANDLE_VALUE;
+	
+	if(!result)
+		throw Iex::IoExc("Error closing file.");
+#endif
+}
+
+
+void
+OFStreamPr::write(const char c[/*n*/], int n)
+{
+#ifdef __APPLE__
+	if(fwrite(c, 1, n, _file) != n)
+		throw Iex::IoExc("Error writing file.");
+#else
+	DWORD out = 0;
+	
+	BOOL result = WriteFile(_fileH, (LPCVOID)c, n, &out, NULL);
+	
+	if(!result || out != n)
+		throw Iex::IoExc("Error writing file.");
+#endif
+}
+
+
+Imf::Int64
+OFStreamPr::tellp()
+{
+#ifdef __APPLE__
+	off_t pos = ftello(_file);
+	
+	if(pos < 0)
 		throw Iex::IoExc("Error seeking current position.");
 	
 	return pos;
+#else
+	LARGE_INTEGER lpos, zero;
+
+	zero.QuadPart = 0;
+
+	BOOL result = SetFilePointerEx(_fileH, zero, &lpos, FILE_CURRENT);
+
+	if(!result)
+		throw Iex::IoExc("Error seeking current position.");
+
+	return lpos.QuadPart;
+#endif
 }
 
 
 void
-OStreamPr::seekp(Imf::Int64 pos)
+OFStreamPr::seekp(Imf::Int64 pos)
 {
-	prInt64 new_pos = 0;
+#ifdef __APPLE__
+	if(fseeko(_file, pos, SEEK_SET) != 0)
+		throw Iex::IoExc("Error seeking.");
+#else
+	LARGE_INTEGER lpos, out;
+
+	lpos.QuadPart = pos;
+
+	BOOL result = SetFilePointerEx(_fileH, lpos, &out, FILE_BEGIN);
+
+	if(!result || lpos.QuadPart != out.QuadPart)
+		throw Iex::IoExc("Error seeking.");
+#endif
+}
+
+
+OMemStreamPr::OMemStreamPr() :
+	OStream("Premiere Memory File"),
+	_pos(0)
+{
+
+}
+
+
+void
+OMemStreamPr::write(const char c[/*n*/], int n)
+{
+	if(n <= 0)
+		return;
 	
-	prSuiteError err = suite->Seek(_fileObject, pos, new_pos, fileSeekMode_Begin);
+	if(_pos + n > _data.size())
+	{
+		if(_pos + n > _data.capacity())
+			_data.reserve( std::max<size_t>(_pos + n, _data.capacity() * 2) );
+		
+		_data.resize(_pos + n);
+	}
 	
-	if(err != suiteError_NoError)
+	memcpy(&_data[_pos], c, n);
+	
+	_pos += n;
+}
+
+
+Imf::Int64
+OMemStreamPr::tellp()
+{
+	return _pos;
+}
+
+
+void
+OMemStreamPr::seekp(Imf::Int64 pos)
+{
+	if(pos < 0)
 		throw Iex::IoExc("Error seeking.");
+	
+	_pos = pos;
+}
+
+
+void
+OMemStreamPr::writeTo(Imf::OStream &os, size_t pos, size_t len) const
+{
+	assert(pos + len <= _data.size());
+	
+	// OStream::write() takes an int
+	const size_t max_write = (1 << 30);
+	
+	while(len > 0)
+	{
+		const size_t n = std::min(len, max_write);
+		
+		os.write(&_data[pos], n);
+		
+		pos += n;
+		len -= n;
+	}
 }
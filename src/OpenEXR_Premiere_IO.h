@@ -42,9 +42,21 @@
 
 #include <ImfIO.h>
 
+#include <vector>
+
 #include "PrSDKImport.h"
 #include "PrSDKExportFileSuite.h"
 
+#include "OpenEXR_Premiere_ChunkCache.h"
+#include "OpenEXR_Premiere_Scratch.h"
+
+
+// path, modification date and size of an open file
+bool GetFileIdentity(imFileRef fileRef, ChunkCacheFile &file);
+
+// same, for a path that came from GetFileIdentity()
+bool GetPathIdentity(const std::string &path, ChunkCacheFile &file);
+
 
 class IStreamPr : public Imf::IStream
 {
@@ -56,11 +68,29 @@ class IStreamPr : public Imf::IStream
 	virtual Imf::Int64 tellg();
 	virtual void seekg(Imf::Int64 pos);
 	
+	// false if the file isn't going through the chunk cache
+	bool identity(ChunkCacheFile &file) const { file = _file; return _cached; }
+	
+	// true if blocks cached from a smaller version of the file are being used
+	bool carried() const { return _carried; }
+	
   private:
+	bool readFile(char c[/*n*/], int n);
+	void seekFile(Imf::Int64 pos);
+	
 	imFileRef _fileRef;
+	
+	bool _cached;
+	bool _carried;
+	ChunkCacheFile _file;
+	Imf::Int64 _pos;
 };
 
 
+// Writes are collected in a buffer and handed to the file suite in big
+// pieces.  The position is tracked here, so tellp() and seekp() don't go
+// to the host.  Call flush() when done to find out if the last write worked,
+// the destructor can't say.
 class OStreamPr : public Imf::OStream
 {
   public:
@@ -70,10 +100,68 @@ class OStreamPr : public Imf::OStream
 	virtual void write(const char c[/*n*/], int n);
 	virtual Imf::Int64 tellp();
 	virtual void seekp(Imf::Int64 pos);
+	
+	void flush();
 
   private:
+	void writeFile(const char c[/*n*/], size_t n, Imf::Int64 pos);
+	
 	PrSDKExportFileSuite *suite;
 	csSDK_uint32 _fileObject;
+	
+	ScratchBuffer _buffer;
+	Imf::Int64 _buffer_pos; // where the buffer goes in the file
+	size_t _buffered;
+	
+	Imf::Int64 _pos; // where OpenEXR thinks we are
+	Imf::Int64 _file_pos; // where the host thinks we are
+};
+
+
+// for files we name ourselves, like the frames of a sequence
+// Call close() when done to find out if the last write made it to disk.
+class OFStreamPr : public Imf::OStream
+{
+  public:
+	OFStreamPr(const prUTF16Char *path);
+	virtual ~OFStreamPr();
+
+	virtual void write(const char c[/*n*/], int n);
+	virtual Imf::Int64 tellp();
+	virtual void seekp(Imf::Int64 pos);
+	
+	void close();
+
+  private:
+#ifdef __APPLE__
+	FILE *_file;
+#else
+	HANDLE _fileH;
+#endif
+};
+
+
+// holds a whole file in memory, so it can be encoded
+// on one thread and written out on another
+class OMemStreamPr : public Imf::OStream
+{
+  public:
+	OMemStreamPr();
+	virtual ~OMemStreamPr() {}
+
+	virtual void write(const char c[/*n*/], int n);
+	virtual Imf::Int64 tellp();
+	virtual void seekp(Imf::Int64 pos);
+	
+	const char *data() const { return (_data.empty() ? NULL : &_data[0]); }
+	size_t size() const { return _data.size(); }
+	
+	void writeTo(Imf::OStream &os) const { writeTo(os, 0, _data.size()); }
+	void writeTo(Imf::OStream &os, size_t pos, size_t len) const;
+
+  private:
+	std::vector<char> _data;
+	size_t _pos;
 };
 
 
@@ -40,12 +40,18 @@
 #include "OpenEXR_Premiere_Import.h"
 
 #include "OpenEXR_Premiere_IO.h"
+#include "OpenEXR_Premiere_Tasks.h"
+#include "OpenEXR_Premiere_Scratch.h"
+#include "OpenEXR_Premiere_ChunkCache.h"
+#include "OpenEXR_Premiere_DiskCache.h"
+#include "OpenEXR_Premiere_Convert.h"
 
 #include "OpenEXR_Premiere_Dialogs.h"
 #include "OpenEXR_UTF.h"
 
 #include "ImfHybridInputFile.h"
 #include <ImfRgbaFile.h>
+#include <ImfPreviewImage.h>
 
 #include <ImfStandardAttributes.h>
 #include <ImfChannelList.h>
@@ -53,13 +59,15 @@
 #include <IexBaseExc.h>
 #include <IlmThread.h>
 #include <IlmThreadPool.h>
-#include <ImfArray.h>
+#include <IlmThreadMutex.h>
 #include <ImfStdIO.h>
+#include <ImfMisc.h>
 
 #include <algorithm>
 
 #include <stdio.h>
 #include <assert.h>
+#include <math.h>
 
 
 #ifdef PRMAC_ENV
@@ -83,6 +91,8 @@ typedef struct
 {	
 	csSDK_int32				width;
 	csSDK_int32				height;
+	csSDK_int32				preview_width; // 0 if there's no preview we can use
+	csSDK_int32				preview_height;
 	csSDK_int32				importerID;
 	PlugMemoryFuncsPtr		memFuncs;
 	SPBasicSuite			*BasicSuite;
@@ -184,10 +194,208 @@ SDKShutdown()
 	if( supportsThreads() )
 		setGlobalThreadCount(0);
 	
+	ShutdownScratch();
+	
+	ShutdownChunkCache();
+	
+	ShutdownDiskCache();
+	
 	return malNoError;
 }
 
 
+// Frames decoded from incomplete files, so Premiere's copies can be thrown
+// out once the files change.  Checked at most every OPENEXR_PARTIAL_POLL seconds.
+// The SDK can only expire every PPix Premiere has cached, for the whole
+// project, so that's done at most every OPENEXR_PARTIAL_EXPIRE seconds
+// however many files changed.  A file that hasn't changed in
+// OPENEXR_PARTIAL_GIVE_UP seconds is taken off the list.
+#ifndef OPENEXR_PARTIAL_POLL
+#define OPENEXR_PARTIAL_POLL		1.0
+#endif
+
+#ifndef OPENEXR_PARTIAL_EXPIRE
+#define OPENEXR_PARTIAL_EXPIRE		10.0
+#endif
+
+#ifndef OPENEXR_PARTIAL_GIVE_UP
+#define OPENEXR_PARTIAL_GIVE_UP		600.0
+#endif
+
+typedef struct PartialFrame
+{
+	ChunkCacheFile	file;
+	double			noted; // CurrentSeconds()
+} PartialFrame;
+
+static Mutex gPartialMutex;
+static vector<PartialFrame> gPartialFrames;
+static double gPartialCheckTime = 0.0;
+static double gPartialExpireTime = 0.0;
+static bool gPartialExpirePending = false;
+
+
+// Where the headers and chunk offset tables of a file end, and the chunks
+// begin.  The headers are walked attribute by attribute, because their
+// size depends on how they were written.  0 if they can't be read.
+static Int64
+ChunkTablesEnd(Imf::IStream &stream, const HybridInputFile &in)
+{
+	stream.seekg(0);
+	
+	unsigned char magic_version[8];
+	
+	if( !stream.read((char *)magic_version, 8) )
+		return 0;
+	
+	const bool multipart = (magic_version[5] & 0x10); // the 0x1000 version flag
+	
+	for(int part=0; part < in.parts(); part++)
+	{
+		// attributes are name, type, size, value until an empty name
+		while(true)
+		{
+			char c = 1;
+			int len = 0;
+			
+			while(c != '\0' && stream.read(&c, 1))
+				len++;
+			
+			if(c != '\0')
+				return 0;
+			
+			if(len == 1)
+				break;
+			
+			do {
+				if( !stream.read(&c, 1) )
+					return 0;
+			} while(c != '\0');
+			
+			unsigned char size[4];
+			
+			if( !stream.read((char *)size, 4) )
+				return 0;
+			
+			const Int64 value_size = size[0] | (size[1] << 8) | (size[2] << 16) | ((Int64)size[3] << 24);
+			
+			stream.seekg(stream.tellg() + value_size);
+		}
+		
+		if(!multipart)
+			break;
+	}
+	
+	Int64 tables_end = stream.tellg() + (multipart ? 1 : 0); // empty header ends the list
+	
+	for(int part=0; part < in.parts(); part++)
+		tables_end += (Int64)sizeof(Int64) * getChunkOffsetTableSize( in.header(part) );
+	
+	return tables_end;
+}
+
+
+static void
+NotePartialFrame(imFileRef fileRef, Int64 tablesEnd)
+{
+	ChunkCacheFile file;
+	
+	if( !GetFileIdentity(fileRef, file) )
+		return;
+	
+	// without knowing where the chunks start, nothing can be carried
+	if(tablesEnd > 0)
+		NoteGrowingFile(file, tablesEnd);
+	else
+		ForgetGrowingFile(file);
+	
+	PartialFrame frame;
+	
+	frame.file = file;
+	frame.noted = CurrentSeconds();
+	
+	Lock lock(gPartialMutex);
+	
+	for(vector<PartialFrame>::iterator i = gPartialFrames.begin(); i != gPartialFrames.end(); ++i)
+	{
+		if(i->file.path == file.path)
+		{
+			*i = frame;
+			
+			return;
+		}
+	}
+	
+	gPartialFrames.push_back(frame);
+}
+
+
+static void
+CheckPartialFrames(SPBasicSuite *basicSuite)
+{
+	bool expire = false;
+	
+	{
+		Lock lock(gPartialMutex);
+		
+		if(gPartialFrames.empty() && !gPartialExpirePending)
+			return;
+		
+		const double now = CurrentSeconds();
+		
+		if(now - gPartialCheckTime < OPENEXR_PARTIAL_POLL)
+			return;
+		
+		gPartialCheckTime = now;
+		
+		vector<PartialFrame>::iterator i = gPartialFrames.begin();
+		
+		while(i != gPartialFrames.end())
+		{
+			ChunkCacheFile current;
+			
+			if( !GetPathIdentity(i->file.path, current) ||
+				current.modTime != i->file.modTime ||
+				current.size != i->file.size )
+			{
+				i = gPartialFrames.erase(i);
+				
+				gPartialExpirePending = true;
+			}
+			else if(now - i->noted > OPENEXR_PARTIAL_GIVE_UP)
+			{
+				i = gPartialFrames.erase(i);
+			}
+			else
+				++i;
+		}
+		
+		if(gPartialExpirePending && now - gPartialExpireTime >= OPENEXR_PARTIAL_EXPIRE)
+		{
+			gPartialExpirePending = false;
+			gPartialExpireTime = now;
+			
+			expire = true;
+		}
+	}
+	
+	// have Premiere ask for the frames again
+#if kPrSDKPPixCacheSuiteVersion >= 4
+	if(expire && basicSuite)
+	{
+		PrSDKPPixCacheSuite *PPixCacheSuite = NULL;
+		basicSuite->AcquireSuite(kPrSDKPPixCacheSuite, kPrSDKPPixCacheSuiteVersion, (const void**)&PPixCacheSuite);
+		
+		if(PPixCacheSuite)
+		{
+			PPixCacheSuite->ExpireAllPPixesFromCache();
+			basicSuite->ReleaseSuite(kPrSDKPPixCacheSuite, kPrSDKPPixCacheSuiteVersion);
+		}
+	}
+#endif
+}
+
+
 static prMALError 
 SDKGetIndFormat(
 	imStdParms		*stdParms, 
@@ -581,6 +789,44 @@ InitPrefs(ImporterPrefs *prefs)
 }
 
 
+// The exporter can put alpha in its own part named "alpha",
+// which HybridInputFile calls "alpha.A".
+static const char *
+DefaultAlphaChannel(const ChannelList &channels)
+{
+	if( channels.findChannel("A") )
+		return "A";
+	else if( channels.findChannel("alpha.A") )
+		return "alpha.A";
+	else
+		return NULL;
+}
+
+
+// The preview image shows RGBA, so it's only a stand-in
+// when those are the channels we'd be importing.
+static bool
+PreviewUsable(const Header &head, const ImporterPrefs *prefs)
+{
+	if( !head.hasPreviewImage() )
+		return false;
+	
+	const PreviewImage &preview = head.previewImage();
+	
+	if(preview.width() == 0 || preview.height() == 0)
+		return false;
+	
+	if(prefs && prefs->file_init)
+	{
+		return (string(prefs->red) == "R" &&
+				string(prefs->green) == "G" &&
+				string(prefs->blue) == "B");
+	}
+	else
+		return (head.channels().findChannel("R") != NULL);
+}
+
+
 static void
 InitPrefs(
 	const HybridInputFile &in,
@@ -612,7 +858,9 @@ InitPrefs(
 			strcpy(prefs->blue, (channels.findChannel("B") ? "B" : "(none)"));
 		}
 		
-		strcpy(prefs->alpha, (channels.findChannel("A") ? "A" : "(none)"));
+		const char *alpha = DefaultAlphaChannel(channels);
+		
+		strcpy(prefs->alpha, (alpha ? alpha : "(none)"));
 		
 		prefs->bypassConversion = false;
 		
@@ -784,6 +1032,15 @@ SDKGetIndPixelFormat(
 		case 0:
 			SDKIndPixelFormatRec->outPixelFormat = PrPixelFormat_BGRA_4444_32f_Linear;
 			break;
+		
+		// lighter formats for reduced-quality playback
+		case 1:
+			SDKIndPixelFormatRec->outPixelFormat = PrPixelFormat_BGRA_4444_16u;
+			break;
+		
+		case 2:
+			SDKIndPixelFormatRec->outPixelFormat = PrPixelFormat_BGRA_4444_8u;
+			break;
 	
 		default:
 			result = imBadFormatIndex;
@@ -794,6 +1051,86 @@ SDKGetIndPixelFormat(
 }
 
 
+// How the worker tasks have been doing, for the analysis text.
+// Preempted counts the times a higher class jumped ahead of a waiting task.
+static string
+TaskStatsSummary()
+{
+	TaskClassStats stats[kTaskPriority_Count];
+	
+	GetTaskStats(stats);
+	
+	const char *names[kTaskPriority_Count] = { "Interactive", "Export", "Background" };
+	
+	string summary = "Tasks:";
+	
+	for(int c=0; c < kTaskPriority_Count; c++)
+	{
+		const double avg_wait = (stats[c].tasksRun > 0 ? stats[c].totalQueueSeconds / (double)stats[c].tasksRun : 0.0);
+		
+		char class_string[256];
+		
+		sprintf(class_string, "%s %s %.0f run, %.2f ms avg wait, %.1f ms max, %.0f preempted, %.0f failed",
+					(c > 0 ? ";" : ""), names[c], (double)stats[c].tasksRun,
+					avg_wait * 1000.0, stats[c].maxQueueSeconds * 1000.0,
+					(double)stats[c].timesPreempted, (double)stats[c].tasksFailed);
+		
+		summary += class_string;
+	}
+	
+	return summary;
+}
+
+
+// How the scratch buffers and the two caches have been doing, also for the analysis text.
+static string
+CacheStatsSummary()
+{
+	const double MB = 1024.0 * 1024.0;
+	
+	ScratchStats scratch;
+	GetScratchStats(scratch);
+	
+	char scratch_string[256];
+	
+	sprintf(scratch_string, "Scratch: %.0f MB in use, %.0f MB cached, %.0f MB peak, %.0f reused, %.0f allocated, %.0f trimmed",
+				(double)scratch.bytesInUse / MB, (double)scratch.bytesCached / MB, (double)scratch.peakBytes / MB,
+				(double)scratch.reused, (double)scratch.allocated, (double)scratch.trimmed);
+	
+	string summary = scratch_string;
+	
+	if( ChunkCacheEnabled() )
+	{
+		ChunkCacheStats chunks;
+		GetChunkCacheStats(chunks);
+		
+		char chunk_string[256];
+		
+		sprintf(chunk_string, "\nChunk cache: %.0f hits, %.0f misses, %.0f MB from disk, %.0f evictions, %.0f MB cached, %.0f MB peak",
+					(double)chunks.hits, (double)chunks.misses, (double)chunks.bytesFromDisk / MB,
+					(double)chunks.evictions, (double)chunks.bytesCached / MB, (double)chunks.peakBytes / MB);
+		
+		summary += chunk_string;
+	}
+	
+	if( DiskCacheEnabled() )
+	{
+		DiskCacheStats disk;
+		GetDiskCacheStats(disk);
+		
+		char disk_string[256];
+		
+		sprintf(disk_string, "\nFrame cache: %.0f hits, %.0f misses, %.0f writes, %.0f dropped, %.0f evictions",
+					(double)disk.hits, (double)disk.misses, (double)disk.writes,
+					(double)disk.dropped, (double)disk.evictions);
+		
+		summary += disk_string;
+	}
+	
+	return summary;
+}
+
+
 static prMALError 
 SDKAnalysis(
 	imStdParms		*stdParms,
@@ -865,6 +1202,10 @@ SDKAnalysis(
 			info += ", Bypass linear conversion";
 		}
 		
+		info += "\n" + TaskStatsSummary();
+		
+		info += "\n" + CacheStatsSummary();
+		
 		if(info.size() > SDKAnalysisRec->buffersize - 1)
 		{
 			info.resize(SDKAnalysisRec->buffersize - 4);
@@ -925,6 +1266,10 @@ SDKGetInfo8(
 	}
 
 
+	// Premiere keeps asking about sequences, a good time to look for updated frames
+	CheckPartialFrames(ldataP->BasicSuite);
+	
+
 	try
 	{
 		IStreamPr instream(fileAccessInfo8->fileref);
@@ -956,7 +1301,7 @@ SDKGetInfo8(
 		}
 		
 
-		const csSDK_int32 depth = (in.channels().findChannel("A") ? 128 : 96);
+		const csSDK_int32 depth = (DefaultAlphaChannel( in.channels() ) ? 128 : 96);
 
 
 		SDKFileInfo8->hasVideo = kPrTrue;
@@ -1026,6 +1371,15 @@ SDKGetInfo8(
 		
 		ldataP->width = SDKFileInfo8->vidInfo.imageWidth;
 		ldataP->height = SDKFileInfo8->vidInfo.imageHeight;
+		
+		ldataP->preview_width = ldataP->preview_height = 0;
+		
+		if(PreviewUsable(head, prefs) && head.previewImage().width() < width && head.previewImage().height() < height)
+		{
+			ldataP->preview_width = head.previewImage().width();
+			ldataP->preview_height = head.previewImage().height();
+		}
+		
 		ldataP->importerID = SDKFileInfo8->vidInfo.importerID;
 
 		stdParms->piSuites->memFuncs->unlockHandle(reinterpret_cast<char**>(ldataH));
@@ -1054,8 +1408,19 @@ SDKPreferredFrameSize(
 		case 0:
 			preferredFrameSizeRec->outWidth = ldataP->width;
 			preferredFrameSizeRec->outHeight = ldataP->height;
-			// If we supported more formats, we'd return imIterateFrameSizes to request to be called again
-			result = malNoError;
+			// a preview in the header makes a thumbnail size too
+			result = (ldataP->preview_width > 0 ? imIterateFrameSizes : malNoError);
+			break;
+		
+		case 1:
+			if(ldataP->preview_width > 0)
+			{
+				preferredFrameSizeRec->outWidth = ldataP->preview_width;
+				preferredFrameSizeRec->outHeight = ldataP->preview_height;
+				result = malNoError;
+			}
+			else
+				result = imOtherErr;
 			break;
 	
 		default:
@@ -1247,10 +1612,10 @@ static void FixDuplicates(const DupSet &dupSet, const Box2i &dw)
 }
 
 
-class FillRowTask : public Task
+class FillRowTask : public PriorityTask
 {
 public:
-	FillRowTask(TaskGroup *group, char *pixel_origin, RowbyteType rowbytes, float value, int width, int row);
+	FillRowTask(PriorityTaskGroup *group, char *pixel_origin, RowbyteType rowbytes, float value, int width, int row);
 	virtual ~FillRowTask() {}
 	
 	virtual void execute();
@@ -1262,8 +1627,8 @@ private:
 };
 
 
-FillRowTask::FillRowTask(TaskGroup *group, char *pixel_origin, RowbyteType rowbytes, float value, int width, int row) :
-	Task(group),
+FillRowTask::FillRowTask(PriorityTaskGroup *group, char *pixel_origin, RowbyteType rowbytes, float value, int width, int row) :
+	PriorityTask(group),
 	_value(value),
 	_width(width)
 {
@@ -1283,26 +1648,48 @@ FillRowTask::execute()
 }
 
 
-class ConvertRgbaRowTask : public Task
+// What the PPix we're filling holds.  Pixels are always decoded to float,
+// 8u and 16u get converted on the way in.
+enum PPixDepth
+{
+	PPIX_FLOAT,
+	PPIX_16U,
+	PPIX_8U
+};
+
+static inline int
+PPixPixelSize(PPixDepth depth)
+{
+	return (depth == PPIX_8U ? 4 : depth == PPIX_16U ? 8 : sizeof(float) * 4);
+}
+
+
+class ConvertRgbaRowTask : public PriorityTask
 {
   public:
-	ConvertRgbaRowTask(TaskGroup *group, Rgba *input_row, float *output_row, int witdh);
+	ConvertRgbaRowTask(PriorityTaskGroup *group, Rgba *input_row, char *output_row, int witdh,
+						PPixDepth depth, bool linear);
 	virtual ~ConvertRgbaRowTask() {}
 	
 	virtual void execute();
 
   private:
 	const Rgba *_input_row;
-	float *_output_row;
+	char *_output_row;
 	const int _width;
+	const PPixDepth _depth;
+	const bool _linear;
 };
 
 
-ConvertRgbaRowTask::ConvertRgbaRowTask(TaskGroup *group, Rgba *input_row, float *output_row, int width) :
-	Task(group),
+ConvertRgbaRowTask::ConvertRgbaRowTask(PriorityTaskGroup *group, Rgba *input_row, char *output_row, int width,
+										PPixDepth depth, bool linear) :
+	PriorityTask(group),
 	_input_row(input_row),
 	_output_row(output_row),
-	_width(width)
+	_width(width),
+	_depth(depth),
+	_linear(linear)
 {
 
 }
@@ -1312,112 +1699,478 @@ void
 ConvertRgbaRowTask::execute()
 {
 	const Rgba *in = _input_row;
-	float *out = _output_row;
 	
-	for(int x=0; x < _width; x++)
+	if(_depth == PPIX_8U)
+	{
+		ConvertRgbaRowLowBit(&in->r, (unsigned char *)_output_row, _width, _linear);
+	}
+	else if(_depth == PPIX_16U)
+	{
+		ConvertRgbaRowLowBit(&in->r, (unsigned short *)_output_row, _width, _linear);
+	}
+	else
 	{
-		*out++ = in->b;
-		*out++ = in->g;
-		*out++ = in->r;
-		*out++ = in->a;
+		float *out = (float *)_output_row;
 		
-		in++;
+		for(int x=0; x < _width; x++)
+		{
+			*out++ = in->b;
+			*out++ = in->g;
+			*out++ = in->r;
+			*out++ = in->a;
+			
+			in++;
+		}
 	}
 }
 
 
-class CopyPPixRowTask : public Task
+// copies a row of float BGRA into the PPix, converting if it's 8u or 16u
+class CopyPPixRowTask : public PriorityTask
 {
   public:
-	CopyPPixRowTask(TaskGroup *group,
+	CopyPPixRowTask(PriorityTaskGroup *group,
 					const char *input_origin, RowbyteType input_rowbytes,
 					char *output_origin, RowbyteType output_rowbytes,
-					int width, int row);
+					int width, int row, PPixDepth depth = PPIX_FLOAT, bool linear = false);
 	virtual ~CopyPPixRowTask() {}
 	
 	virtual void execute();
 
   private:
 	const float *_input_row;
-	float *_output_row;
+	char *_output_row;
 	const int _width;
+	const PPixDepth _depth;
+	const bool _linear;
 };
 
 
-CopyPPixRowTask::CopyPPixRowTask(TaskGroup *group,
+CopyPPixRowTask::CopyPPixRowTask(PriorityTaskGroup *group,
 									const char *input_origin, RowbyteType input_rowbytes,
 									char *output_origin, RowbyteType output_rowbytes,
-									int width, int row) :
-	Task(group),
-	_width(width)
+									int width, int row, PPixDepth depth, bool linear) :
+	PriorityTask(group),
+	_width(width),
+	_depth(depth),
+	_linear(linear)
 {
 	_input_row = (float *)(input_origin + (input_rowbytes * row));
-	_output_row = (float *)(output_origin + (output_rowbytes * row));
+	_output_row = (output_origin + (output_rowbytes * row));
 }
 
 
 void
 CopyPPixRowTask::execute()
 {
-	const float *in = _input_row;
-	float *out = _output_row;
+	if(_depth == PPIX_8U)
+		ConvertBgraRowLowBit(_input_row, (unsigned char *)_output_row, _width, _linear);
+	else if(_depth == PPIX_16U)
+		ConvertBgraRowLowBit(_input_row, (unsigned short *)_output_row, _width, _linear);
+	else
+		ConvertBgraRow(_input_row, (float *)_output_row, _width, false);
+}
+
+
+// copies a row of a disk-cached frame, which is half BGRA, into the PPix
+class CopyCachedRowTask : public PriorityTask
+{
+  public:
+	CopyCachedRowTask(PriorityTaskGroup *group,
+						const char *input_origin, RowbyteType input_rowbytes,
+						char *output_origin, RowbyteType output_rowbytes,
+						int width, int row, PPixDepth depth, bool linear);
+	virtual ~CopyCachedRowTask() {}
 	
-	for(int x=0; x < _width; x++)
-	{
-		*out++ = *in++;
-	}
+	virtual void execute();
+
+  private:
+	const half *_input_row;
+	char *_output_row;
+	const int _width;
+	const PPixDepth _depth;
+	const bool _linear;
+};
+
+
+CopyCachedRowTask::CopyCachedRowTask(PriorityTaskGroup *group,
+										const char *input_origin, RowbyteType input_rowbytes,
+										char *output_origin, RowbyteType output_rowbytes,
+										int width, int row, PPixDepth depth, bool linear) :
+	PriorityTask(group),
+	_width(width),
+	_depth(depth),
+	_linear(linear)
+{
+	_input_row = (const half *)(input_origin + (input_rowbytes * row));
+	_output_row = (output_origin + (output_rowbytes * row));
 }
 
 
-static prMALError 
-SDKGetSourceVideo(
-	imStdParms			*stdparms, 
-	imFileRef			fileRef, 
-	imSourceVideoRec	*sourceVideoRec)
+void
+CopyCachedRowTask::execute()
 {
-	prMALError		result		= malNoError;
+	if(_depth == PPIX_8U)
+		ConvertBgraRowLowBit(_input_row, (unsigned char *)_output_row, _width, _linear);
+	else if(_depth == PPIX_16U)
+		ConvertBgraRowLowBit(_input_row, (unsigned short *)_output_row, _width, _linear);
+	else
+		ConvertBgraRow(_input_row, (float *)_output_row, _width);
+}
 
-	// Get the privateData handle you stored in imGetInfo
-	ImporterLocalRec8H ldataH = reinterpret_cast<ImporterLocalRec8H>(sourceVideoRec->inPrivateData);
-	ImporterLocalRec8Ptr ldataP = *ldataH;
-	ImporterPrefs *prefs = reinterpret_cast<ImporterPrefs *>(sourceVideoRec->prefs);
-	
 
-	PPixHand temp_ppix = NULL;
+// Scanlines per band when decoding through a scratch buffer,
+// so the buffer is sized by the band rather than the whole frame.
+#ifndef OPENEXR_DECODE_BAND_HEIGHT
+#define OPENEXR_DECODE_BAND_HEIGHT	64
+#endif
+
+// band height is rounded up to whole chunks so no chunk gets decompressed twice
+static int
+DecodeBandHeight(const Header &head)
+{
+	int chunk_height = 1;
 	
-	try
+	if( head.hasTileDescription() )
 	{
-		if( supportsThreads() )
-			setGlobalThreadCount(gNumCPUs);
+		chunk_height = head.tileDescription().ySize;
+	}
+	else
+	{
+		switch( head.compression() )
+		{
+			case Imf::ZIP_COMPRESSION:
+			case Imf::PXR24_COMPRESSION:
+				chunk_height = 16;
+				break;
 			
+			case Imf::PIZ_COMPRESSION:
+			case Imf::B44_COMPRESSION:
+			case Imf::B44A_COMPRESSION:
+			case Imf::DWAA_COMPRESSION:
+				chunk_height = 32;
+				break;
 			
-		// read the file
-		IStreamPr instream(fileRef);
-		HybridInputFile in(instream);
-		
-		
-		const char *red = "R", *green = "G", *blue = "B", *alpha = "A";
-		const char *y = "Y", *ry = "RY", *by = "BY";
-		
-		bool bypassConversion = false;
-		
-		assert(prefs != NULL); // should have been created by imGetPrefs8 or imGetInfo8
-		
-		if(prefs && prefs->file_init)
-		{
-			assert(0 == strncmp(prefs->magic, "oEXR", 4));
-			assert(prefs->version == 1);
-		
-			red = prefs->red;
-			green = prefs->green;
-			blue = prefs->blue;
-			alpha = prefs->alpha;
+			case Imf::DWAB_COMPRESSION:
+				chunk_height = 256;
+				break;
 			
-			bypassConversion = prefs->bypassConversion;
+			default:
+				chunk_height = 1;
+				break;
 		}
-		else if(in.channels().findChannel("Y") && !in.channels().findChannel("R"))
-		{
-			if(in.channels().findChannel("RY") && in.channels().findChannel("BY"))
+	}
+	
+	const int band_height = max(OPENEXR_DECODE_BAND_HEIGHT, 1);
+	
+	return ((band_height + chunk_height - 1) / chunk_height) * chunk_height;
+}
+
+
+// start of the band holding this scanline, bands being lined up with the chunks
+static int
+BandStart(int scanline, int dataW_min_y, int band_height)
+{
+	return dataW_min_y + (((scanline - dataW_min_y) / band_height) * band_height);
+}
+
+
+// waits for a band's tasks, throwing if any failed, and lets the group go
+static void
+FinishBandGroup(auto_ptr<PriorityTaskGroup> &group)
+{
+	if(group.get() != NULL)
+		group->wait();
+	
+	group.reset();
+}
+
+
+// address of EXR pixel (x, y) in the Premiere buffer, which goes bottom-up
+static inline char *
+PPixAddress(char *buf, RowbyteType rowbytes, int pixel_size, const Box2i &dispW, int x, int y)
+{
+	return buf + ((ptrdiff_t)rowbytes * (dispW.max.y - y)) + ((ptrdiff_t)pixel_size * (x - dispW.min.x));
+}
+
+
+// Fill the lines of a band that couldn't be read, in every slice,
+// the way OpenEXR fills channels missing from the file
+static void
+FillMissingLines(const FrameBuffer &frameBuffer, const Box2i &dataW, int scanLine1, int scanLine2)
+{
+	for(FrameBuffer::ConstIterator i = frameBuffer.begin(); i != frameBuffer.end(); ++i)
+	{
+		const Slice &slice = i.slice();
+		
+		for(int y = scanLine1; y <= scanLine2; y++)
+		{
+			if(y % slice.ySampling != 0)
+				continue;
+			
+			for(int x = dataW.min.x; x <= dataW.max.x; x++)
+			{
+				if(x % slice.xSampling != 0)
+					continue;
+				
+				char *pix = slice.base + ((ptrdiff_t)(y / slice.ySampling) * (ptrdiff_t)slice.yStride) +
+											((ptrdiff_t)(x / slice.xSampling) * (ptrdiff_t)slice.xStride);
+				
+				switch(slice.type)
+				{
+					case Imf::FLOAT:	*(float *)pix = (float)slice.fillValue;					break;
+					case Imf::HALF:		*(half *)pix = (float)slice.fillValue;					break;
+					case Imf::UINT:		*(unsigned int *)pix = (unsigned int)slice.fillValue;	break;
+					default:																	break;
+				}
+			}
+		}
+	}
+}
+
+
+// A frame that's still being rendered is missing chunks.  Read it a band at
+// a time so whatever is there gets decoded, and fill the bands OpenEXR
+// can't read from the file.  Returns false if any were.  Anything else,
+// like running out of memory, is still an error.
+static bool
+ReadAvailablePixels(HybridInputFile &in, int scanLine1, int scanLine2)
+{
+	if( in.isComplete() )
+	{
+		in.readPixels(scanLine1, scanLine2);
+		
+		return true;
+	}
+	
+	
+	const Box2i &dataW = in.dataWindow();
+	
+	const int band_height = DecodeBandHeight( in.header(0) );
+	
+	bool complete = true;
+	
+	for(int band_start = BandStart(scanLine1, dataW.min.y, band_height);
+			band_start <= scanLine2;
+			band_start += band_height)
+	{
+		const int first_line = max(band_start, scanLine1);
+		const int last_line = min(band_start + band_height - 1, scanLine2);
+		
+		try
+		{
+			in.readPixels(first_line, last_line);
+		}
+		catch(Iex::InputExc &)
+		{
+			FillMissingLines(in.frameBuffer(), dataW, first_line, last_line);
+			
+			complete = false;
+		}
+		catch(Iex::IoExc &)
+		{
+			FillMissingLines(in.frameBuffer(), dataW, first_line, last_line);
+			
+			complete = false;
+		}
+	}
+	
+	return complete;
+}
+
+
+// exr_BGRA_origin is where pixel (0, 0) would be
+static void
+MakeBGRAFrameBuffer(FrameBuffer &frameBuffer, DupSet &dupSet, const ChannelList &channels,
+					const char * const chan[4], char *exr_BGRA_origin, RowbyteType rowbytes)
+{
+	for(int c=0; c < 4; c++)
+	{
+		int xSampling = 1,
+			ySampling = 1;
+		
+		const Channel *channel = channels.findChannel(chan[c]);
+		
+		if(channel)
+		{
+			xSampling = channel->xSampling;
+			ySampling = channel->ySampling;
+		}
+		
+		const float fill = (c == 3 ? 1.f : 0.f);
+	
+		Slice slice(Imf::FLOAT,
+					exr_BGRA_origin + (sizeof(float) * c),
+					sizeof(float) * 4,
+					rowbytes,
+					xSampling, ySampling, fill);
+		
+		const Slice *dup_slice = frameBuffer.findSlice(chan[c]);
+		
+		if(dup_slice == NULL)
+		{
+			frameBuffer.insert(chan[c], slice);
+		}
+		else
+		{
+			// The OpenEXR FrameBuffer can only hold one slice per channel name
+			// because it uses a std::map.  If the user uses the same channel name
+			// more than once, we have to duplicate it ourselves.
+			
+			dupSet.push_back( DupInfo(*dup_slice, slice) );
+		}
+	}
+}
+
+
+// Fill a thumbnail-sized PPix from the header's 8-bit preview,
+// resampled bilinearly.  Previews are gamma corrected and premultiplied.
+static void
+CopyPreviewToPPix(const PreviewImage &preview, char *buf, RowbyteType rowbytes, int width, int height,
+					PPixDepth depth, bool linear, bool use_alpha)
+{
+	// 8u and 16u want it gamma corrected anyway
+	if(depth != PPIX_FLOAT)
+		linear = false;
+	
+	vector<float> row(width * 4);
+	
+	float lut[256];
+	
+	for(int i=0; i < 256; i++)
+	{
+		const float v = (float)i / 255.f;
+		
+		lut[i] = (linear ? powf(v, 2.2f) : v);
+	}
+	
+	const int preview_width = preview.width();
+	const int preview_height = preview.height();
+	
+	const PreviewRgba *pixels = preview.pixels();
+	
+	for(int y=0; y < height; y++)
+	{
+		const float sy = max(0.f, min((float)(preview_height - 1), (((float)y + 0.5f) * preview_height / height) - 0.5f));
+		
+		const int y0 = (int)sy;
+		const int y1 = min(y0 + 1, preview_height - 1);
+		const float fy = sy - (float)y0;
+		
+		float *out = &row[0];
+		
+		for(int x=0; x < width; x++)
+		{
+			const float sx = max(0.f, min((float)(preview_width - 1), (((float)x + 0.5f) * preview_width / width) - 0.5f));
+			
+			const int x0 = (int)sx;
+			const int x1 = min(x0 + 1, preview_width - 1);
+			const float fx = sx - (float)x0;
+			
+			const PreviewRgba &p00 = pixels[(y0 * preview_width) + x0];
+			const PreviewRgba &p01 = pixels[(y0 * preview_width) + x1];
+			const PreviewRgba &p10 = pixels[(y1 * preview_width) + x0];
+			const PreviewRgba &p11 = pixels[(y1 * preview_width) + x1];
+			
+		#define PREVIEW_LERP(C, TABLE) \
+			((((TABLE(p00.C) * (1.f - fx)) + (TABLE(p01.C) * fx)) * (1.f - fy)) + \
+			 (((TABLE(p10.C) * (1.f - fx)) + (TABLE(p11.C) * fx)) * fy))
+		#define PREVIEW_COLOR(V)	lut[V]
+		#define PREVIEW_ALPHA(V)	((float)(V) / 255.f)
+			
+			out[0] = PREVIEW_LERP(b, PREVIEW_COLOR);
+			out[1] = PREVIEW_LERP(g, PREVIEW_COLOR);
+			out[2] = PREVIEW_LERP(r, PREVIEW_COLOR);
+			out[3] = (use_alpha ? PREVIEW_LERP(a, PREVIEW_ALPHA) : 1.f);
+			
+		#undef PREVIEW_LERP
+		#undef PREVIEW_COLOR
+		#undef PREVIEW_ALPHA
+			
+			out += 4;
+		}
+		
+		// Premiere is bottom-up
+		char *ppix_row = buf + ((ptrdiff_t)rowbytes * (height - 1 - y));
+		
+		if(depth == PPIX_8U)
+			ConvertBgraRowLowBit(&row[0], (unsigned char *)ppix_row, width, false);
+		else if(depth == PPIX_16U)
+			ConvertBgraRowLowBit(&row[0], (unsigned short *)ppix_row, width, false);
+		else
+			ConvertBgraRow(&row[0], (float *)ppix_row, width, false);
+	}
+}
+
+
+// The disk cache keeps halves, so only frames that start out as half can go
+// in without losing anything.  Channels that aren't there get filled.
+static bool
+AllHalfChannels(const ChannelList &channels, const char * const chan[4])
+{
+	for(int c=0; c < 4; c++)
+	{
+		const Channel *channel = channels.findChannel(chan[c]);
+		
+		if(channel && channel->type != Imf::HALF)
+			return false;
+	}
+	
+	return true;
+}
+
+
+static prMALError 
+SDKGetSourceVideo(
+	imStdParms			*stdparms, 
+	imFileRef			fileRef, 
+	imSourceVideoRec	*sourceVideoRec)
+{
+	prMALError		result		= malNoError;
+	
+	CheckPartialFrames( stdparms->piSuites->utilFuncs->getSPBasicSuite() );
+
+	// Get the privateData handle you stored in imGetInfo
+	ImporterLocalRec8H ldataH = reinterpret_cast<ImporterLocalRec8H>(sourceVideoRec->inPrivateData);
+	ImporterLocalRec8Ptr ldataP = *ldataH;
+	ImporterPrefs *prefs = reinterpret_cast<ImporterPrefs *>(sourceVideoRec->prefs);
+	
+
+	try
+	{
+		if( supportsThreads() )
+			setGlobalThreadCount(gNumCPUs);
+			
+			
+		// read the file
+		IStreamPr instream(fileRef);
+		HybridInputFile in(instream);
+		
+		
+		const char *default_alpha = DefaultAlphaChannel( in.channels() );
+		
+		const char *red = "R", *green = "G", *blue = "B", *alpha = (default_alpha ? default_alpha : "A");
+		const char *y = "Y", *ry = "RY", *by = "BY";
+		
+		bool bypassConversion = false;
+		
+		assert(prefs != NULL); // should have been created by imGetPrefs8 or imGetInfo8
+		
+		if(prefs && prefs->file_init)
+		{
+			assert(0 == strncmp(prefs->magic, "oEXR", 4));
+			assert(prefs->version == 1);
+		
+			red = prefs->red;
+			green = prefs->green;
+			blue = prefs->blue;
+			alpha = prefs->alpha;
+			
+			bypassConversion = prefs->bypassConversion;
+		}
+		else if(in.channels().findChannel("Y") && !in.channels().findChannel("R"))
+		{
+			if(in.channels().findChannel("RY") && in.channels().findChannel("BY"))
 			{
 				red = y;
 				green = ry;
@@ -1431,21 +2184,73 @@ SDKGetSourceVideo(
 		
 		
 		// make the Premiere buffer
-		if(sourceVideoRec->inFrameFormats == NULL)
+		if(sourceVideoRec->inFrameFormats == NULL || sourceVideoRec->inNumFrameFormats < 1)
 			throw Iex::NullExc("inFrameFormats is NULL");
 		
-		assert(sourceVideoRec->inNumFrameFormats == 1);
-		assert(sourceVideoRec->inFrameFormats[0].inPixelFormat == PrPixelFormat_BGRA_4444_32f_Linear);
-		
+		// Formats are listed in order of preference, so take the first one we
+		// advertised.  Premiere asks for 8u or 16u for reduced-quality playback.
 		imFrameFormat frameFormat = sourceVideoRec->inFrameFormats[0];
 		
-		frameFormat.inPixelFormat = (bypassConversion ? PrPixelFormat_BGRA_4444_32f : PrPixelFormat_BGRA_4444_32f_Linear);
-				
+		for(int i=0; i < sourceVideoRec->inNumFrameFormats; i++)
+		{
+			const PrPixelFormat format = sourceVideoRec->inFrameFormats[i].inPixelFormat;
+			
+			if(format == PrPixelFormat_BGRA_4444_32f_Linear ||
+				format == PrPixelFormat_BGRA_4444_16u ||
+				format == PrPixelFormat_BGRA_4444_8u)
+			{
+				frameFormat = sourceVideoRec->inFrameFormats[i];
+				break;
+			}
+		}
+		
+		const PPixDepth depth = (frameFormat.inPixelFormat == PrPixelFormat_BGRA_4444_8u ? PPIX_8U :
+									frameFormat.inPixelFormat == PrPixelFormat_BGRA_4444_16u ? PPIX_16U :
+									PPIX_FLOAT);
+		
+		const int pixel_size = PPixPixelSize(depth);
+		
+		// what the pixels get decoded as, 8u and 16u get gamma encoded from linear
+		const PrPixelFormat float_format = (bypassConversion ? PrPixelFormat_BGRA_4444_32f : PrPixelFormat_BGRA_4444_32f_Linear);
+		
+		const bool linear = !bypassConversion;
+		
+		if(depth == PPIX_FLOAT)
+			frameFormat.inPixelFormat = float_format;
+		
 		const Box2i &dispW = in.displayWindow();
 		
 		const int width = dispW.max.x - dispW.min.x + 1;
 		const int height = dispW.max.y - dispW.min.y + 1;
 		
+		
+		// Thumbnails can come straight from the preview image
+		// in the header, without decoding any pixels.
+		const Header &head = in.header(0);
+		
+		if(frameFormat.inFrameWidth > 0 && frameFormat.inFrameHeight > 0 &&
+			(frameFormat.inFrameWidth < width || frameFormat.inFrameHeight < height) &&
+			PreviewUsable(head, prefs) &&
+			frameFormat.inFrameWidth <= head.previewImage().width() &&
+			frameFormat.inFrameHeight <= head.previewImage().height())
+		{
+			prRect previewRect;
+			prSetRect(&previewRect, 0, 0, frameFormat.inFrameWidth, frameFormat.inFrameHeight);
+			
+			RowbyteType rowBytes = 0;
+			char *buf = NULL;
+			
+			ldataP->PPixCreatorSuite->CreatePPix(sourceVideoRec->outFrame, PrPPixBufferAccess_ReadWrite, frameFormat.inPixelFormat, &previewRect);
+			ldataP->PPixSuite->GetPixels(*sourceVideoRec->outFrame, PrPPixBufferAccess_WriteOnly, &buf);
+			ldataP->PPixSuite->GetRowBytes(*sourceVideoRec->outFrame, &rowBytes);
+			
+			CopyPreviewToPPix(head.previewImage(), buf, rowBytes, frameFormat.inFrameWidth, frameFormat.inFrameHeight,
+								depth, linear, string(alpha) != "(none)");
+			
+			return result;
+		}
+		
+		
 		assert(frameFormat.inFrameWidth == width);
 		assert(frameFormat.inFrameHeight == height);
 		
@@ -1459,14 +2264,53 @@ SDKGetSourceVideo(
 		ldataP->PPixSuite->GetPixels(*sourceVideoRec->outFrame, PrPPixBufferAccess_WriteOnly, &buf);
 		ldataP->PPixSuite->GetRowBytes(*sourceVideoRec->outFrame, &rowBytes);
 		
-
-
-		char *dataW_origin = buf;
-		RowbyteType dataW_rowbytes = rowBytes;
-		csSDK_int32 dataW_width = width;
-		csSDK_int32 dataW_height = height;
 		
+		// frames from the slow codecs might be waiting in the disk cache
+		string cache_key;
+		
+		const Compression compression = in.header(0).compression();
+		
+		const char *cache_chan[4] = { blue, green, red, alpha };
+		
+		if( (compression == Imf::PIZ_COMPRESSION ||
+				compression == Imf::DWAA_COMPRESSION ||
+				compression == Imf::DWAB_COMPRESSION) &&
+			AllHalfChannels(in.channels(), cache_chan) &&
+			DiskCacheEnabled() )
+		{
+			ChunkCacheFile file;
+			
+			if( GetFileIdentity(fileRef, file) )
+			{
+				cache_key = DiskCacheKey(file, cache_chan, bypassConversion, float_format, width, height);
+				
+				DiskCachedFrame cached;
+				
+				if( cached.open(cache_key, width, height) )
+				{
+					PriorityTaskGroup taskGroup;
+					
+					for(int y=0; y < height; y++)
+					{
+						AddPriorityTask(new CopyCachedRowTask(&taskGroup,
+																cached.data(), cached.rowbytes(),
+																buf, rowBytes,
+																width, y, depth, linear), kTaskPriority_Interactive);
+					}
+					
+					taskGroup.wait();
+					
+					return result;
+				}
+				
+				// frames go in from a float PPix, an 8u or 16u one can only read them
+				if(depth != PPIX_FLOAT)
+					cache_key.clear();
+			}
+		}
 		
+
+
 		const Box2i &dataW = in.dataWindow();
 		
 		if((dataW != dispW) || (in.parts() > 1))
@@ -1479,14 +2323,17 @@ SDKGetSourceVideo(
 				(dataW.max.x < dispW.max.x) ||
 				(dataW.max.y < dispW.max.y) )
 			{
-				TaskGroup taskGroup;
+				PriorityTaskGroup taskGroup;
 				
+				// zero is all zero bits in every format
 				for(int y=0; y < height; y++)
 				{
-					ThreadPool::addGlobalTask(new FillRowTask(&taskGroup, buf, rowBytes, 0.f,
-																width * 4, y) );
+					AddPriorityTask(new FillRowTask(&taskGroup, buf, rowBytes, 0.f,
+														(width * pixel_size) / sizeof(float), y), kTaskPriority_Interactive);
 				}
 				
+				taskGroup.wait();
+				
 				// if the dataWindow does not actually intersect the displayWindow,
 				// no need to continue further
 				if( !dataW.intersects(dispW) )
@@ -1494,190 +2341,287 @@ SDKGetSourceVideo(
 					return result;
 				}
 			}
-			
-			
-			dataW_width = dataW.max.x - dataW.min.x + 1;
-			dataW_height = dataW.max.y - dataW.min.y + 1;
-			
-			// if dataWindow is completely inside displayWindow, we can use the
-			// existing PPixHand, otherwise have to create a new one
-			if( (dataW.min.x >= dispW.min.x) &&
-				(dataW.min.y >= dispW.min.y) &&
-				(dataW.max.x <= dispW.max.x) &&
-				(dataW.max.y <= dispW.max.y) )
-			{
-				dataW_origin = buf + (rowBytes * (dispW.max.y - dataW.max.y)) + (sizeof(float) * 4 * (dataW.min.x - dispW.min.x));
-			}
-			else
-			{
-				prRect tempRect;
-				prSetRect(&tempRect, 0, 0, dataW_width, dataW_height);
-				
-				ldataP->PPixCreatorSuite->CreatePPix(&temp_ppix, PrPPixBufferAccess_ReadWrite, frameFormat.inPixelFormat, &tempRect);
-				ldataP->PPixSuite->GetPixels(temp_ppix, PrPPixBufferAccess_ReadWrite, &dataW_origin);
-				ldataP->PPixSuite->GetRowBytes(temp_ppix, &dataW_rowbytes);
-			}
 		}
 		
 		
-		if(frameFormat.inPixelFormat == PrPixelFormat_BGRA_4444_32f_Linear || frameFormat.inPixelFormat == PrPixelFormat_BGRA_4444_32f)
+		const csSDK_int32 dataW_width = dataW.max.x - dataW.min.x + 1;
+		const csSDK_int32 dataW_height = dataW.max.y - dataW.min.y + 1;
+		
+		// the part of the dataWindow that lands in the displayWindow
+		const Box2i copyW( V2i( max(dataW.min.x, dispW.min.x), max(dataW.min.y, dispW.min.y) ),
+							V2i( min(dataW.max.x, dispW.max.x), min(dataW.max.y, dispW.max.y) ) );
+		
+		const csSDK_int32 copy_width = copyW.max.x - copyW.min.x + 1;
+		
+		// if dataWindow is completely inside displayWindow, we can decode
+		// straight into a float PPixHand, otherwise we go through scratch buffers
+		const bool decode_to_ppix = (copyW == dataW && depth == PPIX_FLOAT);
+		
+		// set if the file is still being written and some of it wasn't there
+		bool missing_chunks = false;
+		
+		
+		if(string(red) == "Y" &&
+			(string(green) == "RY" || string(green) == "Y") &&
+			(string(blue) == "BY" || string(blue) == "Y") )
 		{
-			if(string(red) == "Y" &&
-				(string(green) == "RY" || string(green) == "Y") &&
-				(string(blue) == "BY" || string(blue) == "Y") )
+			instream.seekg(0);
+			
+			RgbaInputFile inputFile(instream);
+			
+			const int band_height = DecodeBandHeight( inputFile.header() );
+			
+			// One band is converted while the next one decodes.
+			// Declared in this order so the groups finish before the buffers go away.
+			ScratchBuffer band_buffer[2];
+			auto_ptr<PriorityTaskGroup> band_group[2];
+			
+			int b = 0;
+			
+			for(int band_start = BandStart(copyW.min.y, dataW.min.y, band_height);
+					band_start <= copyW.max.y;
+					band_start += band_height)
 			{
-				instream.seekg(0);
+				const int first_line = max(band_start, copyW.min.y);
+				const int last_line = min(band_start + band_height - 1, copyW.max.y);
 				
-				Array2D<Rgba> half_buffer(dataW_height, dataW_width);
+				FinishBandGroup(band_group[b]); // wait for the last conversion out of this buffer
 				
-				RgbaInputFile inputFile(instream);
+				if(band_buffer[b].data() == NULL)
+					band_buffer[b].allocate(sizeof(Rgba) * dataW_width * band_height);
 				
-				inputFile.setFrameBuffer(&half_buffer[-dataW.min.y][-dataW.min.x], 1, dataW_width);
-				inputFile.readPixels(dataW.min.y, dataW.max.y);
+				Rgba *band_pixels = (Rgba *)band_buffer[b].data();
 				
+				inputFile.setFrameBuffer(band_pixels - (first_line * dataW_width) - dataW.min.x, 1, dataW_width);
 				
-				TaskGroup taskGroup;
-				
-				char *buf_row = dataW_origin;
-				
-				for(int y = dataW_height - 1; y >= 0; y--)
+				if( inputFile.isComplete() )
 				{
-					float *buf_pix = (float *)buf_row;
-					
-					ThreadPool::addGlobalTask(new ConvertRgbaRowTask(&taskGroup,
-																		&half_buffer[y][0],
-																		buf_pix,
-																		dataW_width) );
-					
-					buf_row += dataW_rowbytes;
+					inputFile.readPixels(first_line, last_line);
 				}
-			}
-			else
-			{
-				FrameBuffer frameBuffer;
-				
-				char *exr_BGRA_origin = (char *)dataW_origin - (sizeof(float) * 4 * dataW.min.x) + (dataW_rowbytes * dataW.max.y);
-				
-				
-				DupSet dupSet;
-				
-				const char *chan[4] = { blue, green, red, alpha };
-				
-				for(int c=0; c < 4; c++)
+				else
 				{
-					int xSampling = 1,
-						ySampling = 1;
-					
-					const Channel *channel = in.channels().findChannel(chan[c]);
+					// only chunks that aren't there, as in ReadAvailablePixels()
+					bool missing = false;
 					
-					if(channel)
+					try
 					{
-						xSampling = channel->xSampling;
-						ySampling = channel->ySampling;
+						inputFile.readPixels(first_line, last_line);
 					}
-					
-					const float fill = (c == 3 ? 1.f : 0.f);
-				
-					Slice slice(Imf::FLOAT,
-								exr_BGRA_origin + (sizeof(float) * c),
-								sizeof(float) * 4,
-								-dataW_rowbytes,
-								xSampling, ySampling, fill);
-					
-					const Slice *dup_slice = frameBuffer.findSlice(chan[c]);
-					
-					if(dup_slice == NULL)
+					catch(Iex::InputExc &)
 					{
-						frameBuffer.insert(chan[c], slice);
+						missing = true;
 					}
-					else
+					catch(Iex::IoExc &)
+					{
+						missing = true;
+					}
+					
+					if(missing)
 					{
-						// The OpenEXR FrameBuffer can only hold one slice per channel name
-						// because it uses a std::map.  If the user uses the same channel name
-						// more than once, we have to duplicate it ourselves.
+						fill(band_pixels, band_pixels + (dataW_width * (last_line - first_line + 1)), Rgba(0.f, 0.f, 0.f, 1.f));
 						
-						dupSet.push_back( DupInfo(*dup_slice, slice) );
+						missing_chunks = true;
 					}
 				}
-	
-
-				in.setFrameBuffer(frameBuffer);
 				
-				in.readPixels(dataW.min.y, dataW.max.y);
 				
+				band_group[b].reset(new PriorityTaskGroup);
 				
-				FixSubsampling(frameBuffer, dataW);
+				for(int y = first_line; y <= last_line; y++)
+				{
+					Rgba *band_row = &band_pixels[((y - first_line) * dataW_width) + (copyW.min.x - dataW.min.x)];
+					
+					char *buf_pix = PPixAddress(buf, rowBytes, pixel_size, dispW, copyW.min.x, y);
+					
+					AddPriorityTask(new ConvertRgbaRowTask(band_group[b].get(),
+															band_row,
+															buf_pix,
+															copy_width,
+															depth, linear), kTaskPriority_Interactive);
+				}
 				
-				FixDuplicates(dupSet, dataW);
+				b = !b;
 			}
 			
+			FinishBandGroup(band_group[0]);
+			FinishBandGroup(band_group[1]);
+		}
+		else
+		{
+			const char *chan[4] = { blue, green, red, alpha };
+			
+			bool subsampled = false;
 			
-			if(temp_ppix)
+			for(int c=0; c < 4; c++)
 			{
-				// have to draw dataWindow pixels inside the displayWindow
-				prPoint disp_origin, data_origin;
+				const Channel *channel = in.channels().findChannel(chan[c]);
 				
-				if(dispW.min.x < dataW.min.x)
-				{
-					disp_origin.x = dataW.min.x - dispW.min.x;
-					data_origin.x = 0;
-				}
-				else
-				{
-					disp_origin.x = 0;
-					data_origin.x = dispW.min.x - dataW.min.x;
-				}
+				if(channel && (channel->xSampling != 1 || channel->ySampling != 1))
+					subsampled = true;
+			}
+			
+			
+			if(decode_to_ppix || subsampled)
+			{
+				ScratchBuffer temp_buffer;
 				
+				char *exr_BGRA_origin = NULL;
+				RowbyteType exr_rowbytes = 0;
 				
-				if(dispW.max.y > dataW.max.y)
+				if(decode_to_ppix)
 				{
-					disp_origin.y = dispW.max.y - dataW.max.y;
-					data_origin.y = 0;
+					exr_BGRA_origin = PPixAddress(buf, rowBytes, pixel_size, dispW, 0, 0);
+					exr_rowbytes = -rowBytes;
 				}
 				else
 				{
-					disp_origin.y = 0;
-					data_origin.y = dataW.max.y - dispW.max.y;
+					// FixSubsampling needs the whole dataWindow at once
+					const ptrdiff_t temp_rowbytes = ScratchRowbytes(dataW_width, sizeof(float) * 4);
+					
+					temp_buffer.allocate(temp_rowbytes * dataW_height);
+					
+					exr_BGRA_origin = temp_buffer.data() - (temp_rowbytes * dataW.min.y) - ((ptrdiff_t)sizeof(float) * 4 * dataW.min.x);
+					exr_rowbytes = (RowbyteType)temp_rowbytes;
 				}
 				
 				
-				char *display_pixel_origin = buf + (disp_origin.y * rowBytes) + (disp_origin.x * sizeof(float) * 4);
+				FrameBuffer frameBuffer;
+				DupSet dupSet;
 				
-				char *data_pixel_origin = dataW_origin + (data_origin.y * dataW_rowbytes) + (data_origin.x * sizeof(float) * 4);
+				MakeBGRAFrameBuffer(frameBuffer, dupSet, in.channels(), chan, exr_BGRA_origin, exr_rowbytes);
 				
-				const int copy_width = min(dispW.max.x, dataW.max.x) - max(dispW.min.x, dataW.min.x) + 1;
-				const int copy_height = min(dispW.max.y, dataW.max.y) - max(dispW.min.y, dataW.min.y) + 1;
+				in.setFrameBuffer(frameBuffer);
 				
+				if( !ReadAvailablePixels(in, dataW.min.y, dataW.max.y) )
+					missing_chunks = true;
 				
-				TaskGroup taskGroup;
 				
-				for(int y=0; y < copy_height; y++)
+				FixSubsampling(frameBuffer, dataW);
+				
+				FixDuplicates(dupSet, dataW);
+				
+				
+				if(!decode_to_ppix)
 				{
-					ThreadPool::addGlobalTask(new CopyPPixRowTask(&taskGroup,
-														data_pixel_origin, dataW_rowbytes,
-														display_pixel_origin, rowBytes,
-														copy_width * 4, y) );
+					// have to draw dataWindow pixels inside the displayWindow
+					const char *data_pixel_origin = exr_BGRA_origin + ((ptrdiff_t)exr_rowbytes * copyW.min.y) + ((ptrdiff_t)sizeof(float) * 4 * copyW.min.x);
+					
+					char *display_pixel_origin = PPixAddress(buf, rowBytes, pixel_size, dispW, copyW.min.x, copyW.min.y);
+					
+					const int copy_height = copyW.max.y - copyW.min.y + 1;
+					
+					PriorityTaskGroup taskGroup;
+					
+					for(int y=0; y < copy_height; y++)
+					{
+						AddPriorityTask(new CopyPPixRowTask(&taskGroup,
+															data_pixel_origin, exr_rowbytes,
+															display_pixel_origin, -rowBytes,
+															copy_width, y, depth, linear), kTaskPriority_Interactive);
+					}
+					
+					taskGroup.wait();
+				}
+			}
+			else
+			{
+				// The dataWindow spills out of the displayWindow, or the PPix isn't
+				// float, so decode only the scanlines we need, one band at a time,
+				// and copy the visible part.
+				const int band_height = DecodeBandHeight( in.header(0) );
+				
+				const ptrdiff_t band_rowbytes = ScratchRowbytes(dataW_width, sizeof(float) * 4);
+				
+				ScratchBuffer band_buffer[2];
+				auto_ptr<PriorityTaskGroup> band_group[2];
+				
+				int b = 0;
+				
+				for(int band_start = BandStart(copyW.min.y, dataW.min.y, band_height);
+						band_start <= copyW.max.y;
+						band_start += band_height)
+				{
+					const int first_line = max(band_start, copyW.min.y);
+					const int last_line = min(band_start + band_height - 1, copyW.max.y);
+					
+					FinishBandGroup(band_group[b]);
+					
+					if(band_buffer[b].data() == NULL)
+						band_buffer[b].allocate(band_rowbytes * band_height);
+					
+					char *exr_BGRA_origin = band_buffer[b].data() - (band_rowbytes * first_line) - ((ptrdiff_t)sizeof(float) * 4 * dataW.min.x);
+					
+					FrameBuffer frameBuffer;
+					DupSet dupSet;
+					
+					MakeBGRAFrameBuffer(frameBuffer, dupSet, in.channels(), chan, exr_BGRA_origin, (RowbyteType)band_rowbytes);
+					
+					in.setFrameBuffer(frameBuffer);
+					
+					if( !ReadAvailablePixels(in, first_line, last_line) )
+						missing_chunks = true;
+					
+					FixDuplicates(dupSet, Box2i( V2i(dataW.min.x, first_line), V2i(dataW.max.x, last_line) ));
+					
+					
+					const char *data_pixel_origin = band_buffer[b].data() + ((ptrdiff_t)sizeof(float) * 4 * (copyW.min.x - dataW.min.x));
+					
+					char *display_pixel_origin = PPixAddress(buf, rowBytes, pixel_size, dispW, copyW.min.x, first_line);
+					
+					band_group[b].reset(new PriorityTaskGroup);
+					
+					for(int y=0; y <= (last_line - first_line); y++)
+					{
+						AddPriorityTask(new CopyPPixRowTask(band_group[b].get(),
+															data_pixel_origin, (RowbyteType)band_rowbytes,
+															display_pixel_origin, -rowBytes,
+															copy_width, y, depth, linear), kTaskPriority_Interactive);
+					}
+					
+					b = !b;
 				}
+				
+				FinishBandGroup(band_group[0]);
+				FinishBandGroup(band_group[1]);
 			}
 		}
+		
+		
+		if(missing_chunks)
+		{
+			// don't keep this frame around, it'll be read again when the file changes
+			cache_key.clear();
+			
+			NotePartialFrame(fileRef, ChunkTablesEnd(instream, in));
+		}
 		else
-			assert(false);
+		{
+			ChunkCacheFile file;
+			
+			if( instream.identity(file) )
+				ForgetGrowingFile(file);
+		}
+		
+		// Blocks carried from a smaller version of the file were checked,
+		// but not closely enough to keep the frame across sessions.
+		if( instream.carried() )
+			cache_key.clear();
+		
+		
+		// all the row tasks are done by now
+		if( !cache_key.empty() )
+			WriteDiskCachedFrame(cache_key, buf, rowBytes, width, height);
 	}
 	catch(...)
 	{
 		result = malUnknownError;
 	}
 	
-	
-	if(temp_ppix)
-		ldataP->PPixSuite->Dispose(temp_ppix);
-	
 
 	return result;
 }
 
 
-
 PREMPLUGENTRY DllExport xImportEntry (
 	csSDK_int32		selector, 
 	imStdParms		*stdParms, 
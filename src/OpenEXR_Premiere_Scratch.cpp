@@ -0,0 +1,443 @@
+
+//////////////////////////////////////////////////////////////////////////////
+// 
+// Copyright (c) 2015, Brendan Bolles
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+//////////////////////////////////////////////////////////////////////////////
+
+//------------------------------------------
+//
+// OpenEXR_Premiere_Scratch.cpp
+// 
+// OpenEXR plug-in for Adobe Premiere
+//
+//------------------------------------------
+
+
+#include "OpenEXR_Premiere_Scratch.h"
+
+#include "OpenEXR_Premiere_Tasks.h"
+
+#include <IlmThread.h>
+#include <IlmThreadMutex.h>
+#include <IlmThreadSemaphore.h>
+
+#include <map>
+#include <new>
+#include <vector>
+
+#include <stdlib.h>
+#include <assert.h>
+
+#ifdef __APPLE__
+	#include <unistd.h>
+#else
+	#include <malloc.h>
+	#include <windows.h>
+#endif
+
+
+using namespace std;
+using namespace IlmThread;
+
+
+static const size_t kScratchAlignment = 64;
+static const size_t kMinBucket = 64 * 1024;
+
+static const double kTrimInterval = 0.5; // how often the timer wakes up, in seconds
+
+
+typedef struct FreeBlock
+{
+	char	*data;
+	double	lastUsed;
+	
+	FreeBlock(char *d, double t) : data(d), lastUsed(t) {}
+} FreeBlock;
+
+typedef std::vector<FreeBlock> FreeList;
+typedef std::map<size_t, FreeList> FreeLists;
+
+
+static Mutex		gScratchMutex;
+static FreeLists	gFreeLists;
+static ScratchStats	gScratchStats = {0, 0, 0, 0, 0, 0};
+
+static const size_t	kHighWater = OPENEXR_SCRATCH_HIGH_WATER;
+static const double	kIdleSeconds = OPENEXR_SCRATCH_IDLE_SECONDS;
+
+
+static char *
+AlignedAlloc(size_t size)
+{
+#ifdef __APPLE__
+	void *ptr = NULL;
+	
+	if(posix_memalign(&ptr, kScratchAlignment, size) != 0)
+		ptr = NULL;
+	
+	return (char *)ptr;
+#else
+	return (char *)_aligned_malloc(size, kScratchAlignment);
+#endif
+}
+
+
+static void
+AlignedFree(char *ptr)
+{
+#ifdef __APPLE__
+	free(ptr);
+#else
+	_aligned_free(ptr);
+#endif
+}
+
+
+// Sizes are rounded up to one of four steps between powers of two,
+// so a bucket wastes at most 25%.
+static size_t
+BucketSize(size_t size)
+{
+	size_t bucket = kMinBucket;
+	
+	while(bucket < size)
+		bucket *= 2;
+	
+	if(bucket > kMinBucket)
+	{
+		const size_t step = bucket / 8;
+		
+		size_t stepped = bucket / 2;
+		
+		while(stepped < size)
+			stepped += step;
+		
+		bucket = stepped;
+	}
+	
+	return bucket;
+}
+
+
+// must hold gScratchMutex
+static void
+FreeOldest()
+{
+	FreeLists::iterator oldest_list = gFreeLists.end();
+	size_t oldest_index = 0;
+	double oldest_time = 0;
+	
+	for(FreeLists::iterator i = gFreeLists.begin(); i != gFreeLists.end(); ++i)
+	{
+		FreeList &list = i->second;
+		
+		for(size_t n=0; n < list.size(); n++)
+		{
+			if(oldest_list == gFreeLists.end() || list[n].lastUsed < oldest_time)
+			{
+				oldest_list = i;
+				oldest_index = n;
+				oldest_time = list[n].lastUsed;
+			}
+		}
+	}
+	
+	if(oldest_list != gFreeLists.end())
+	{
+		FreeList &list = oldest_list->second;
+		
+		AlignedFree(list[oldest_index].data);
+		
+		gScratchStats.bytesCached -= oldest_list->first;
+		gScratchStats.trimmed++;
+		
+		list.erase(list.begin() + oldest_index);
+		
+		if(list.empty())
+			gFreeLists.erase(oldest_list);
+	}
+}
+
+
+// must hold gScratchMutex
+static void
+TrimIdle(double now, double idleSeconds)
+{
+	for(FreeLists::iterator i = gFreeLists.begin(); i != gFreeLists.end(); )
+	{
+		FreeList &list = i->second;
+		
+		for(FreeList::iterator b = list.begin(); b != list.end(); )
+		{
+			if(now - b->lastUsed >= idleSeconds)
+			{
+				AlignedFree(b->data);
+				
+				gScratchStats.bytesCached -= i->first;
+				gScratchStats.trimmed++;
+				
+				b = list.erase(b);
+			}
+			else
+				++b;
+		}
+		
+		if(list.empty())
+			gFreeLists.erase(i++);
+		else
+			++i;
+	}
+}
+
+
+static void
+SleepSeconds(double seconds)
+{
+#ifdef __APPLE__
+	usleep((useconds_t)(seconds * 1000000.0));
+#else
+	Sleep((DWORD)(seconds * 1000.0));
+#endif
+}
+
+
+class ScratchTrimThread : public Thread
+{
+  public:
+	ScratchTrimThread() : _quit(false), _finished(0) {}
+	virtual ~ScratchTrimThread() {}
+	
+	virtual void run();
+	
+	void quit();
+	
+  private:
+	volatile bool _quit;
+	Semaphore _finished;
+};
+
+
+void
+ScratchTrimThread::run()
+{
+	while(!_quit)
+	{
+		SleepSeconds(kTrimInterval);
+		
+		Lock lock(gScratchMutex);
+		
+		TrimIdle(CurrentSeconds(), kIdleSeconds);
+	}
+	
+	_finished.post();
+}
+
+
+void
+ScratchTrimThread::quit()
+{
+	_quit = true;
+	
+	_finished.wait();
+}
+
+
+static ScratchTrimThread *gTrimThread = NULL;
+
+
+// must hold gScratchMutex
+static void
+StartTrimThread()
+{
+	if(gTrimThread == NULL && supportsThreads())
+	{
+		gTrimThread = new ScratchTrimThread;
+		
+		gTrimThread->start();
+	}
+}
+
+
+ScratchBuffer::ScratchBuffer(size_t size) :
+	_data(NULL),
+	_size(0),
+	_bucket(0)
+{
+	if(size > 0)
+		allocate(size);
+}
+
+
+ScratchBuffer::~ScratchBuffer()
+{
+	release();
+}
+
+
+void
+ScratchBuffer::allocate(size_t size)
+{
+	release();
+	
+	const size_t bucket = BucketSize(size);
+	
+	Lock lock(gScratchMutex);
+	
+	StartTrimThread();
+	
+	FreeLists::iterator i = gFreeLists.find(bucket);
+	
+	if(i != gFreeLists.end())
+	{
+		FreeList &list = i->second;
+		
+		assert(!list.empty());
+		
+		// most recently used is warmest in cache
+		_data = list.back().data;
+		
+		list.pop_back();
+		
+		if(list.empty())
+			gFreeLists.erase(i);
+		
+		gScratchStats.bytesCached -= bucket;
+		gScratchStats.reused++;
+	}
+	else
+	{
+		// make room under the high-water mark before allocating more
+		while(gScratchStats.bytesCached > 0 &&
+				gScratchStats.bytesInUse + gScratchStats.bytesCached + bucket > kHighWater)
+		{
+			FreeOldest();
+		}
+		
+		_data = AlignedAlloc(bucket);
+		
+		if(_data == NULL)
+		{
+			// one more try after letting go of everything we're holding
+			while(gScratchStats.bytesCached > 0)
+				FreeOldest();
+			
+			_data = AlignedAlloc(bucket);
+			
+			if(_data == NULL)
+				throw bad_alloc();
+		}
+		
+		gScratchStats.allocated++;
+	}
+	
+	_size = size;
+	_bucket = bucket;
+	
+	gScratchStats.bytesInUse += bucket;
+	
+	if(gScratchStats.bytesInUse + gScratchStats.bytesCached > gScratchStats.peakBytes)
+		gScratchStats.peakBytes = gScratchStats.bytesInUse + gScratchStats.bytesCached;
+}
+
+
+void
+ScratchBuffer::release()
+{
+	if(_data == NULL)
+		return;
+	
+	Lock lock(gScratchMutex);
+	
+	gScratchStats.bytesInUse -= _bucket;
+	
+	while(gScratchStats.bytesCached > 0 &&
+			gScratchStats.bytesInUse + gScratchStats.bytesCached + _bucket > kHighWater)
+	{
+		FreeOldest();
+	}
+	
+	if(gScratchStats.bytesInUse + gScratchStats.bytesCached + _bucket <= kHighWater)
+	{
+		gFreeLists[_bucket].push_back( FreeBlock(_data, CurrentSeconds()) );
+		
+		gScratchStats.bytesCached += _bucket;
+	}
+	else
+	{
+		AlignedFree(_data);
+		
+		gScratchStats.trimmed++;
+	}
+	
+	_data = NULL;
+	_size = 0;
+	_bucket = 0;
+}
+
+
+size_t
+ScratchRowbytes(size_t width, size_t pixelSize)
+{
+	const size_t rowbytes = width * pixelSize;
+	
+	return ((rowbytes + kScratchAlignment - 1) / kScratchAlignment) * kScratchAlignment;
+}
+
+
+void
+GetScratchStats(ScratchStats &stats)
+{
+	Lock lock(gScratchMutex);
+	
+	stats = gScratchStats;
+}
+
+
+void
+ShutdownScratch()
+{
+	ScratchTrimThread *thread = NULL;
+	
+	{
+		Lock lock(gScratchMutex);
+		
+		thread = gTrimThread;
+		
+		gTrimThread = NULL;
+	}
+	
+	if(thread)
+	{
+		thread->quit();
+		
+		delete thread;
+	}
+	
+	Lock lock(gScratchMutex);
+	
+	while(gScratchStats.bytesCached > 0)
+		FreeOldest();
+}
@@ -0,0 +1,101 @@
+
+//////////////////////////////////////////////////////////////////////////////
+// 
+// Copyright (c) 2015, Brendan Bolles
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+//////////////////////////////////////////////////////////////////////////////
+
+//------------------------------------------
+//
+// OpenEXR_Premiere_Scratch.h
+// 
+// OpenEXR plug-in for Adobe Premiere
+//
+//------------------------------------------
+
+
+#ifndef _OPENEXR_PREMIERE_SCRATCH_H_
+#define _OPENEXR_PREMIERE_SCRATCH_H_
+
+#include <stddef.h>
+
+
+// Temporary frame buffers come from a size-bucketed arena instead of
+// being allocated and freed for every frame.  Buffers are 64-byte aligned
+// and are kept around after release, up to a high-water mark.  A background
+// timer frees buffers that have not been used for a while.
+
+#ifndef OPENEXR_SCRATCH_HIGH_WATER
+#define OPENEXR_SCRATCH_HIGH_WATER		((size_t)2048 * 1024 * 1024)
+#endif
+
+#ifndef OPENEXR_SCRATCH_IDLE_SECONDS
+#define OPENEXR_SCRATCH_IDLE_SECONDS	10.0
+#endif
+
+class ScratchBuffer
+{
+  public:
+	ScratchBuffer(size_t size = 0);
+	~ScratchBuffer();
+	
+	// contents are not initialized
+	void allocate(size_t size);
+	void release();
+	
+	char * data() const { return _data; }
+	size_t size() const { return _size; }
+	
+  private:
+	ScratchBuffer(const ScratchBuffer &);
+	ScratchBuffer & operator = (const ScratchBuffer &);
+	
+	char *_data;
+	size_t _size;
+	size_t _bucket;
+};
+
+
+// rowbytes that keep every row 64-byte aligned
+size_t ScratchRowbytes(size_t width, size_t pixelSize);
+
+
+typedef struct ScratchStats
+{
+	size_t	bytesInUse;
+	size_t	bytesCached;
+	size_t	peakBytes;
+	size_t	reused;
+	size_t	allocated;
+	size_t	trimmed;
+} ScratchStats;
+
+void GetScratchStats(ScratchStats &stats);
+
+// frees all cached buffers and stops the idle timer (it restarts when needed)
+void ShutdownScratch();
+
+
+#endif // _OPENEXR_PREMIERE_SCRATCH_H_
@@ -0,0 +1,306 @@
+
+//////////////////////////////////////////////////////////////////////////////
+// 
+// Copyright (c) 2015, Brendan Bolles
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+//////////////////////////////////////////////////////////////////////////////
+
+//------------------------------------------
+//
+// OpenEXR_Premiere_Tasks.cpp
+// 
+// OpenEXR plug-in for Adobe Premiere
+//
+//------------------------------------------
+
+
+#include "OpenEXR_Premiere_Tasks.h"
+
+#include <IlmThreadPool.h>
+#include <IexBaseExc.h>
+
+#include <deque>
+#include <exception>
+
+#ifdef __APPLE__
+	#include <mach/mach_time.h>
+#else
+	#include <windows.h>
+#endif
+
+
+using namespace std;
+using namespace IlmThread;
+using Imf::Int64;
+
+
+PriorityTaskGroup::PriorityTaskGroup() :
+	_isEmpty(1),
+	_numPending(0),
+	_failed(false)
+{
+
+}
+
+
+PriorityTaskGroup::~PriorityTaskGroup()
+{
+	_isEmpty.wait();
+	
+	// removeTask() posts with the mutex held, so make sure
+	// it has let go before the mutex is destroyed
+	Lock lock(_mutex);
+}
+
+
+void
+PriorityTaskGroup::wait()
+{
+	_isEmpty.wait();
+	_isEmpty.post();
+	
+	Lock lock(_mutex);
+	
+	if(_failed)
+	{
+		_failed = false;
+		
+		throw Iex::BaseExc(_failure.c_str());
+	}
+}
+
+
+void
+PriorityTaskGroup::addTask()
+{
+	Lock lock(_mutex);
+	
+	if(_numPending++ == 0)
+		_isEmpty.wait();
+}
+
+
+void
+PriorityTaskGroup::removeTask()
+{
+	Lock lock(_mutex);
+	
+	if(--_numPending == 0)
+		_isEmpty.post();
+}
+
+
+void
+PriorityTaskGroup::taskFailed(const char *what)
+{
+	Lock lock(_mutex);
+	
+	if(!_failed)
+	{
+		_failed = true;
+		_failure = what;
+	}
+}
+
+
+PriorityTask::PriorityTask(PriorityTaskGroup *group) :
+	_group(group)
+{
+	if(_group)
+		_group->addTask();
+}
+
+
+PriorityTask::~PriorityTask()
+{
+	if(_group)
+		_group->removeTask();
+}
+
+
+typedef struct QueuedTask
+{
+	PriorityTask	*task;
+	double			queuedTime;
+	Int64			sequence;
+	
+	QueuedTask(PriorityTask *t, double q, Int64 s) : task(t), queuedTime(q), sequence(s) {}
+} QueuedTask;
+
+typedef std::deque<QueuedTask> TaskQueue;
+
+
+static Mutex			gQueueMutex;
+static TaskQueue		gQueues[kTaskPriority_Count];
+static Int64			gSequence = 0;
+static TaskClassStats	gStats[kTaskPriority_Count];
+
+
+static void
+RunNextTask()
+{
+	PriorityTask *task = NULL;
+	int task_class = 0;
+	
+	{
+		Lock lock(gQueueMutex);
+		
+		for(int c=0; c < kTaskPriority_Count && task == NULL; c++)
+		{
+			TaskQueue &queue = gQueues[c];
+			
+			if(!queue.empty())
+			{
+				const QueuedTask next = queue.front();
+				
+				queue.pop_front();
+				
+				const double wait = CurrentSeconds() - next.queuedTime;
+				
+				TaskClassStats &stats = gStats[c];
+				
+				stats.tasksRun++;
+				stats.totalQueueSeconds += wait;
+				
+				if(wait > stats.maxQueueSeconds)
+					stats.maxQueueSeconds = wait;
+				
+				// anything of lower priority that was queued before us just got preempted
+				for(int l = c + 1; l < kTaskPriority_Count; l++)
+				{
+					if(!gQueues[l].empty() && gQueues[l].front().sequence < next.sequence)
+						gStats[l].timesPreempted++;
+				}
+				
+				task = next.task;
+				task_class = c;
+			}
+		}
+	}
+	
+	if(task)
+	{
+		bool failed = true;
+		string failure;
+		
+		try
+		{
+			task->execute();
+			
+			failed = false;
+		}
+		catch(Iex::BaseExc &e)
+		{
+			failure = e.what();
+		}
+		catch(exception &e)
+		{
+			failure = e.what();
+		}
+		catch(...) {}
+		
+		if(failed)
+		{
+			// before the task is deleted, which can wake the waiter
+			if(task->group())
+				task->group()->taskFailed(failure.empty() ? "Task failed" : failure.c_str());
+			
+			Lock lock(gQueueMutex);
+			
+			gStats[task_class].tasksFailed++;
+		}
+		
+		delete task;
+	}
+}
+
+
+// Every call to AddPriorityTask puts one of these in the IlmThread pool.
+// When a worker gets to it, it runs whatever task currently has the highest
+// priority, not necessarily the one that was added with it.
+class DispatchTask : public Task
+{
+  public:
+	DispatchTask(TaskGroup *group) : Task(group) {}
+	virtual ~DispatchTask() {}
+	
+	virtual void execute() { RunNextTask(); }
+};
+
+
+static TaskGroup gDispatchGroup;
+
+
+void
+AddPriorityTask(PriorityTask *task, TaskPriority priority)
+{
+	if(task == NULL)
+		return;
+	
+	if(priority < kTaskPriority_Interactive || priority >= kTaskPriority_Count)
+		priority = kTaskPriority_Export;
+	
+	{
+		Lock lock(gQueueMutex);
+		
+		gQueues[priority].push_back( QueuedTask(task, CurrentSeconds(), gSequence++) );
+	}
+	
+	ThreadPool::addGlobalTask(new DispatchTask(&gDispatchGroup));
+}
+
+
+void
+GetTaskStats(TaskClassStats stats[kTaskPriority_Count])
+{
+	Lock lock(gQueueMutex);
+	
+	for(int c=0; c < kTaskPriority_Count; c++)
+		stats[c] = gStats[c];
+}
+
+
+double
+CurrentSeconds()
+{
+#ifdef __APPLE__
+	static mach_timebase_info_data_t timebase = {0, 0};
+	
+	if(timebase.denom == 0)
+		mach_timebase_info(&timebase);
+	
+	return ((double)mach_absolute_time() * (double)timebase.numer / (double)timebase.denom) / 1000000000.0;
+#else
+	static LARGE_INTEGER frequency = {0};
+	
+	if(frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+	
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+#endif
+}
@@ -0,0 +1,127 @@
+
+//////////////////////////////////////////////////////////////////////////////
+// 
+// Copyright (c) 2015, Brendan Bolles
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+//////////////////////////////////////////////////////////////////////////////
+
+//------------------------------------------
+//
+// OpenEXR_Premiere_Tasks.h
+// 
+// OpenEXR plug-in for Adobe Premiere
+//
+//------------------------------------------
+
+
+#ifndef _OPENEXR_PREMIERE_TASKS_H_
+#define _OPENEXR_PREMIERE_TASKS_H_
+
+#include <ImfInt64.h>
+#include <IlmThreadMutex.h>
+#include <IlmThreadSemaphore.h>
+
+#include <string>
+
+
+// Priority classes for the plug-in's worker tasks, highest priority first.
+// Tasks are dispatched one at a time from per-class queues, so a frame
+// requested by Premiere jumps ahead of export and background work that
+// is still waiting, as soon as the current task finishes.
+typedef enum
+{
+	kTaskPriority_Interactive = 0,
+	kTaskPriority_Export,
+	kTaskPriority_Background,
+	
+	kTaskPriority_Count
+} TaskPriority;
+
+
+// Works like IlmThread::TaskGroup: the destructor waits
+// until every task in the group has executed.  A task that throws
+// is noted in its group, and wait() throws it on to the waiter.
+class PriorityTaskGroup
+{
+  public:
+	PriorityTaskGroup();
+	~PriorityTaskGroup();
+	
+	// waits for the tasks added so far, throws Iex::BaseExc if any failed
+	void wait();
+	
+	// called by the dispatcher when one of our tasks throws
+	void taskFailed(const char *what);
+	
+  private:
+	friend class PriorityTask;
+	
+	void addTask();
+	void removeTask();
+	
+	IlmThread::Mutex _mutex;
+	IlmThread::Semaphore _isEmpty;
+	int _numPending;
+	bool _failed;
+	std::string _failure;
+};
+
+
+class PriorityTask
+{
+  public:
+	PriorityTask(PriorityTaskGroup *group);
+	virtual ~PriorityTask();
+	
+	virtual void execute() = 0;
+	
+	PriorityTaskGroup * group() { return _group; }
+	
+  private:
+	PriorityTaskGroup *_group;
+};
+
+
+// Takes ownership of the task, which is deleted after it executes.
+void AddPriorityTask(PriorityTask *task, TaskPriority priority);
+
+
+typedef struct TaskClassStats
+{
+	Imf::Int64	tasksRun;
+	Imf::Int64	timesPreempted; // higher priority task dispatched while one of ours was waiting longer
+	Imf::Int64	tasksFailed;
+	double		totalQueueSeconds;
+	double		maxQueueSeconds;
+} TaskClassStats;
+
+void GetTaskStats(TaskClassStats stats[kTaskPriority_Count]);
+
+
+// monotonic clock, used for timing throughout the plug-in
+double CurrentSeconds();
+
+
+#endif // _OPENEXR_PREMIERE_TASKS_H_
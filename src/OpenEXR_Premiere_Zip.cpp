@@ -0,0 +1,108 @@
+
+//////////////////////////////////////////////////////////////////////////////
+// 
+// Copyright (c) 2015, Brendan Bolles
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// 
+//////////////////////////////////////////////////////////////////////////////
+
+//------------------------------------------
+//
+// OpenEXR_Premiere_Zip.cpp
+// 
+// OpenEXR plug-in for Adobe Premiere
+//
+//------------------------------------------
+
+
+#include "OpenEXR_Premiere_Zip.h"
+
+#include <zlib.h>
+
+
+// Only changed between exports, while no chunks are being compressed.
+// The worker threads pick it up through the task queue's mutex.
+static int gZipLevel = EXR_DEFAULT_ZIP_LEVEL;
+
+
+void
+SetZipCompressionLevel(int level)
+{
+	gZipLevel = ((level >= 1 && level <= 9) ? level : EXR_DEFAULT_ZIP_LEVEL);
+}
+
+
+// These replace zlib's compress.c, and work the same way.  All three have
+// to be here, or the linker would bring in compress.c for the others and
+// find compress() defined twice.
+
+int ZEXPORT
+compress2(Bytef *dest, uLongf *destLen, const Bytef *source, uLong sourceLen, int level)
+{
+	z_stream stream;
+	
+	stream.next_in = (Bytef *)source;
+	stream.avail_in = (uInt)sourceLen;
+	stream.next_out = dest;
+	stream.avail_out = (uInt)*destLen;
+	
+	if((uLong)stream.avail_out != *destLen || (uLong)stream.avail_in != sourceLen)
+		return Z_BUF_ERROR;
+	
+	stream.zalloc = (alloc_func)0;
+	stream.zfree = (free_func)0;
+	stream.opaque = (voidpf)0;
+	
+	int err = deflateInit(&stream, level);
+	
+	if(err != Z_OK)
+		return err;
+	
+	err = deflate(&stream, Z_FINISH);
+	
+	if(err != Z_STREAM_END)
+	{
+		deflateEnd(&stream);
+		
+		return (err == Z_OK ? Z_BUF_ERROR : err);
+	}
+	
+	*destLen = stream.total_out;
+	
+	return deflateEnd(&stream);
+}
+
+
+int ZEXPORT
+compress(Bytef *dest, uLongf *destLen, const Bytef *source, uLong sourceLen)
+{
+	return compress2(dest, destLen, source, sourceLen, gZipLevel);
+}
+
+
+uLong ZEXPORT
+compressBound(uLong sourceLen)
+{
+	return sourceLen + (sourceLen >> 12) + (sourceLen >> 14) + (sourceLen >> 25) + 13;
+}
@@ -0,0 +1,235 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2015, Brendan Bolles
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+//------------------------------------------
+//
+// ConvertBench.cpp
+//
+// Times the export row converters in OpenEXR_Premiere_Convert.cpp against
+// the two-pass loop they replaced (copy each component, then premultiply),
+// for float->half and float->float, with and without premultiply.
+// Runs CheckConvertBgraRow() first, so the numbers are for converters
+// that give the same results.
+//
+// Build, for example:
+//
+//   c++ -O2 -Isrc -Iext/openexr/IlmBase/Half tools/ConvertBench.cpp
+//       src/OpenEXR_Premiere_Convert.cpp -lHalf
+//
+// ConvertBench [width] [height] [passes]
+//
+//------------------------------------------
+
+
+#include "OpenEXR_Premiere_Convert.h"
+
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sys/time.h>
+#endif
+
+using namespace std;
+
+
+static double
+CurrentSeconds()
+{
+#ifdef _WIN32
+	LARGE_INTEGER count, freq;
+
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+
+	return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (double)tv.tv_sec + ((double)tv.tv_usec / 1000000.0);
+#endif
+}
+
+
+// the way ConvertBgraRowTask used to do it
+template <typename OutFormat>
+static void
+ConvertBgraRowTwoPass(const float *input_row, OutFormat *output_row, int length, bool premult)
+{
+	const float *in = input_row;
+	OutFormat *out = output_row;
+
+	for(int x=0; x < (length * 4); x++)
+	{
+		*out++ = *in++;
+	}
+
+	if(premult)
+	{
+		OutFormat *b = output_row + 0;
+		OutFormat *g = output_row + 1;
+		OutFormat *r = output_row + 2;
+		OutFormat *a = output_row + 3;
+
+		for(int x=0; x < length; x++)
+		{
+			if(*a != 1.f)
+			{
+				*b *= *a;
+				*g *= *a;
+				*r *= *a;
+			}
+
+			b += 4;
+			g += 4;
+			r += 4;
+			a += 4;
+		}
+	}
+}
+
+
+// A frame with soft alpha, so premultiply has work on most pixels
+static void
+MakeFrame(vector<float> &frame, int width, int height)
+{
+	frame.resize((size_t)width * height * 4);
+
+	float *pix = &frame[0];
+
+	for(int y=0; y < height; y++)
+	{
+		for(int x=0; x < width; x++)
+		{
+			const float u = (float)x / width;
+			const float v = (float)y / height;
+
+			*pix++ = u;
+			*pix++ = v;
+			*pix++ = 0.5f + 0.5f * sinf(10.f * (u + v));
+			*pix++ = (x % 3 == 0 ? 1.f : u * v);
+		}
+	}
+}
+
+
+template <typename OutFormat>
+static double
+TimeConverter(void (*convert)(const float *, OutFormat *, int, bool),
+				const vector<float> &frame, vector<OutFormat> &out,
+				int width, int height, int passes, bool premult)
+{
+	out.resize(frame.size());
+
+	double best = 0.0;
+
+	for(int p=0; p < passes; p++)
+	{
+		const double start = CurrentSeconds();
+
+		for(int y=0; y < height; y++)
+		{
+			const size_t row = (size_t)y * width * 4;
+
+			convert(&frame[row], &out[row], width, premult);
+		}
+
+		const double seconds = CurrentSeconds() - start;
+
+		if(p == 0 || seconds < best)
+			best = seconds;
+	}
+
+	return best;
+}
+
+
+template <typename OutFormat>
+static void
+Compare(const char *name, void (*convert)(const float *, OutFormat *, int, bool),
+		const vector<float> &frame, int width, int height, int passes)
+{
+	vector<OutFormat> out;
+
+	for(int premult=0; premult < 2; premult++)
+	{
+		const double two_pass = TimeConverter<OutFormat>(ConvertBgraRowTwoPass<OutFormat>,
+															frame, out, width, height, passes, premult);
+		const double fused = TimeConverter<OutFormat>(convert, frame, out, width, height, passes, premult);
+
+		printf("%-14s %-11s two-pass %7.2f ms, fused %7.2f ms, %5.1fx\n", name,
+				(premult ? "premult" : "straight"), two_pass * 1000.0, fused * 1000.0, two_pass / fused);
+	}
+}
+
+
+static void
+ConvertToHalf(const float *in, half *out, int length, bool premult)
+{
+	ConvertBgraRow(in, out, length, premult);
+}
+
+
+static void
+ConvertToFloat(const float *in, float *out, int length, bool premult)
+{
+	ConvertBgraRow(in, out, length, premult);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	const int width = (argc > 1 ? atoi(argv[1]) : 1920);
+	const int height = (argc > 2 ? atoi(argv[2]) : 1080);
+	const int passes = (argc > 3 ? atoi(argv[3]) : 20);
+
+	if( !CheckConvertBgraRow() )
+	{
+		printf("converters don't match the plain C++ ones\n");
+
+		return 1;
+	}
+
+	vector<float> frame;
+
+	MakeFrame(frame, width, height);
+
+	printf("%dx%d float BGRA, best of %d passes\n", width, height, passes);
+
+	Compare<half>("float->half", ConvertToHalf, frame, width, height, passes);
+	Compare<float>("float->float", ConvertToFloat, frame, width, height, passes);
+
+	return 0;
+}
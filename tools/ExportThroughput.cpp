@@ -0,0 +1,391 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2015, Brendan Bolles
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+//------------------------------------------
+//
+// ExportThroughput.cpp
+//
+// Times the sequence exporter's scheme outside of Premiere: several frames
+// compressing at once, each into its own OutputFile in memory, written to
+// disk in frame order.  Prints frames per second for each pipeline depth,
+// so you can see how it scales with the number of cores.
+//
+// Build against the same OpenEXR as the plug-in, for example:
+//
+//   c++ -O2 -Iext/openexr/IlmBase/Half -Iext/openexr/IlmBase/Iex
+//       -Iext/openexr/IlmBase/IlmThread -Iext/openexr/IlmBase/Imath
+//       -Iext/openexr/OpenEXR/IlmImf -I<config dir> tools/ExportThroughput.cpp
+//       -lIlmImf -lIlmThread -lIex -lHalf -lz -lpthread
+//
+// ExportThroughput [piz|dwaa|dwab|zip|zips|none] [frames] [max depth] [folder]
+//
+//------------------------------------------
+
+
+#include <ImfOutputFile.h>
+#include <ImfChannelList.h>
+#include <ImfFrameBuffer.h>
+#include <ImfStdIO.h>
+#include <ImfThreading.h>
+#include <IlmThread.h>
+#include <IlmThreadMutex.h>
+#include <IlmThreadSemaphore.h>
+#include <half.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <unistd.h>
+	#include <sys/time.h>
+#endif
+
+using namespace std;
+using namespace Imf;
+using namespace IlmThread;
+
+
+static const int kWidth = 1920;
+static const int kHeight = 1080;
+
+
+static double
+CurrentSeconds()
+{
+#ifdef _WIN32
+	LARGE_INTEGER count, freq;
+
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+
+	return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (double)tv.tv_sec + ((double)tv.tv_usec / 1000000.0);
+#endif
+}
+
+
+static int
+NumCPUs()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+
+	return info.dwNumberOfProcessors;
+#else
+	return sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+
+// Something like a render: smooth gradients with a little grain, so
+// the compressors have about as much work as they would on real frames.
+static void
+MakeFrame(vector<half> &pixels, int frame)
+{
+	pixels.resize((size_t)kWidth * kHeight * 4);
+
+	unsigned int seed = 1 + frame;
+
+	half *pix = &pixels[0];
+
+	for(int y=0; y < kHeight; y++)
+	{
+		for(int x=0; x < kWidth; x++)
+		{
+			seed = (seed * 1103515245) + 12345;
+
+			const float grain = ((float)((seed >> 16) & 0xff) / 255.f - 0.5f) * 0.02f;
+
+			const float u = (float)x / kWidth;
+			const float v = (float)y / kHeight;
+
+			*pix++ = u + grain;
+			*pix++ = v + grain;
+			*pix++ = 0.5f + 0.5f * sinf(10.f * (u + v) + frame * 0.1f) + grain;
+			*pix++ = 1.f;
+		}
+	}
+}
+
+
+static void
+EncodeFrame(StdOSStream &stream, const vector<half> &pixels, Compression compression)
+{
+	Header head(kWidth, kHeight);
+
+	head.compression() = compression;
+
+	const char *names[4] = { "R", "G", "B", "A" };
+
+	FrameBuffer frameBuffer;
+
+	for(int c=0; c < 4; c++)
+	{
+		head.channels().insert(names[c], Channel(HALF));
+
+		frameBuffer.insert(names[c], Slice(HALF, (char *)&pixels[c],
+											sizeof(half) * 4, sizeof(half) * 4 * kWidth));
+	}
+
+	OutputFile file(stream, head, globalThreadCount());
+
+	file.setFrameBuffer(frameBuffer);
+	file.writePixels(kHeight);
+}
+
+
+// One run of the pipeline.  Encoders take a slot before starting a frame,
+// and the slot comes back when the frame has been written, so only depth
+// frames are ever held in memory.
+class Pipeline
+{
+  public:
+	Pipeline(int depth, int frames, Compression compression, const string &folder);
+
+	void run();
+
+	bool nextFrame(int &frame);
+	void encoded(int frame, const string &data);
+
+	size_t bytesWritten() const { return _bytesWritten; }
+
+  private:
+	const int _depth;
+	const int _frames;
+	const Compression _compression;
+	const string _folder;
+
+	Mutex _mutex;
+	int _nextFrame;
+	vector<string> _encoded;
+	vector<bool> _ready;
+
+	Semaphore _slots;
+	Semaphore _finished;
+
+	size_t _bytesWritten;
+
+	friend class EncoderThread;
+};
+
+
+class EncoderThread : public Thread
+{
+  public:
+	EncoderThread(Pipeline &pipeline) : _pipeline(pipeline) { start(); }
+	virtual ~EncoderThread() {}
+
+	virtual void run();
+
+  private:
+	Pipeline &_pipeline;
+};
+
+
+void
+EncoderThread::run()
+{
+	vector<half> pixels;
+
+	int frame;
+
+	while( _pipeline.nextFrame(frame) )
+	{
+		// stands in for Premiere rendering the frame
+		MakeFrame(pixels, frame);
+
+		StdOSStream stream;
+
+		EncodeFrame(stream, pixels, _pipeline._compression);
+
+		_pipeline.encoded(frame, stream.str());
+	}
+}
+
+
+Pipeline::Pipeline(int depth, int frames, Compression compression, const string &folder) :
+	_depth(depth),
+	_frames(frames),
+	_compression(compression),
+	_folder(folder),
+	_nextFrame(0),
+	_encoded(frames),
+	_ready(frames, false),
+	_slots(depth),
+	_finished(0),
+	_bytesWritten(0)
+{
+
+}
+
+
+bool
+Pipeline::nextFrame(int &frame)
+{
+	_slots.wait();
+
+	Lock lock(_mutex);
+
+	if(_nextFrame >= _frames)
+	{
+		_slots.post(); // let the other encoders find out too
+
+		return false;
+	}
+
+	frame = _nextFrame++;
+
+	return true;
+}
+
+
+void
+Pipeline::encoded(int frame, const string &data)
+{
+	{
+		Lock lock(_mutex);
+
+		_encoded[frame] = data;
+		_ready[frame] = true;
+	}
+
+	_finished.post();
+}
+
+
+void
+Pipeline::run()
+{
+	vector<EncoderThread *> encoders;
+
+	for(int i=0; i < _depth; i++)
+		encoders.push_back(new EncoderThread(*this));
+
+	// files get written in frame order, whatever order they finish in
+	for(int frame=0; frame < _frames; frame++)
+	{
+		string data;
+
+		while(true)
+		{
+			{
+				Lock lock(_mutex);
+
+				if(_ready[frame])
+				{
+					data.swap(_encoded[frame]);
+					break;
+				}
+			}
+
+			// posted once for every frame that gets encoded
+			_finished.wait();
+		}
+
+		char path[1024];
+
+		sprintf(path, "%s/throughput_%04d.exr", _folder.c_str(), frame);
+
+		ofstream file(path, ios_base::binary);
+
+		file.write(data.data(), data.size());
+
+		_bytesWritten += data.size();
+
+		_slots.post();
+	}
+
+	for(int i=0; i < _depth; i++)
+		delete encoders[i];
+}
+
+
+static Compression
+CompressionNamed(const char *name)
+{
+	if(!strcmp(name, "none"))
+		return NO_COMPRESSION;
+	else if(!strcmp(name, "zips"))
+		return ZIPS_COMPRESSION;
+	else if(!strcmp(name, "zip"))
+		return ZIP_COMPRESSION;
+	else if(!strcmp(name, "dwaa"))
+		return DWAA_COMPRESSION;
+	else if(!strcmp(name, "dwab"))
+		return DWAB_COMPRESSION;
+	else
+		return PIZ_COMPRESSION;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	const char *compression_name = (argc > 1 ? argv[1] : "piz");
+	const int frames = (argc > 2 ? atoi(argv[2]) : 48);
+	const int max_depth = (argc > 3 ? atoi(argv[3]) : 16);
+	const string folder = (argc > 4 ? argv[4] : ".");
+
+	const Compression compression = CompressionNamed(compression_name);
+
+	const int cpus = NumCPUs();
+
+	setGlobalThreadCount(cpus);
+
+	printf("%d CPUs, %s, %d frames %dx%d half RGBA\n", cpus, compression_name, frames, kWidth, kHeight);
+
+	for(int depth=1; depth <= max_depth; depth *= 2)
+	{
+		Pipeline pipeline(depth, frames, compression, folder);
+
+		const double start = CurrentSeconds();
+
+		pipeline.run();
+
+		const double seconds = CurrentSeconds() - start;
+
+		printf("depth %2d: %6.2f fps, %7.1f MB/s written\n", depth,
+				(double)frames / seconds, (double)pipeline.bytesWritten() / (1024.0 * 1024.0) / seconds);
+	}
+
+	return 0;
+}